@@ -0,0 +1,51 @@
+// Lights sorted into clusters of the view frustum, or listed per object, see
+// Clusters.h. Needs lighting.glsl.
+const int CLUSTERS_X = 16;
+const int CLUSTERS_Y = 9;
+const int CLUSTERS_Z = 24;
+const int OBJECT_LIGHTS = 8;
+
+uniform samplerBuffer lightData;
+uniform usamplerBuffer clusters;
+uniform isamplerBuffer clusterLights;
+// Per instance transform, OBJECT_LIGHTS light indices ended by -1.
+uniform isamplerBuffer objectLights;
+// Directional lights, first in lightData, reach every cluster.
+uniform int globalLightCount;
+// Near and far distances of the depth slices.
+uniform vec2 clusterDepth;
+// Clusters per pixel, horizontally and vertically.
+uniform vec2 clusterScale;
+
+Light fetchLight(int index) {
+    int base = index * 6;
+    vec4 texels[6];
+    for (int i = 0; i < 6; i++) {
+        texels[i] = texelFetch(lightData, base + i);
+    }
+    Light light;
+    light.position = texels[0].xyz;
+    light.type = int(texels[0].w);
+    light.direction = texels[1].xyz;
+    light.ambient = texels[2].rgb;
+    light.cutOff = texels[2].w;
+    light.diffuse = texels[3].rgb;
+    light.outerCutOff = texels[3].w;
+    light.specular = texels[4].rgb;
+    light.constant = texels[4].w;
+    light.linear = texels[5].x;
+    light.quadratic = texels[5].y;
+    light.shadow = int(texels[5].z);
+    return light;
+}
+
+// Offset and count of the lights of the cluster the fragment is in.
+uvec2 clusterRange() {
+    float near = clusterDepth.x;
+    float far = clusterDepth.y;
+    float z = gl_FragCoord.z * 2.0f - 1.0f;
+    float viewDepth = (2.0f * near * far) / (far + near - z * (far - near));
+    int slice = clamp(int(log(viewDepth / near) / log(far / near) * CLUSTERS_Z), 0, CLUSTERS_Z - 1);
+    ivec2 tile = min(ivec2(gl_FragCoord.xy * clusterScale), ivec2(CLUSTERS_X - 1, CLUSTERS_Y - 1));
+    return texelFetch(clusters, (slice * CLUSTERS_Y + tile.y) * CLUSTERS_X + tile.x).xy;
+}
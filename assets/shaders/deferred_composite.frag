@@ -0,0 +1,18 @@
+#version 330 core
+
+in vec2 TexCoords;
+
+out vec4 FragColor;
+
+uniform sampler2D lighting;
+uniform sampler2D gDepth;
+
+// Copies the lit surfaces with their depth, so that the forward passes drawn
+// afterwards are hidden by them.
+void main() {
+    float depth = texture(gDepth, TexCoords).r;
+    if (depth == 1.0f)
+        discard; // nothing drawn, the background is kept
+    gl_FragDepth = depth;
+    FragColor = vec4(texture(lighting, TexCoords).rgb, 1.0f);
+}
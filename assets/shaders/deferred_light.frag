@@ -0,0 +1,41 @@
+#version 330 core
+
+out vec4 FragColor;
+
+#include "frame.glsl"
+#include "lighting.glsl"
+#include "shadows.glsl"
+
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedo;
+uniform sampler2D gSpecular;
+uniform sampler2D gDepth;
+
+uniform Light light;
+// Whether the light is the one casting the cascaded shadows. Other lights read
+// theirs from the atlas.
+uniform bool shadowed;
+uniform float shininess;
+
+void main() {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 albedo = texelFetch(gAlbedo, texel, 0);
+    if (albedo.a == 0.0f)
+        discard; // background, or a surface that is not lit
+
+    // World position from the depth of the surface.
+    float depth = texelFetch(gDepth, texel, 0).r;
+    vec2 ndc = gl_FragCoord.xy / vec2(textureSize(gDepth, 0)) * 2.0f - 1.0f;
+    vec4 position = inverseViewProjection * vec4(ndc, depth * 2.0f - 1.0f, 1.0f);
+
+    Surface surface;
+    surface.position = position.xyz / position.w;
+    surface.normal = texelFetch(gNormal, texel, 0).xyz;
+    surface.albedo = albedo.rgb;
+    surface.specular = texelFetch(gSpecular, texel, 0).rgb;
+    surface.shininess = shininess;
+
+    float shadow = shadowed ? calcShadow(surface.position, surface.normal)
+                            : calcLightShadow(light, surface.position, surface.normal);
+    FragColor = vec4(calcLight(light, surface, normalize(viewPos - surface.position), shadow), 1.0f);
+}
@@ -0,0 +1,22 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+
+// Point and spot lights cover the box of their range, directional lights the
+// whole screen.
+uniform bool volume;
+// Box of the light, bound by its offset in the frame ring buffer.
+layout (std140) uniform Volume {
+    mat4 model;
+};
+
+#include "frame.glsl"
+
+void main() {
+    if (volume) {
+        gl_Position = viewProjection * model * vec4(aPos, 1.0f);
+    } else {
+        vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+        gl_Position = vec4(position * 2.0f - 1.0f, 0.0f, 1.0f);
+    }
+}
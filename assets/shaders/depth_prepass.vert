@@ -0,0 +1,16 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+
+#include "frame.glsl"
+
+#include "transforms.glsl"
+
+// Computed exactly like object.vert: the shading pass tests its depth for
+// equality with this one.
+invariant gl_Position;
+
+void main() {
+    vec4 worldPos = instanceModel() * vec4(aPos, 1.0f);
+    gl_Position = projection * view * worldPos;
+}
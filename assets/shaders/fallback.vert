@@ -0,0 +1,11 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+
+#include "frame.glsl"
+
+#include "transforms.glsl"
+
+void main() {
+    gl_Position = projection * view * instanceModel() * vec4(aPos, 1.0f);
+}
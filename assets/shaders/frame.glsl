@@ -0,0 +1,9 @@
+// Constants of the camera, written once per frame into the frame ring buffer
+// and bound to FRAME_BLOCK_BINDING. Layout of FrameConstants.
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 inverseViewProjection;
+    vec3 viewPos;
+};
@@ -0,0 +1,10 @@
+#version 330 core
+
+out vec2 TexCoords;
+
+// A single triangle covering the screen.
+void main() {
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    TexCoords = position;
+    gl_Position = vec4(position * 2.0f - 1.0f, 0.0f, 1.0f);
+}
@@ -0,0 +1,35 @@
+#version 330 core
+
+out ivec2 Seed;
+
+// Nearest seed found so far by each pixel, -1 without one.
+uniform isampler2D seeds;
+uniform int stepSize;
+
+// Keeps the nearest of the seeds found by the pixel and by its 8 neighbours
+// stepSize pixels away.
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(seeds, 0);
+    Seed = ivec2(-1);
+    int nearest = 0x7FFFFFFF;
+    for (int y = -1; y <= 1; y++)
+    {
+        for (int x = -1; x <= 1; x++)
+        {
+            ivec2 neighbour = pixel + ivec2(x, y) * stepSize;
+            if (any(lessThan(neighbour, ivec2(0))) || any(greaterThanEqual(neighbour, size)))
+                continue;
+            ivec2 seed = texelFetch(seeds, neighbour, 0).xy;
+            if (seed.x < 0)
+                continue;
+            ivec2 offset = seed - pixel;
+            int distance = offset.x * offset.x + offset.y * offset.y;
+            if (distance < nearest)
+            {
+                nearest = distance;
+                Seed = seed;
+            }
+        }
+    }
+}
@@ -2,10 +2,10 @@
 
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include "frame.glsl"
+
+#include "transforms.glsl"
 
 void main() {
-    gl_Position = projection * view * model * vec4(aPos, 1.0f);
+    gl_Position = projection * view * instanceModel() * vec4(aPos, 1.0f);
 }
\ No newline at end of file
@@ -0,0 +1,120 @@
+// Phong lighting shared by the forward and the deferred paths. Surfaces are
+// described by their diffuse and specular colors, already read from their
+// textures. Shadow is the fraction of the direct light reaching the surface,
+// ambient light is never shadowed.
+struct Light {
+    int type;
+
+    vec3 direction;
+    vec3 position;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+
+    float cutOff;
+    float outerCutOff;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    // First view in the shadow atlas, -1 without a shadow.
+    int shadow;
+};
+
+struct Surface {
+    vec3 position;
+    vec3 normal;
+    vec3 albedo;
+    vec3 specular;
+    float shininess;
+};
+
+vec3 calcDirLight(Light light, Surface surface, vec3 viewDir, float shadow)
+{
+    // ambient
+    vec3 ambient = light.ambient * surface.albedo;
+
+    // diffuse
+    vec3 lightDir = normalize(-light.direction);
+    float diff = max(dot(surface.normal, lightDir), 0.0f);
+    vec3 diffuse = light.diffuse * diff * surface.albedo;
+
+    // specular
+    vec3 reflectDir = reflect(-lightDir, surface.normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0f), surface.shininess);
+    vec3 specular = surface.specular * spec * light.specular;
+
+    vec3 result = ambient + (diffuse + specular) * shadow;
+    return result;
+}
+
+vec3 calcPointLight(Light light, Surface surface, vec3 viewDir, float shadow)
+{
+    // ambient
+    vec3 ambient = light.ambient * surface.albedo;
+
+    // diffuse
+    vec3 lightDir = normalize(light.position - surface.position);
+    float diff = max(dot(surface.normal, lightDir), 0.0f);
+    vec3 diffuse = light.diffuse * diff * surface.albedo;
+
+    // specular
+    vec3 reflectDir = reflect(-lightDir, surface.normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0f), surface.shininess);
+    vec3 specular = surface.specular * spec * light.specular;
+
+    vec3 result = ambient + (diffuse + specular) * shadow;
+
+    float distance = length(light.position - surface.position);
+    float attenuation = 1.0f / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    return result * attenuation;
+}
+
+vec3 calcSpotLight(Light light, Surface surface, vec3 viewDir, float shadow)
+{
+    // ambient
+    vec3 result = light.ambient * surface.albedo;
+
+    vec3 lightDir = normalize(light.position - surface.position);
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0f, 1.0f);
+    if (intensity > 0.0f) {
+        // diffuse
+        float diff = max(dot(surface.normal, lightDir), 0.0f);
+        vec3 diffuse = light.diffuse * diff * surface.albedo;
+
+        // specular
+        vec3 reflectDir = reflect(-lightDir, surface.normal);
+        float spec = pow(max(dot(viewDir, reflectDir), 0.0f), surface.shininess);
+        vec3 specular = surface.specular * spec * light.specular;
+
+        result += (diffuse + specular) * intensity * shadow;
+    }
+
+    float distance = length(light.position - surface.position);
+    float attenuation = 1.0f / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    return result * attenuation;
+}
+
+vec3 calcLight(Light light, Surface surface, vec3 viewDir, float shadow)
+{
+    if (light.type == 0) {
+        return calcDirLight(light, surface, viewDir, shadow);
+    }
+    else if (light.type == 1) {
+        return calcPointLight(light, surface, viewDir, shadow);
+    }
+    else if (light.type == 2) {
+        return calcSpotLight(light, surface, viewDir, shadow);
+    }
+    // Unsupported light type, skip
+    return vec3(0.0f);
+}
+
+vec3 calcLight(Light light, Surface surface, vec3 viewDir)
+{
+    return calcLight(light, surface, viewDir, 1.0f);
+}
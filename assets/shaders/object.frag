@@ -3,8 +3,16 @@
 in vec3 Normal;
 in vec3 FragPos;
 in vec2 TexCoords;
+flat in int ObjectIndex;
 
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+// Sum of the weights of transparent fragments, with weighted blended transparency only.
+layout (location = 1) out float AlphaWeight;
+// G-buffer, with deferred shading only. FragColor then receives the light emitted by the surface.
+layout (location = 2) out vec4 GNormal;
+layout (location = 3) out vec4 GAlbedo;
+layout (location = 4) out vec4 GSpecular;
+layout (location = 5) out float GDepth;
 
 struct Material {
     sampler2D texture_diffuse1;
@@ -14,74 +22,120 @@ struct Material {
     float shininess;
 };
 
-struct Light {
-    int type;
-
-    vec3 direction;
-    vec3 position;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-
-    float cutOff;
-    float outerCutOff;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
+#include "frame.glsl"
+#include "lighting.glsl"
+#include "clusters.glsl"
+#include "shadows.glsl"
 
 uniform Material material;
 uniform bool emission;
-uniform vec3 viewPos;
 uniform Light lights[30];
 uniform int lightCount;
 uniform bool showDepth;
+// Writes the ID of the instance to the outline mask, see Outline.h.
 uniform bool outline;
-uniform vec3 outlineColor;
-uniform bool isGrass;
-
-uniform sampler2D grass;
+// Blended unlit texture, such as foliage or windows.
+uniform bool transparent;
+// Transparent fragments are accumulated rather than blended in order, see Oit.h.
+uniform bool weightedBlended;
+// Opaque surfaces are written to the G-buffer and lit afterwards, see Deferred.h.
+uniform bool deferred;
+// Where lights are read from, see LightCulling in Clusters.h: 0 for lights, 1
+// for the cluster of the fragment, 2 for the list of the object.
+uniform int lightCulling;
+
+uniform sampler2D transparentTexture;
 
 float LinearizeDepth(float depth);
 float near = 0.1f;
 float far = 100.0f;
 
-vec3 calcDirLight(Light light, vec3 normal, vec3 viewDir);
-vec3 calcPointLight(Light light, vec3 normal, vec3 viewDir);
-vec3 calcSpotLight(Light light, vec3 normal, vec3 viewDir);
+// Lights come in the order of LightManager::forEachActive whatever the path:
+// the first directional one is the one casting the cascaded shadows. Point and
+// spot lights read theirs from the atlas.
+bool shadowPending = true;
+
+float lightShadow(Light light, Surface surface)
+{
+    if (light.type != 0)
+        return calcLightShadow(light, surface.position, surface.normal);
+    if (!shadowPending)
+        return 1.0f;
+    shadowPending = false;
+    return calcShadow(surface.position, surface.normal);
+}
 
 void main() {
-    if (isGrass)
+    // Surfaces that are not lit leave nothing for the light passes.
+    GNormal = vec4(0.0f);
+    GAlbedo = vec4(0.0f);
+    GSpecular = vec4(0.0f);
+    GDepth = gl_FragCoord.z;
+
+    if (outline)
+    {
+        FragColor = vec4(float(ObjectIndex + 1), 0.0f, 0.0f, 1.0f);
+    }
+    else if (transparent)
     {
-        vec4 texColor = texture(grass, TexCoords);
+        vec4 texColor = texture(transparentTexture, TexCoords);
         if (texColor.a < 0.1) discard;
-        FragColor = texColor;
+        if (weightedBlended) {
+            // Nearer and more opaque fragments weigh more.
+            float weight = clamp(pow(min(1.0f, texColor.a * 10.0f) + 0.01f, 3.0f) * 1e8f
+                                 * pow(1.0f - gl_FragCoord.z * 0.9f, 3.0f), 1e-2f, 3e3f);
+            FragColor = vec4(texColor.rgb * texColor.a * weight, texColor.a);
+            AlphaWeight = texColor.a * weight;
+        } else {
+            FragColor = texColor;
+        }
     }
     else if (showDepth)
     {
         float depth = LinearizeDepth(gl_FragCoord.z) / far;
         FragColor = vec4(vec3(depth), 1.0f);
-    } else if (outline) {
-        FragColor = vec4(outlineColor, 1.0f);
     } else {
-        vec3 norm = normalize(Normal);
-        vec3 viewDir = normalize(viewPos - FragPos);
+        Surface surface;
+        surface.position = FragPos;
+        surface.normal = normalize(Normal);
+        surface.albedo = texture(material.texture_diffuse1, TexCoords).rgb;
+        surface.specular = texture(material.texture_specular1, TexCoords).rgb;
+        surface.shininess = material.shininess;
+
         vec3 result = vec3(0.0f);
-        for (int i = 0; i < lightCount; i++)
-        {
-            if (lights[i].type == 0) {
-                result += calcDirLight(lights[i], norm, viewDir);
-            }
-            else if (lights[i].type == 1) {
-                result += calcPointLight(lights[i], norm, viewDir);
+        if (deferred) {
+            GNormal = vec4(surface.normal, 0.0f);
+            GAlbedo = vec4(surface.albedo, 1.0f);
+            GSpecular = vec4(surface.specular, 1.0f);
+        } else if (lightCulling != 0) {
+            vec3 viewDir = normalize(viewPos - FragPos);
+            for (int i = 0; i < globalLightCount; i++)
+            {
+                Light light = fetchLight(i);
+                result += calcLight(light, surface, viewDir, lightShadow(light, surface));
             }
-            else if (lights[i].type == 2) {
-                result += calcSpotLight(lights[i], norm, viewDir);
+            if (lightCulling == 1) {
+                uvec2 range = clusterRange();
+                for (uint i = 0u; i < range.y; i++)
+                {
+                    Light light = fetchLight(texelFetch(clusterLights, int(range.x + i)).r);
+                    result += calcLight(light, surface, viewDir, lightShadow(light, surface));
+                }
             } else {
-                // Unsupported light type, skip
-                continue;
+                for (int i = 0; i < OBJECT_LIGHTS; i++)
+                {
+                    int index = texelFetch(objectLights, ObjectIndex * OBJECT_LIGHTS + i).r;
+                    if (index < 0)
+                        break;
+                    Light light = fetchLight(index);
+                    result += calcLight(light, surface, viewDir, lightShadow(light, surface));
+                }
+            }
+        } else {
+            vec3 viewDir = normalize(viewPos - FragPos);
+            for (int i = 0; i < lightCount; i++)
+            {
+                result += calcLight(lights[i], surface, viewDir, lightShadow(lights[i], surface));
             }
         }
 
@@ -104,71 +158,3 @@ float LinearizeDepth(float depth)
     float z = depth * 2.0f - 1.0f;
     return (2.0f * near * far) / (far + near - z * (far - near));
 }
-
-vec3 calcDirLight(Light light, vec3 normal, vec3 viewDir)
-{
-    // ambient
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-
-    // diffuse
-    vec3 lightDir = normalize(-light.direction);
-    float diff = max(dot(normal, lightDir), 0.0f);
-    vec3 diffuse = light.diffuse * diff * texture(material.texture_diffuse1, TexCoords).rgb;
-
-    // specular
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0f), material.shininess);
-    vec3 specular = texture(material.texture_specular1, TexCoords).rgb * spec * light.specular;
-
-    vec3 result = ambient + diffuse + specular;
-    return result;
-}
-
-vec3 calcPointLight(Light light, vec3 normal, vec3 viewDir)
-{
-    // ambient
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-
-    // diffuse
-    vec3 lightDir = normalize(light.position - FragPos);
-    float diff = max(dot(normal, lightDir), 0.0f);
-    vec3 diffuse = light.diffuse * diff * texture(material.texture_diffuse1, TexCoords).rgb;
-
-    // specular
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0f), material.shininess);
-    vec3 specular = texture(material.texture_specular1, TexCoords).rgb * spec * light.specular;
-
-    vec3 result = ambient + diffuse + specular;
-
-    float distance = length(light.position - FragPos);
-    float attenuation = 1.0f / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-    return result * attenuation;
-}
-
-vec3 calcSpotLight(Light light, vec3 normal, vec3 viewDir)
-{
-    // ambient
-    vec3 result = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-
-    vec3 lightDir = normalize(light.position - FragPos);
-    float theta = dot(lightDir, normalize(-light.direction));
-    float epsilon = light.cutOff - light.outerCutOff;
-    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0f, 1.0f);
-    if (intensity > 0.0f) {
-        // diffuse
-        float diff = max(dot(normal, lightDir), 0.0f);
-        vec3 diffuse = light.diffuse * diff * texture(material.texture_diffuse1, TexCoords).rgb;
-
-        // specular
-        vec3 reflectDir = reflect(-lightDir, normal);
-        float spec = pow(max(dot(viewDir, reflectDir), 0.0f), material.shininess);
-        vec3 specular = texture(material.texture_specular1, TexCoords).rgb * spec * light.specular;
-
-        result += (diffuse + specular) * intensity;
-    }
-
-    float distance = length(light.position - FragPos);
-    float attenuation = 1.0f / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-    return result * attenuation;
-}
@@ -7,16 +7,21 @@ layout (location = 2) in vec2 aTexCoords;
 out vec3 Normal;
 out vec3 FragPos;
 out vec2 TexCoords;
+// Transform of the instance, whose lights are listed in objectLights.
+flat out int ObjectIndex;
 
-uniform mat3 normalMatrix;
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include "frame.glsl"
+
+#include "transforms.glsl"
+
+// Opaque objects may be shaded with GL_EQUAL against depth_prepass.vert.
+invariant gl_Position;
 
 void main() {
-    vec4 worldPos = model * vec4(aPos, 1.0f);
-    Normal = normalMatrix * aNormal;
+    vec4 worldPos = instanceModel() * vec4(aPos, 1.0f);
+    Normal = instanceNormalMatrix() * aNormal;
     FragPos = vec3(worldPos);
     TexCoords = aTexCoords;
+    ObjectIndex = instanceTransform();
     gl_Position = projection * view * worldPos;
-}
\ No newline at end of file
+}
@@ -0,0 +1,19 @@
+#version 330 core
+
+in vec2 TexCoords;
+
+out vec4 FragColor;
+
+uniform sampler2D accumulation;
+uniform sampler2D alphaWeights;
+
+void main() {
+    vec4 accum = texture(accumulation, TexCoords);
+    float revealage = accum.a;
+    if (revealage == 1.0f)
+        discard; // nothing transparent covers the pixel
+
+    // Weighted average of the layers, blended over the frame by their total coverage.
+    float weights = max(texture(alphaWeights, TexCoords).r, 1e-5f);
+    FragColor = vec4(accum.rgb / weights, 1.0f - revealage);
+}
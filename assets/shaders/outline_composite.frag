@@ -0,0 +1,35 @@
+#version 330 core
+
+out vec4 FragColor;
+
+uniform sampler2D mask;
+// Nearest edge of every pixel, from the jump flood.
+uniform isampler2D seeds;
+uniform vec3 outlineColor;
+// In pixels.
+uniform float thickness;
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float id = texelFetch(mask, pixel, 0).r;
+    float coverage = 0.0f;
+    if (id == 0.0f)
+    {
+        // Outside the silhouettes, smoothed over the last pixel.
+        ivec2 seed = texelFetch(seeds, pixel, 0).xy;
+        if (seed.x >= 0)
+            coverage = clamp(thickness + 1.0f - distance(vec2(seed), vec2(pixel)), 0.0f, 1.0f);
+    }
+    else
+    {
+        // Touching outlined instances are separated by a line, on one side.
+        ivec2 last = textureSize(mask, 0) - 1;
+        float right = texelFetch(mask, min(pixel + ivec2(1, 0), last), 0).r;
+        float up = texelFetch(mask, min(pixel + ivec2(0, 1), last), 0).r;
+        if ((right != 0.0f && right != id) || (up != 0.0f && up != id))
+            coverage = 1.0f;
+    }
+    if (coverage == 0.0f)
+        discard;
+    FragColor = vec4(outlineColor, coverage);
+}
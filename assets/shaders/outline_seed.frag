@@ -0,0 +1,27 @@
+#version 330 core
+
+out ivec2 Seed;
+
+// IDs of the outlined instances, 0 elsewhere.
+uniform sampler2D mask;
+
+// Pixels of an instance next to a pixel of another one, or of none, are the
+// edges outlines are measured from. Other pixels get no seed.
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    ivec2 last = textureSize(mask, 0) - 1;
+    float id = texelFetch(mask, pixel, 0).r;
+    Seed = ivec2(-1);
+    if (id == 0.0f)
+        return;
+    // The border of the screen is not an edge.
+    ivec2 neighbours[4] = ivec2[](ivec2(-1, 0), ivec2(1, 0), ivec2(0, -1), ivec2(0, 1));
+    for (int i = 0; i < 4; i++)
+    {
+        if (texelFetch(mask, clamp(pixel + neighbours[i], ivec2(0), last), 0).r != id)
+        {
+            Seed = pixel;
+            return;
+        }
+    }
+}
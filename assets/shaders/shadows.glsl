@@ -0,0 +1,98 @@
+// Cascaded shadow map of the first directional light, see Shadows.h.
+const int SHADOW_CASCADES = 4;
+
+uniform sampler2DArrayShadow shadowMap;
+uniform bool shadows;
+uniform mat4 shadowMatrices[SHADOW_CASCADES];
+// Distance receivers are moved along their normal before the lookup, about a
+// texel of each cascade, against acne on surfaces at grazing angles.
+uniform float shadowOffsets[SHADOW_CASCADES];
+uniform float shadowBias;
+
+// Fraction of the light reaching the position, from the first cascade covering
+// it. Positions outside every cascade are lit.
+float calcShadow(vec3 position, vec3 normal)
+{
+    if (!shadows)
+        return 1.0f;
+    vec2 texel = 1.0f / vec2(textureSize(shadowMap, 0).xy);
+    for (int i = 0; i < SHADOW_CASCADES; i++)
+    {
+        vec4 clip = shadowMatrices[i] * vec4(position + normal * shadowOffsets[i], 1.0f);
+        vec3 coords = clip.xyz * 0.5f + 0.5f;
+        // The taps below reach a texel and a half away.
+        if (any(lessThan(coords.xy, 2.0f * texel)) || any(greaterThan(coords.xy, 1.0f - 2.0f * texel))
+            || coords.z < 0.0f || coords.z > 1.0f)
+            continue;
+
+        // Four bilinear comparisons, 4x4 texels in all.
+        float lit = 0.0f;
+        for (int x = -1; x <= 1; x += 2)
+        {
+            for (int y = -1; y <= 1; y += 2)
+            {
+                vec2 uv = coords.xy + vec2(x, y) * texel;
+                lit += texture(shadowMap, vec4(uv, float(i), coords.z - shadowBias));
+            }
+        }
+        return lit * 0.25f;
+    }
+    return 1.0f;
+}
+
+// Shadow atlas of point and spot lights, see Shadows.h. Per view, 6 texels:
+// the matrix to atlas coordinates, the tile (min and max coordinates), and the
+// size of a texel at unit distance from the light.
+uniform sampler2DShadow shadowAtlas;
+uniform samplerBuffer shadowViews;
+// In texels, scaled by the distance to the light.
+uniform float shadowAtlasOffset;
+uniform float shadowAtlasBias;
+
+// Fraction of the light reaching the position, from the view of the light
+// looking at it. Lights without a shadow, needing lighting.glsl, light it all.
+float calcLightShadow(Light light, vec3 position, vec3 normal)
+{
+    if (light.shadow < 0)
+        return 1.0f;
+    vec3 toPosition = position - light.position;
+    int shadowView = light.shadow;
+    if (light.type == 1)
+    {
+        // Cube faces in the order +x, -x, +y, -y, +z, -z.
+        vec3 axis = abs(toPosition);
+        if (axis.x >= axis.y && axis.x >= axis.z)
+            shadowView += toPosition.x >= 0.0f ? 0 : 1;
+        else if (axis.y >= axis.z)
+            shadowView += toPosition.y >= 0.0f ? 2 : 3;
+        else
+            shadowView += toPosition.z >= 0.0f ? 4 : 5;
+    }
+    int base = shadowView * 6;
+    mat4 matrix = mat4(texelFetch(shadowViews, base), texelFetch(shadowViews, base + 1),
+                       texelFetch(shadowViews, base + 2), texelFetch(shadowViews, base + 3));
+    vec4 tile = texelFetch(shadowViews, base + 4);
+    float texelScale = texelFetch(shadowViews, base + 5).x;
+
+    float offset = length(toPosition) * texelScale * shadowAtlasOffset;
+    vec4 clip = matrix * vec4(position + normal * offset, 1.0f);
+    vec3 coords = clip.xyz / clip.w;
+    if (clip.w <= 0.0f || coords.z > 1.0f)
+        return 1.0f;
+
+    // Four bilinear comparisons as above, kept inside the tile: its neighbours
+    // belong to other views.
+    vec2 texel = 1.0f / vec2(textureSize(shadowAtlas, 0));
+    vec2 low = tile.xy + 1.5f * texel;
+    vec2 high = tile.zw - 1.5f * texel;
+    float lit = 0.0f;
+    for (int x = -1; x <= 1; x += 2)
+    {
+        for (int y = -1; y <= 1; y += 2)
+        {
+            vec2 uv = clamp(coords.xy + vec2(x, y) * texel, low, high);
+            lit += texture(shadowAtlas, vec3(uv, coords.z - shadowAtlasBias));
+        }
+    }
+    return lit * 0.25f;
+}
@@ -0,0 +1,35 @@
+// Per-instance transforms written by the render queue: 7 texels per instance,
+// the model matrix followed by the normal matrix columns.
+uniform samplerBuffer transforms;
+uniform int baseInstance;
+// Draws merged into a multi-draw have different base instances: the index of
+// each instance, base included, is read from an attribute instead.
+layout (location = 3) in int aInstance;
+uniform bool multiDraw;
+// Remapped instances look their transform up in a list starting at
+// baseInstance: the visible instances of indirect draws, filled on the GPU, or
+// transparent instances in back to front order.
+uniform isamplerBuffer instanceIndices;
+uniform bool remapInstances;
+
+int instanceTransform() {
+    int instance = multiDraw ? aInstance : baseInstance + gl_InstanceID;
+    if (remapInstances)
+        return texelFetch(instanceIndices, instance).r;
+    return instance;
+}
+
+mat4 instanceModel() {
+    int base = instanceTransform() * 7;
+    return mat4(texelFetch(transforms, base),
+                texelFetch(transforms, base + 1),
+                texelFetch(transforms, base + 2),
+                texelFetch(transforms, base + 3));
+}
+
+mat3 instanceNormalMatrix() {
+    int base = instanceTransform() * 7 + 4;
+    return mat3(texelFetch(transforms, base).xyz,
+                texelFetch(transforms, base + 1).xyz,
+                texelFetch(transforms, base + 2).xyz);
+}
@@ -14,6 +14,12 @@ const std::string ASSETS_DIR = "assets/";
 const std::string SHADER_DIR = ASSETS_DIR + "shaders/";
 const std::string TEXTURE_DIR = ASSETS_DIR + "textures/";
 
+constexpr float NEAR_PLANE = 0.1f;
+constexpr float FAR_PLANE = 100.0f;
+
+// Bytes of per-frame GPU data, grown when a frame needs more.
+constexpr GLsizeiptr FRAME_RING_SIZE = 64 * 1024;
+
 constexpr auto UNLOCK_KEY = GLFW_KEY_LEFT_SHIFT;
 constexpr auto FORWARD_KEY = GLFW_KEY_W;
 constexpr auto BACKWARD_KEY = GLFW_KEY_S;
@@ -23,7 +29,14 @@ constexpr auto UP_KEY = GLFW_KEY_SPACE;
 constexpr auto DOWN_KEY = GLFW_KEY_LEFT_CONTROL;
 constexpr auto EXIT_KEY = GLFW_KEY_ESCAPE;
 
-Application::Application() : m_window{this}, m_grassTexture(TEXTURE_DIR + "grass.png") {
+Application::Application()
+    : m_window{this}, m_shaderManager{SHADER_DIR + "fallback.vert", SHADER_DIR + "fallback.frag"},
+      m_modelManager{m_threadPool, m_shaderManager}, m_frameRing{FRAME_RING_SIZE},
+      m_oit{m_shaderManager, SHADER_DIR},
+      m_deferred{m_shaderManager, SHADER_DIR}, m_clusters{m_threadPool},
+      m_outline{m_shaderManager, SHADER_DIR},
+      m_vegetation{TEXTURE_DIR + "grass.png"},
+      m_glass{TEXTURE_DIR + "blending_transparent_window.png"} {
   IMGUI_CHECKVERSION();
   ImGui::CreateContext();
   ImGuiIO &io = ImGui::GetIO();
@@ -31,13 +44,16 @@ Application::Application() : m_window{this}, m_grassTexture(TEXTURE_DIR + "grass
   ImGui_ImplGlfw_InitForOpenGL(m_window.getHandle(), true);
   ImGui_ImplOpenGL3_Init("#version 330 core");
 
+  // Programs are compiled in the background, the first frames use the fallback.
   try {
-    const auto objectShader =
-        Shader(SHADER_DIR + "object.vert", SHADER_DIR + "object.frag");
-    const auto lightShader =
-        Shader(SHADER_DIR + "light.vert", SHADER_DIR + "light.frag");
-    m_shaders["object"] = std::make_unique<Shader>(objectShader);
-    m_shaders["light"] = std::make_unique<Shader>(lightShader);
+    m_shaderManager.add("object", SHADER_DIR + "object.vert",
+                        SHADER_DIR + "object.frag");
+    m_shaderManager.add("light", SHADER_DIR + "light.vert",
+                        SHADER_DIR + "light.frag");
+    m_shaderManager.add("depth_prepass", SHADER_DIR + "depth_prepass.vert",
+                        SHADER_DIR + "depth_prepass.frag");
+    m_shaderManager.add("shadow_depth", SHADER_DIR + "shadow_depth.vert",
+                        SHADER_DIR + "shadow_depth.frag");
   } catch (const std::exception &e) {
     std::cerr << e.what() << std::endl;
     throw;
@@ -46,36 +62,6 @@ Application::Application() : m_window{this}, m_grassTexture(TEXTURE_DIR + "grass
   m_lightManager.add(std::make_unique<DirectionalLight>(glm::vec3(-1.0f)));
   m_lightManager.add(
     std::make_unique<PointLight>(glm::vec3(1.0f, 2.0f, -2.0f)));
-
-  // Grass rendering setup.
-  m_grassTexture.setWrap(Texture::Wrap::ClampToEdge, Texture::Wrap::ClampToEdge);
-  m_transparentVertices = {
-    0.0f, 0.5f, 0.0f, 0.0f, 0.0f,
-    0.0f, -0.5f, 0.0f, 0.0f, 1.0f,
-    1.0f, -0.5f, 0.0f, 1.0f, 1.0f,
-
-    0.0f, 0.5f, 0.0f, 0.0f, 0.0f,
-    1.0f, -0.5f, 0.0f, 1.0f, 1.0f,
-    1.0f, 0.5f, 0.0f, 1.0f, 0.0f
-  };
-  glGenVertexArrays(1, &m_transparentVao);
-  glGenBuffers(1, &m_transparentVbo);
-  glBindVertexArray(m_transparentVao);
-  glBindBuffer(GL_ARRAY_BUFFER, m_transparentVbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(m_transparentVertices), m_transparentVertices.data(), GL_STATIC_DRAW);
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), static_cast<void *>(nullptr));
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), reinterpret_cast<void *>(3 * sizeof(float)));
-  glBindVertexArray(0);
-  m_vegetationPos =
-  {
-    glm::vec3(-1.5f, 0.0f, -0.48f),
-    glm::vec3(1.5f, 0.0f, 0.51f),
-    glm::vec3(0.0f, 0.0f, 0.7f),
-    glm::vec3(-0.3f, 0.0f, -2.3f),
-    glm::vec3(0.5f, 0.0f, -0.6f)
-  };
 }
 
 Application::~Application() {
@@ -91,6 +77,8 @@ void Application::mainLoop() {
 
   processInput();
 
+  m_shaderManager.poll();
+
   widgets();
 
   m_state.wireframe
@@ -99,53 +87,114 @@ void Application::mainLoop() {
 
   m_state.depthTesting ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST);
   glDepthFunc(m_state.depthFn);
-  glEnable(GL_STENCIL_TEST);
 
   const auto &bgColor = m_window.getBgColor();
   glClearColor(bgColor.r, bgColor.g, bgColor.b, 1.0f);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   const auto viewPos = m_cameraManager.getActiveCamera()->getPosition();
   const auto view = m_cameraManager.getActiveCamera()->lookAt();
+  const auto aspect = static_cast<float>(m_window.getWidth()) /
+                      static_cast<float>(m_window.getHeight());
   const auto projection =
-      glm::perspective(glm::radians(m_cameraManager.getFov()),
-                       static_cast<float>(m_window.getWidth()) /
-                       static_cast<float>(m_window.getHeight()),
-                       0.1f, 100.0f);
-
-  // Render the light sources.
-  const auto &lightShader = m_shaders["light"];
-  lightShader->use();
-  lightShader->setMat4("view", view);
-  lightShader->setMat4("projection", projection);
+      glm::perspective(glm::radians(m_cameraManager.getFov()), aspect,
+                       NEAR_PLANE, FAR_PLANE);
+
+  // Camera constants, read by every program including frame.glsl.
+  m_state.viewProjection = projection * view;
+  m_frameRing.beginFrame();
+  const FrameConstants frame{view, projection, m_state.viewProjection,
+                             glm::inverse(m_state.viewProjection),
+                             glm::vec4(viewPos, 1.0f)};
+  m_frameRing.bindRange(
+      GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING,
+      m_frameRing.write(frame, RingBuffer::getUniformAlignment()));
+
+  // Per-frame uniforms, per-draw ones are set by the render queue.
+  const auto lightShader = m_shaderManager.get("light");
+  lightShader->setBlockBinding("Frame", FRAME_BLOCK_BINDING);
   m_lightManager.update(m_cameraManager.getActiveCamera());
-  m_lightManager.draw(lightShader.get());
+  m_modelManager.update();
+
+  // Shadows are drawn first: lights get their shadow index from the atlas.
+  m_shadows.update(m_lightManager, view, m_cameraManager.getFov(), aspect,
+                   NEAR_PLANE, FAR_PLANE);
+  m_atlas.update(m_lightManager, m_state.viewProjection, viewPos,
+                 m_cameraManager.getFov(), m_window.getHeight());
+  m_modelManager.submitShadowCasters(m_shadows);
+  m_modelManager.submitShadowCasters(m_atlas);
+  // Both draw with the same program, not with the fallback.
+  const auto shadowShader = m_shaderManager.isReady("shadow_depth")
+                                ? m_shaderManager.get("shadow_depth")
+                                : nullptr;
+  m_shadows.render(shadowShader, m_frameRing);
+  m_atlas.render(m_lightManager, shadowShader, m_frameRing);
 
-  // Draw the objects.
-  const auto &objectShader = m_shaders["object"];
+  const auto objectShader = m_shaderManager.get("object");
   objectShader->use();
-  objectShader->setFloat("material.shininess", 32);
-  objectShader->setVec3("viewPos", viewPos);
+  constexpr float shininess = 32.0f;
+  objectShader->setFloat("material.shininess", shininess);
   objectShader->setBool("emission", m_state.emission);
-  objectShader->setMat4("view", view);
-  objectShader->setMat4("projection", projection);
+  objectShader->setBlockBinding("Frame", FRAME_BLOCK_BINDING);
   objectShader->setBool("showDepth", m_state.showDepth);
-  m_lightManager.setShaderUniforms(objectShader.get());
-  m_modelManager.draw(objectShader.get());
+  // Forward shading until the deferred programs are linked.
+  const auto deferred = m_state.deferred && m_deferred.isReady();
+  objectShader->setBool("deferred", deferred);
+  const auto lightCulling =
+      deferred ? LightCulling::None : m_state.lightCulling;
+  objectShader->setInt("lightCulling", static_cast<int>(lightCulling));
+  if (lightCulling != LightCulling::None)
+    m_clusters.build(m_lightManager, lightCulling, view,
+                     m_cameraManager.getFov(), aspect, NEAR_PLANE, FAR_PLANE);
+  m_clusters.bind(objectShader);
+  m_shadows.bind(objectShader);
+  m_atlas.bind(objectShader);
+  m_lightManager.setShaderUniforms(objectShader);
+  m_modelManager.setShaderUniforms(objectShader);
 
-  // Render grass (blending example).
-  objectShader->use();
-  m_grassTexture.setUnit(0);
-  objectShader->setInt("grass", 0);
-  objectShader->setBool("isGrass", true);
-  glBindVertexArray(m_transparentVao);
-  for (auto pos: m_vegetationPos) {
-    auto model = glm::mat4(1.0f);
-    model = glm::translate(model, pos);
-    objectShader->setMat4("model", model);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+  const Frustum frustum(m_state.viewProjection);
+  m_renderQueue.setMultiDraw(m_state.multiDraw);
+  m_renderQueue.setRingBuffer(&m_frameRing);
+  // Positions must be computed by both programs, not by the fallback.
+  if (m_state.depthPrepass && m_shaderManager.getPendingCount() == 0) {
+    const auto depthShader = m_shaderManager.get("depth_prepass");
+    depthShader->setBlockBinding("Frame", FRAME_BLOCK_BINDING);
+    m_renderQueue.setDepthPrepass(depthShader);
+  } else {
+    m_renderQueue.setDepthPrepass(nullptr);
   }
-  objectShader->setBool("isGrass", false);
+  m_renderQueue.setWeightedBlended(
+      m_state.weightedBlended && m_oit.isReady() ? &m_oit : nullptr);
+  m_renderQueue.begin(viewPos, FAR_PLANE);
+  if (deferred) {
+    m_renderQueue.addCallback(RenderPass::Opaque,
+                              [this] { m_deferred.beginGeometry(); });
+    // Outlines and transparent objects are drawn forward, over the result.
+    m_renderQueue.addCallback(RenderPass::Outline, [this] {
+      m_deferred.shade(m_lightManager, m_shadows, m_atlas, m_frameRing,
+                       shininess);
+    });
+  }
+  m_lightManager.submit(m_renderQueue, lightShader);
+  m_modelManager.submit(
+      m_renderQueue, objectShader, frustum,
+      lightCulling == LightCulling::PerObject ? &m_clusters : nullptr);
+  if (m_modelManager.getOutlinedCount() > 0) {
+    m_renderQueue.addCallback(RenderPass::Outline,
+                              [this] { m_outline.begin(); });
+    m_renderQueue.addCallback(RenderPass::Transparent,
+                              [this] { m_outline.composite(); });
+  }
+  m_vegetation.submit(m_renderQueue, objectShader, frustum);
+  m_glass.submit(m_renderQueue, objectShader, frustum);
+  if (lightCulling == LightCulling::PerObject)
+    m_clusters.buildObjectLists(m_renderQueue.getTransformCount());
+  m_lightManager.countObjectsInRange([this](const AABB &bounds) {
+    return m_modelManager.countObjectsOverlapping(bounds);
+  });
+
+  m_renderQueue.execute();
+  m_frameRing.endFrame();
 
   ImGui::Render();
   ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -169,6 +218,23 @@ void Application::toggleCursor() {
   }
 }
 
+void Application::pick(const double x, const double y) {
+  if (ImGui::GetIO().WantCaptureMouse)
+    return;
+  // Ray from the near plane to the far plane through the cursor.
+  const auto width = static_cast<float>(m_window.getWidth());
+  const auto height = static_cast<float>(m_window.getHeight());
+  const auto ndc = glm::vec2(2.0f * static_cast<float>(x) / width - 1.0f,
+                             1.0f - 2.0f * static_cast<float>(y) / height);
+  const auto inverse = glm::inverse(m_state.viewProjection);
+  auto near = inverse * glm::vec4(ndc, -1.0f, 1.0f);
+  auto far = inverse * glm::vec4(ndc, 1.0f, 1.0f);
+  near /= near.w;
+  far /= far.w;
+  const auto origin = glm::vec3(near);
+  m_modelManager.pick(origin, glm::normalize(glm::vec3(far) - origin));
+}
+
 void Application::resize(const int width, const int height) {
   m_window.resize(width, height);
 }
@@ -187,10 +253,107 @@ void Application::widgets() {
                     m_state.deltaTime * 1000, fps);
   }
   ImGui::Text("%s", m_state.performanceStr.c_str());
+  const auto &[issued, skipped] = m_shaderManager.getUploadStats();
+  ImGui::Text("Uniform uploads: %llu issued, %llu skipped",
+              static_cast<unsigned long long>(issued),
+              static_cast<unsigned long long>(skipped));
+  const auto &stats = m_renderQueue.getStats();
+  ImGui::Text("Draw calls: %d (%d packets, %d instances, %d multi-draws)",
+              stats.drawCalls, stats.packets, stats.instances,
+              stats.multiDraws);
+  if (stats.prepassDrawCalls > 0)
+    ImGui::Text("Depth pre-pass: %d draw calls", stats.prepassDrawCalls);
+  ImGui::Text("State changes: %d programs, %d texture sets, %d VAOs",
+              stats.programChanges, stats.textureChanges, stats.vaoChanges);
+  ImGui::Text("Frame ring: %.1f / %.1f KB per frame, %s, %d stalls",
+              static_cast<double>(m_frameRing.getFrameBytes()) / 1024.0,
+              static_cast<double>(m_frameRing.getFrameSize()) / 1024.0,
+              RingBuffer::isPersistentSupported() ? "persistent"
+                                                  : "copied",
+              m_frameRing.getStalls());
+  if (m_state.weightedBlended && m_oit.isReady())
+    ImGui::Text("Transparent: %d instances, weighted blended",
+                stats.transparentInstances);
+  else
+    ImGui::Text("Transparent: %d instances sorted in %.3f ms",
+                stats.transparentInstances, stats.sortMilliseconds);
+  const auto &transforms = m_modelManager.getTransformStats();
+  ImGui::Text("Transforms: %d recomputed (%.3f ms)", transforms.recomputed,
+              transforms.milliseconds);
+  const auto &objects = m_modelManager.getObjectCullStats();
+  const auto &meshes = m_modelManager.getMeshCullStats();
+  ImGui::Text("Frustum culling: %d / %d objects, %d / %d meshes visible "
+              "(%.3f ms)",
+              objects.visible, objects.tested, meshes.visible, meshes.tested,
+              objects.milliseconds + meshes.milliseconds);
+  if (const auto &occlusion = m_modelManager.getOcclusionStats();
+      occlusion.tested > 0)
+    ImGui::Text("Occlusion culling: %d / %d occluded by %d objects (%d "
+                "triangles), raster %.3f ms, test %.3f ms",
+                occlusion.occluded, occlusion.tested, occlusion.occluders,
+                occlusion.triangles, occlusion.rasterMilliseconds,
+                occlusion.testMilliseconds);
+  if (const auto &[tested, early, late] = m_modelManager.getHiZStats();
+      tested > 0)
+    ImGui::Text("GPU occlusion culling: %d / %d occluded, %d drawn early, %d "
+                "late (previous frame)",
+                tested - early - late, tested, early, late);
+  const auto &clusters = m_clusters.getStats();
+  if (!m_state.deferred && m_state.lightCulling == LightCulling::Clusters)
+    ImGui::Text("Clustered lighting: %d lights, %d in clusters (at most %d), "
+                "%.3f ms",
+                clusters.lights, clusters.assignments, clusters.maxPerCluster,
+                clusters.milliseconds);
+  if (!m_state.deferred && m_state.lightCulling == LightCulling::PerObject)
+    ImGui::Text("Per-object lights: %d lights, %d in the lists of %d objects, "
+                "%.3f ms",
+                clusters.lights, clusters.assignments, clusters.objects,
+                clusters.milliseconds);
+  if (m_shadows.isEnabled()) {
+    for (auto i = 0;
+         const auto &[casters, rendered, gpuMilliseconds] :
+         m_shadows.getStats()) {
+      if (casters < 0)
+        ImGui::Text("Shadow cascade %d: not due, last drawn in %.3f ms", i++,
+                    gpuMilliseconds);
+      else
+        ImGui::Text("Shadow cascade %d: %d casters, %s, last drawn in %.3f ms",
+                    i++, casters, rendered ? "drawn" : "cached",
+                    gpuMilliseconds);
+    }
+  }
+  if (const auto &atlas = m_atlas.getStats(); atlas.lights > 0)
+    ImGui::Text("Shadow atlas: %d lights, %d views, %d drawn, %d stale, %d "
+                "casters, %.0f%% used, last drawn in %.3f ms",
+                atlas.lights, atlas.views, atlas.drawnViews, atlas.staleViews,
+                atlas.instances, atlas.occupancy * 100.0f,
+                atlas.gpuMilliseconds);
+  if (m_state.deferred)
+    ImGui::Text("Deferred shading: %d lights, %d as volumes",
+                m_deferred.getStats().lights, m_deferred.getStats().volumes);
+  if (const auto pending = m_shaderManager.getPendingCount(); pending > 0)
+    ImGui::Text("Compiling %d shader(s)...", pending);
   ImGui::End();
 
   ImGui::Begin("Options");
   ImGui::Checkbox("Wireframe", &m_state.wireframe);
+  if (RenderQueue::isMultiDrawSupported())
+    ImGui::Checkbox("Multi-draw indirect", &m_state.multiDraw);
+  ImGui::Checkbox("Depth pre-pass", &m_state.depthPrepass);
+  constexpr std::array transparencyModes = {"Sorted", "Weighted blended"};
+  int transparencyMode = m_state.weightedBlended ? 1 : 0;
+  if (ImGui::Combo("Transparency", &transparencyMode, transparencyModes.data(),
+                   transparencyModes.size()))
+    m_state.weightedBlended = transparencyMode == 1;
+  ImGui::Checkbox("Deferred shading", &m_state.deferred);
+  if (!m_state.deferred) {
+    constexpr std::array lightCullingModes = {"None", "Clusters",
+                                              "Per object"};
+    auto lightCulling = static_cast<int>(m_state.lightCulling);
+    if (ImGui::Combo("Light culling", &lightCulling, lightCullingModes.data(),
+                     lightCullingModes.size()))
+      m_state.lightCulling = static_cast<LightCulling>(lightCulling);
+  }
   ImGui::Checkbox("Emission", &m_state.emission);
   ImGui::Checkbox("Show depth", &m_state.showDepth);
   ImGui::Checkbox("Depth testing", &m_state.depthTesting);
@@ -219,8 +382,14 @@ void Application::widgets() {
   ImGui::Begin("Settings");
   m_window.widgets();
   m_cameraManager.widgets();
+  m_shaderManager.widgets();
   m_modelManager.widgets();
   m_lightManager.widgets();
+  m_shadows.widgets();
+  m_atlas.widgets();
+  m_outline.widgets();
+  m_vegetation.widgets();
+  m_glass.widgets();
   ImGui::End();
 }
 
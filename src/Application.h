@@ -2,18 +2,30 @@
 #define APPLICATION_H
 
 #include "Camera.h"
+#include "Clusters.h"
+#include "Deferred.h"
+#include "Glass.h"
 #include "Light.h"
 #include "Model.h"
+#include "Outline.h"
+#include "RenderQueue.h"
+#include "RingBuffer.h"
+#include "Shadows.h"
+#include "ThreadPool.h"
+#include "Vegetation.h"
 #include "Window.h"
 
-#include <array>
-
 struct AppState {
   float deltaTime = 0.0f;
   float deltaTimeAdded = 0.0f;
   float lastFrame = 0.0f;
   std::string performanceStr = "Starting...";
   bool wireframe = false;
+  bool multiDraw = true;
+  bool depthPrepass = false; // opaque objects shaded once per pixel
+  bool weightedBlended = false; // order-independent transparency
+  bool deferred = false;
+  LightCulling lightCulling = LightCulling::Clusters; // forward lighting only
   bool emission = false;
   bool cursorLocked = true;
   bool cursorJustLocked = false;
@@ -23,6 +35,7 @@ struct AppState {
   GLenum depthFn = GL_LESS;
   float lastX = 400.0f;
   float lastY = 300.0f;
+  glm::mat4 viewProjection{1.0f}; // of the last frame, used for picking
 };
 
 class Application {
@@ -46,23 +59,31 @@ public:
 
   void toggleCursor();
 
+  // Picks the object under the cursor, in window coordinates.
+  void pick(double x, double y);
+
   Camera *getActiveCamera() const { return m_cameraManager.getActiveCamera(); }
 
   void resize(int width, int height);
 
 private:
   Window m_window;
+  ThreadPool m_threadPool;
+  ShaderManager m_shaderManager;
   CameraManager m_cameraManager;
   LightManager m_lightManager;
   ModelManager m_modelManager;
+  RenderQueue m_renderQueue;
+  RingBuffer m_frameRing;
+  WeightedBlendedOit m_oit;
+  DeferredRenderer m_deferred;
+  ClusteredLights m_clusters;
+  ShadowCascades m_shadows;
+  ShadowAtlas m_atlas;
+  OutlineRenderer m_outline;
+  Vegetation m_vegetation;
+  GlassPanes m_glass;
   AppState m_state;
-  std::unordered_map<std::string, std::unique_ptr<Shader> > m_shaders;
-
-  // grass
-  Texture m_grassTexture;
-  std::array<float, 30> m_transparentVertices;
-  std::array<glm::vec3, 5> m_vegetationPos;
-  GLuint m_transparentVao, m_transparentVbo;
 
   void widgets();
 
@@ -0,0 +1,426 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "BVH.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+
+constexpr std::uint32_t MAX_LEAF_SIZE = 4;
+// Ranges larger than this are split even when the heuristic prefers a leaf.
+constexpr std::uint32_t MAX_FORCED_LEAF_SIZE = 16;
+constexpr int BIN_COUNT = 16;
+constexpr float TRAVERSAL_COST = 1.0f;
+constexpr float INTERSECTION_COST = 1.0f;
+// Relative cost above which the tree is rebuilt.
+constexpr float REBUILD_THRESHOLD = 1.3f;
+
+BVH::~BVH() {
+    if (m_rebuild.valid())
+        m_rebuild.wait();
+}
+
+void BVH::build(std::vector<AABB> bounds) {
+    if (m_rebuild.valid()) {
+        m_rebuild.wait();
+        m_rebuild = {};
+    }
+    m_refitsDuringRebuild.clear();
+    m_bounds = std::move(bounds);
+    m_tree = buildTree(m_bounds);
+    m_builtCost = cost();
+}
+
+void BVH::refit(const std::uint32_t primitive, const AABB &bounds) {
+    m_bounds[primitive] = bounds;
+    if (m_rebuild.valid())
+        m_refitsDuringRebuild.push_back(primitive);
+    refitLeaf(m_tree.leaves[primitive]);
+}
+
+void BVH::update() {
+    if (m_rebuild.valid()) {
+        if (m_rebuild.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+        // The new tree was built from the bounds at the time the rebuild started.
+        m_tree = m_rebuild.get();
+        m_builtCost = cost();
+        for (const auto primitive: m_refitsDuringRebuild) {
+            refitLeaf(m_tree.leaves[primitive]);
+        }
+        m_refitsDuringRebuild.clear();
+        m_rebuilds++;
+        return;
+    }
+
+    if (m_builtCost > 0.0f && cost() > m_builtCost * REBUILD_THRESHOLD) {
+        m_rebuild = std::async(std::launch::async, [bounds = m_bounds] { return buildTree(bounds); });
+    }
+}
+
+BVH::Stats BVH::getStats() const {
+    return {
+        m_tree.nodes.size(), m_builtCost > 0.0f ? cost() / m_builtCost : 1.0f, m_rebuilds, m_rebuild.valid()
+    };
+}
+
+void BVH::query(const Frustum &frustum, std::vector<std::uint32_t> &primitives) const {
+    primitives.clear();
+    if (m_tree.nodes.empty())
+        return;
+
+    const auto &planes = frustum.getPlanes();
+    // Returns false if the box is outside one of the planes of the mask, and removes from the mask the planes the
+    // box is fully inside of: they do not need to be tested for its children.
+    const auto classify = [&planes](const AABB &box, std::uint8_t &mask) {
+        for (auto i = 0; i < 6; ++i) {
+            if (!(mask & 1 << i))
+                continue;
+            const auto &plane = planes[i];
+            const auto normal = glm::vec3(plane);
+            const auto far = glm::vec3(plane.x >= 0.0f ? box.max.x : box.min.x,
+                                       plane.y >= 0.0f ? box.max.y : box.min.y,
+                                       plane.z >= 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(normal, far) + plane.w < 0.0f)
+                return false;
+            const auto near = glm::vec3(plane.x >= 0.0f ? box.min.x : box.max.x,
+                                        plane.y >= 0.0f ? box.min.y : box.max.y,
+                                        plane.z >= 0.0f ? box.min.z : box.max.z);
+            if (glm::dot(normal, near) + plane.w >= 0.0f)
+                mask &= ~(1 << i);
+        }
+        return true;
+    };
+
+    struct Entry {
+        std::uint32_t node;
+        std::uint8_t mask; // planes still to be tested
+    };
+    std::vector<Entry> stack;
+    stack.reserve(64);
+    stack.push_back({0, 0x3F});
+    while (!stack.empty()) {
+        auto [index, mask] = stack.back();
+        stack.pop_back();
+        const auto &node = m_tree.nodes[index];
+        if (mask != 0 && !classify(node.bounds, mask))
+            continue;
+        if (node.count == 0) {
+            stack.push_back({node.offset, mask});
+            stack.push_back({index + 1, mask});
+            continue;
+        }
+        for (auto i = node.offset; i < node.offset + node.count; ++i) {
+            const auto primitive = m_tree.primitives[i];
+            if (auto primitiveMask = mask; primitiveMask == 0 || classify(m_bounds[primitive], primitiveMask))
+                primitives.push_back(primitive);
+        }
+    }
+}
+
+void BVH::query(const AABB &box, std::vector<std::uint32_t> &primitives) const {
+    primitives.clear();
+    if (m_tree.nodes.empty())
+        return;
+
+    std::vector<std::uint32_t> stack;
+    stack.reserve(64);
+    stack.push_back(0);
+    while (!stack.empty()) {
+        const auto index = stack.back();
+        stack.pop_back();
+        const auto &node = m_tree.nodes[index];
+        if (!node.bounds.overlaps(box))
+            continue;
+        if (node.count == 0) {
+            stack.push_back(node.offset);
+            stack.push_back(index + 1);
+            continue;
+        }
+        for (auto i = node.offset; i < node.offset + node.count; ++i) {
+            if (const auto primitive = m_tree.primitives[i]; m_bounds[primitive].overlaps(box))
+                primitives.push_back(primitive);
+        }
+    }
+}
+
+std::optional<BVH::Hit> BVH::raycast(const glm::vec3 &origin, const glm::vec3 &direction,
+                                     const std::function<bool(std::uint32_t)> &filter) const {
+    if (m_tree.nodes.empty())
+        return std::nullopt;
+
+    // Slab test, returns the distance at which the ray enters the box, or infinity if it misses it.
+    const auto inverse = 1.0f / direction;
+    constexpr auto miss = std::numeric_limits<float>::infinity();
+    const auto enter = [&](const AABB &box) {
+        const auto t1 = (box.min - origin) * inverse;
+        const auto t2 = (box.max - origin) * inverse;
+        const auto tMin = glm::min(t1, t2);
+        const auto tMax = glm::max(t1, t2);
+        const auto near = std::max({tMin.x, tMin.y, tMin.z, 0.0f});
+        const auto far = std::min({tMax.x, tMax.y, tMax.z});
+        return near <= far ? near : miss;
+    };
+
+    std::optional<Hit> hit;
+    auto closest = miss;
+    struct Entry {
+        std::uint32_t node;
+        float distance;
+    };
+    std::vector<Entry> stack;
+    stack.reserve(64);
+    stack.push_back({0, enter(m_tree.nodes[0].bounds)});
+    while (!stack.empty()) {
+        const auto [index, distance] = stack.back();
+        stack.pop_back();
+        if (distance >= closest)
+            continue;
+        const auto &node = m_tree.nodes[index];
+        if (node.count == 0) {
+            // The nearest child is visited first, so that hits in it can prune the other one.
+            Entry left{index + 1, enter(m_tree.nodes[index + 1].bounds)};
+            Entry right{node.offset, enter(m_tree.nodes[node.offset].bounds)};
+            if (left.distance > right.distance)
+                std::swap(left, right);
+            if (right.distance < closest)
+                stack.push_back(right);
+            if (left.distance < closest)
+                stack.push_back(left);
+            continue;
+        }
+        for (auto i = node.offset; i < node.offset + node.count; ++i) {
+            const auto primitive = m_tree.primitives[i];
+            if (const auto t = enter(m_bounds[primitive]); t < closest && (!filter || filter(primitive))) {
+                closest = t;
+                hit = Hit{primitive, t};
+            }
+        }
+    }
+    return hit;
+}
+
+BVH::Tree BVH::buildTree(const std::vector<AABB> &bounds) {
+    Tree tree;
+    const auto count = static_cast<std::uint32_t>(bounds.size());
+    if (count == 0)
+        return tree;
+
+    // Primitives are partitioned by value rather than through their index, so that every pass reads memory in order.
+    struct Reference {
+        AABB bounds;
+        glm::vec3 centroid;
+        std::uint32_t primitive;
+    };
+    std::vector<Reference> references(count);
+    for (auto i = 0u; i < count; ++i) {
+        references[i] = {bounds[i], bounds[i].getCenter(), i};
+    }
+    tree.leaves.resize(count);
+    tree.nodes.reserve(2 * count / MAX_LEAF_SIZE + 1);
+    tree.parents.reserve(tree.nodes.capacity());
+
+    // Depth-first with an explicit stack. The left child is popped right after its parent so that it is the next
+    // node, the right child links itself to the parent when it is popped.
+    struct Task {
+        std::uint32_t first;
+        std::uint32_t count;
+        std::uint32_t parent;
+        bool right;
+    };
+    std::vector<Task> stack{{0, count, 0, false}};
+    while (!stack.empty()) {
+        const auto task = stack.back();
+        stack.pop_back();
+
+        const auto index = static_cast<std::uint32_t>(tree.nodes.size());
+        if (task.right)
+            tree.nodes[task.parent].offset = index;
+        tree.parents.push_back(index == 0 ? 0 : task.parent);
+
+        const auto begin = references.begin() + task.first;
+        const auto end = begin + task.count;
+        AABB box, centroidBox;
+        for (auto it = begin; it != end; ++it) {
+            box.expand(it->bounds);
+            centroidBox.expand(it->centroid);
+        }
+
+        // Binned surface area heuristic over the three axes.
+        auto bestCost = std::numeric_limits<float>::max();
+        auto bestAxis = -1;
+        auto bestSplit = 0;
+        if (task.count > MAX_LEAF_SIZE) {
+            for (auto axis = 0; axis < 3; ++axis) {
+                const auto extent = centroidBox.max[axis] - centroidBox.min[axis];
+                if (extent <= 0.0f)
+                    continue;
+                struct Bin {
+                    AABB bounds;
+                    std::uint32_t count = 0;
+                };
+                std::array<Bin, BIN_COUNT> bins{};
+                const auto scale = static_cast<float>(BIN_COUNT) / extent;
+                for (auto it = begin; it != end; ++it) {
+                    const auto bin = std::min(BIN_COUNT - 1,
+                                              static_cast<int>((it->centroid[axis] - centroidBox.min[axis]) * scale));
+                    bins[bin].bounds.expand(it->bounds);
+                    bins[bin].count++;
+                }
+                // Cost of the right side of each split, swept from the right.
+                std::array<float, BIN_COUNT> rightCosts{};
+                AABB right;
+                std::uint32_t rightCount = 0;
+                for (auto i = BIN_COUNT - 1; i > 0; --i) {
+                    right.expand(bins[i].bounds);
+                    rightCount += bins[i].count;
+                    rightCosts[i - 1] = rightCount > 0 ? right.getSurfaceArea() * static_cast<float>(rightCount) : 0;
+                }
+                AABB left;
+                std::uint32_t leftCount = 0;
+                for (auto i = 0; i < BIN_COUNT - 1; ++i) {
+                    left.expand(bins[i].bounds);
+                    leftCount += bins[i].count;
+                    if (leftCount == 0 || leftCount == task.count)
+                        continue;
+                    const auto splitCost = left.getSurfaceArea() * static_cast<float>(leftCount) + rightCosts[i];
+                    if (splitCost < bestCost) {
+                        bestCost = splitCost;
+                        bestAxis = axis;
+                        bestSplit = i;
+                    }
+                }
+            }
+        }
+
+        const auto area = box.getSurfaceArea();
+        const auto leafCost = INTERSECTION_COST * static_cast<float>(task.count);
+        const auto splitCost = area > 0.0f
+                                   ? TRAVERSAL_COST + INTERSECTION_COST * bestCost / area
+                                   : std::numeric_limits<float>::max();
+        if (bestAxis < 0 || (splitCost >= leafCost && task.count <= MAX_FORCED_LEAF_SIZE)) {
+            tree.nodes.push_back({box, task.first, task.count});
+            for (auto it = begin; it != end; ++it) {
+                tree.leaves[it->primitive] = index;
+            }
+            tree.areaSum += nodeWeight(tree.nodes.back()) * area;
+            continue;
+        }
+
+        const auto scale = static_cast<float>(BIN_COUNT) / (centroidBox.max[bestAxis] - centroidBox.min[bestAxis]);
+        const auto middle = std::partition(begin, end, [&](const Reference &reference) {
+            const auto bin = std::min(BIN_COUNT - 1, static_cast<int>(
+                                          (reference.centroid[bestAxis] - centroidBox.min[bestAxis]) * scale));
+            return bin <= bestSplit;
+        });
+        const auto leftCount = static_cast<std::uint32_t>(middle - begin);
+        tree.nodes.push_back({box, 0, 0});
+        tree.areaSum += nodeWeight(tree.nodes.back()) * area;
+        stack.push_back({task.first + leftCount, task.count - leftCount, index, true});
+        stack.push_back({task.first, leftCount, index, false});
+    }
+
+    tree.primitives.resize(count);
+    std::ranges::transform(references, tree.primitives.begin(), &Reference::primitive);
+    return tree;
+}
+
+float BVH::nodeWeight(const Node &node) {
+    return node.count == 0 ? TRAVERSAL_COST : INTERSECTION_COST * static_cast<float>(node.count);
+}
+
+float BVH::cost() const {
+    if (m_tree.nodes.empty())
+        return 0.0f;
+    const auto rootArea = m_tree.nodes[0].bounds.getSurfaceArea();
+    return rootArea > 0.0f ? m_tree.areaSum / rootArea : 0.0f;
+}
+
+void BVH::refitLeaf(std::uint32_t index) {
+    // Walks up to the root, stopping as soon as a node keeps its bounds.
+    while (true) {
+        auto &node = m_tree.nodes[index];
+        AABB box;
+        if (node.count > 0) {
+            for (auto i = node.offset; i < node.offset + node.count; ++i) {
+                box.expand(m_bounds[m_tree.primitives[i]]);
+            }
+        } else {
+            box = m_tree.nodes[index + 1].bounds;
+            box.expand(m_tree.nodes[node.offset].bounds);
+        }
+        if (box == node.bounds)
+            return;
+        m_tree.areaSum += nodeWeight(node) * (box.getSurfaceArea() - node.bounds.getSurfaceArea());
+        node.bounds = box;
+        if (index == 0)
+            return;
+        index = m_tree.parents[index];
+    }
+}
+
+BVHBenchmark benchmarkBVH(const std::size_t objects) {
+    using Clock = std::chrono::steady_clock;
+    const auto elapsed = [](const Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    };
+
+    // Unit boxes, one every 8 cubic units on average.
+    const auto extent = std::cbrt(static_cast<float>(objects) * 8.0f) * 0.5f;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> position(-extent, extent);
+    std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+    const auto randomBox = [&] {
+        const auto center = glm::vec3(position(rng), position(rng), position(rng));
+        return AABB{center - glm::vec3(0.5f), center + glm::vec3(0.5f)};
+    };
+    std::vector<AABB> bounds(objects);
+    std::ranges::generate(bounds, randomBox);
+
+    BVHBenchmark result;
+    result.objects = objects;
+    BVH bvh;
+    auto start = Clock::now();
+    bvh.build(bounds);
+    result.build = elapsed(start);
+
+    const auto moved = std::max<std::size_t>(1, objects / 100);
+    std::uniform_int_distribution<std::uint32_t> primitive(0, static_cast<std::uint32_t>(objects - 1));
+    std::vector<std::pair<std::uint32_t, AABB> > moves(moved);
+    for (auto &[index, box]: moves) {
+        index = primitive(rng);
+        const auto shift = glm::vec3(offset(rng), offset(rng), offset(rng));
+        box = {bounds[index].min + shift, bounds[index].max + shift};
+    }
+    start = Clock::now();
+    for (const auto &[index, box]: moves) {
+        bvh.refit(index, box);
+    }
+    result.refit = elapsed(start);
+
+    // Camera outside the boxes, looking at their center.
+    const auto projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, extent * 4.0f);
+    const auto view = glm::lookAt(glm::vec3(extent * 1.5f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    std::vector<std::uint32_t> visible;
+    start = Clock::now();
+    bvh.query(Frustum(projection * view), visible);
+    result.frustumQuery = elapsed(start);
+
+    constexpr auto rays = 1000;
+    std::vector<std::pair<glm::vec3, glm::vec3> > rayList(rays);
+    for (auto &[origin, direction]: rayList) {
+        origin = glm::vec3(position(rng), position(rng), position(rng));
+        direction = glm::normalize(glm::vec3(offset(rng), offset(rng), offset(rng)) + glm::vec3(1e-4f));
+    }
+    start = Clock::now();
+    for (const auto &[origin, direction]: rayList) {
+        static_cast<void>(bvh.raycast(origin, direction));
+    }
+    result.rayQuery = elapsed(start) / rays;
+    return result;
+}
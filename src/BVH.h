@@ -0,0 +1,114 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <optional>
+#include <vector>
+
+// Bounding volume hierarchy over a set of boxes (primitives), built with the surface area heuristic and stored as a
+// flat array of nodes in depth-first order.
+//
+// Moving a primitive only refits the nodes above it. Refits make the tree looser, once its cost gets too far from the
+// cost it had when built, a new tree is built in the background and swapped in by update().
+class BVH {
+public:
+    struct Node {
+        AABB bounds;
+        // Leaves: index of the first primitive in m_primitives. Inner nodes: index of the right child, the left child
+        // is the next node.
+        std::uint32_t offset;
+        std::uint32_t count; // primitives of a leaf, 0 for inner nodes
+    };
+
+    struct Hit {
+        std::uint32_t primitive;
+        float distance; // along the ray, to the box of the primitive
+    };
+
+    struct Stats {
+        std::size_t nodes = 0;
+        float cost = 0.0f; // surface area heuristic, relative to the cost after the last build
+        int rebuilds = 0;
+        bool rebuilding = false;
+    };
+
+    BVH() = default;
+
+    ~BVH();
+
+    BVH(const BVH &) = delete;
+
+    BVH &operator=(const BVH &) = delete;
+
+    // Blocks until the tree is built, a pending background rebuild is discarded.
+    void build(std::vector<AABB> bounds);
+
+    void refit(std::uint32_t primitive, const AABB &bounds);
+
+    // Starts a background rebuild if refits degraded the tree, and swaps in the rebuilt tree once it is ready. To be
+    // called once per frame.
+    void update();
+
+    [[nodiscard]] std::size_t size() const { return m_bounds.size(); }
+
+    [[nodiscard]] const AABB &getBounds(const std::uint32_t primitive) const { return m_bounds[primitive]; }
+
+    [[nodiscard]] Stats getStats() const;
+
+    // Primitives whose box intersects the frustum. Subtrees fully inside are accepted without testing their boxes.
+    void query(const Frustum &frustum, std::vector<std::uint32_t> &primitives) const;
+
+    // Primitives whose box overlaps the given one.
+    void query(const AABB &box, std::vector<std::uint32_t> &primitives) const;
+
+    // Closest primitive whose box is hit by the ray, among the ones accepted by the filter.
+    [[nodiscard]] std::optional<Hit> raycast(const glm::vec3 &origin, const glm::vec3 &direction,
+                                             const std::function<bool(std::uint32_t)> &filter = {}) const;
+
+private:
+    struct Tree {
+        std::vector<Node> nodes;
+        std::vector<std::uint32_t> primitives; // primitive indices, referenced by the leaves
+        std::vector<std::uint32_t> parents; // parent of each node, the root is its own parent
+        std::vector<std::uint32_t> leaves; // leaf of each primitive
+        float areaSum = 0.0f; // sum of the node areas weighted by their cost, see cost()
+    };
+
+    std::vector<AABB> m_bounds;
+    Tree m_tree;
+    float m_builtCost = 0.0f;
+    int m_rebuilds = 0;
+
+    std::future<Tree> m_rebuild;
+    std::vector<std::uint32_t> m_refitsDuringRebuild;
+
+    static Tree buildTree(const std::vector<AABB> &bounds);
+
+    // Nodes are weighted by the cost of visiting them: one traversal step for inner nodes, one box test per primitive
+    // for leaves.
+    static float nodeWeight(const Node &node);
+
+    [[nodiscard]] float cost() const;
+
+    void refitLeaf(std::uint32_t leaf);
+};
+
+struct BVHBenchmark {
+    std::size_t objects = 0;
+    // All in milliseconds.
+    double build = 0.0;
+    double refit = 0.0; // 1% of the objects moved
+    double frustumQuery = 0.0;
+    double rayQuery = 0.0; // average over several rays
+};
+
+// Measures the BVH on random boxes, spread so that their density does not depend on their count.
+BVHBenchmark benchmarkBVH(std::size_t objects);
+
+#endif
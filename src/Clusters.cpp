@@ -0,0 +1,274 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+
+#include "Clusters.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <tuple>
+#include <utility>
+
+constexpr int LIGHT_TEXELS = 6;
+constexpr std::size_t OBJECTS_PER_JOB = 256;
+
+ClusteredLights::ClusteredLights(ThreadPool &threadPool) : m_threadPool{threadPool} {
+    for (const auto &[target, format]: {
+             std::pair{&m_lightData, GL_RGBA32F}, std::pair{&m_clusters, GL_RG32UI},
+             std::pair{&m_clusterLights, GL_R32I}, std::pair{&m_objectLights, GL_R32I}
+         }) {
+        glGenBuffers(1, &target->buffer);
+        glGenTextures(1, &target->texture);
+        glBindBuffer(GL_TEXTURE_BUFFER, target->buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, target->texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, target->buffer);
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+ClusteredLights::~ClusteredLights() {
+    for (const auto target: {&m_lightData, &m_clusters, &m_clusterLights, &m_objectLights}) {
+        glDeleteTextures(1, &target->texture);
+        glDeleteBuffers(1, &target->buffer);
+    }
+}
+
+void ClusteredLights::build(const LightManager &lights, const LightCulling culling, const glm::mat4 &view,
+                            const float fovY, const float aspect, const float near, const float far) {
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    if (fovY != m_fovY || aspect != m_aspect || near != m_near || far != m_far)
+        computeBounds(fovY, aspect, near, far);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    m_tileScale = glm::vec2(CLUSTERS_X, CLUSTERS_Y) / glm::max(glm::vec2(viewport[2], viewport[3]), glm::vec2(1.0f));
+
+    // Directional lights first, then the others in the order of their spheres.
+    m_lightTexels.clear();
+    m_localLights.clear();
+    m_spheres.clear();
+    m_objects.clear();
+    const auto pack = [this](const Light &light, const glm::vec3 &position, const glm::vec3 &direction,
+                             const float range, const glm::vec2 &cutOffs, const glm::vec3 &attenuation) {
+        m_lightTexels.emplace_back(position, static_cast<float>(light.getType()));
+        m_lightTexels.emplace_back(direction, range);
+        m_lightTexels.emplace_back(light.getAmbient(), cutOffs.x);
+        m_lightTexels.emplace_back(light.getDiffuse(), cutOffs.y);
+        m_lightTexels.emplace_back(light.getSpecular(), attenuation.x);
+        m_lightTexels.emplace_back(attenuation.y, attenuation.z, static_cast<float>(light.getShadow()), 0.0f);
+    };
+    lights.forEachActive([&](const Light &light) {
+        if (light.getType() == Light::Type::Directional) {
+            const auto &directional = static_cast<const DirectionalLight &>(light);
+            pack(light, glm::vec3(0.0f), directional.getDirection(), 0.0f, glm::vec2(0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+        }
+    });
+    m_globalLights = static_cast<int>(m_lightTexels.size() / LIGHT_TEXELS);
+    lights.forEachActive([&](const Light &light) {
+        if (light.getType() == Light::Type::Point) {
+            const auto &point = static_cast<const PointLight &>(light);
+            const auto range = point.getRange();
+            const auto attenuation = glm::vec3(point.getConstant(), point.getLinear(), point.getQuadratic());
+            pack(light, point.getPosition(), glm::vec3(0.0f), range, glm::vec2(0.0f), attenuation);
+            m_localLights.push_back({point.getPosition(), range, attenuation, point.getIntensity()});
+        } else if (light.getType() == Light::Type::Spot) {
+            const auto &spot = static_cast<const SpotLight &>(light);
+            const auto range = spot.getRange();
+            const auto attenuation = glm::vec3(spot.getConstant(), spot.getLinear(), spot.getQuadratic());
+            pack(light, spot.getPosition(), spot.getDirection(), range,
+                 glm::vec2(spot.getCutOff(), spot.getOuterCutOff()), attenuation);
+            m_localLights.push_back({spot.getPosition(), range, attenuation, spot.getIntensity()});
+        }
+    });
+
+    m_ranges.resize(CLUSTER_COUNT);
+    m_indices.clear();
+    m_stats = {};
+    if (culling == LightCulling::Clusters) {
+        for (const auto &light: m_localLights) {
+            m_spheres.push_back({glm::vec3(view * glm::vec4(light.position, 1.0f)), light.range});
+        }
+        m_threadPool.parallelFor(CLUSTERS_Z, [this](const std::size_t slice) {
+            assignSlice(static_cast<int>(slice));
+        });
+
+        // Clusters are ordered by slice, then row, then column, like their lists.
+        for (auto slice = 0; slice < CLUSTERS_Z; ++slice) {
+            for (std::uint32_t tile = 0, offset = 0; tile < CLUSTERS_X * CLUSTERS_Y; ++tile) {
+                const auto count = m_sliceCounts[slice][tile];
+                m_ranges[slice * CLUSTERS_X * CLUSTERS_Y + tile] = glm::uvec2(m_indices.size() + offset, count);
+                offset += count;
+                m_stats.maxPerCluster = std::max(m_stats.maxPerCluster, static_cast<int>(count));
+            }
+            m_indices.insert(m_indices.end(), m_sliceLights[slice].begin(), m_sliceLights[slice].end());
+        }
+    } else {
+        std::ranges::fill(m_ranges, glm::uvec2(0));
+    }
+    // Empty buffer textures are not allowed everywhere.
+    if (m_lightTexels.empty())
+        m_lightTexels.emplace_back(0.0f);
+    if (m_indices.empty())
+        m_indices.push_back(0);
+
+    upload(m_lightData, m_lightTexels.data(), m_lightTexels.size() * sizeof(glm::vec4));
+    upload(m_clusters, m_ranges.data(), m_ranges.size() * sizeof(glm::uvec2));
+    upload(m_clusterLights, m_indices.data(), m_indices.size() * sizeof(GLint));
+
+    m_stats.lights = m_globalLights + static_cast<int>(m_localLights.size());
+    if (culling == LightCulling::Clusters)
+        m_stats.assignments = static_cast<int>(m_indices.size());
+    m_stats.milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void ClusteredLights::addObject(const std::uint32_t transform, const AABB &bounds) {
+    m_objects.push_back({transform, bounds});
+}
+
+void ClusteredLights::buildObjectLists(const std::size_t transformCount) {
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    m_objectIndices.assign(std::max<std::size_t>(transformCount, 1) * OBJECT_LIGHTS, -1);
+    const auto chunks = (m_objects.size() + OBJECTS_PER_JOB - 1) / OBJECTS_PER_JOB;
+    m_threadPool.parallelFor(chunks, [this](const std::size_t chunk) {
+        const auto first = chunk * OBJECTS_PER_JOB;
+        const auto last = std::min(first + OBJECTS_PER_JOB, m_objects.size());
+        for (auto i = first; i < last; ++i) {
+            pickLights(m_objects[i]);
+        }
+    });
+    upload(m_objectLights, m_objectIndices.data(), m_objectIndices.size() * sizeof(GLint));
+
+    m_stats.objects = static_cast<int>(m_objects.size());
+    m_stats.assignments = static_cast<int>(std::ranges::count_if(m_objectIndices, [](const GLint i) {
+        return i >= 0;
+    }));
+    m_stats.milliseconds += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void ClusteredLights::bind(Shader *const shader) const {
+    for (const auto &[target, unit, sampler]: {
+             std::tuple{&m_lightData, LIGHT_DATA_UNIT, "lightData"},
+             std::tuple{&m_clusters, CLUSTER_UNIT, "clusters"},
+             std::tuple{&m_clusterLights, CLUSTER_LIGHTS_UNIT, "clusterLights"},
+             std::tuple{&m_objectLights, OBJECT_LIGHTS_UNIT, "objectLights"}
+         }) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, target->texture);
+        shader->setInt(sampler, unit);
+    }
+    shader->setInt("globalLightCount", m_globalLights);
+    shader->setVec2("clusterDepth", glm::vec2(m_near, m_far));
+    shader->setVec2("clusterScale", m_tileScale);
+}
+
+void ClusteredLights::computeBounds(const float fovY, const float aspect, const float near, const float far) {
+    m_fovY = fovY;
+    m_aspect = aspect;
+    m_near = near;
+    m_far = far;
+
+    // View space looks down -z: at distance d, a tile spans ndc * d * tan(fovY / 2) (times aspect for x).
+    const auto tanY = std::tan(glm::radians(fovY) * 0.5f);
+    const auto tanX = tanY * aspect;
+    for (auto slice = 0; slice < CLUSTERS_Z; ++slice) {
+        const auto sliceNear = near * std::pow(far / near, static_cast<float>(slice) / CLUSTERS_Z);
+        const auto sliceFar = near * std::pow(far / near, static_cast<float>(slice + 1) / CLUSTERS_Z);
+        for (auto y = 0; y < CLUSTERS_Y; ++y) {
+            const auto ndcY0 = -1.0f + 2.0f * static_cast<float>(y) / CLUSTERS_Y;
+            const auto ndcY1 = -1.0f + 2.0f * static_cast<float>(y + 1) / CLUSTERS_Y;
+            for (auto x = 0; x < CLUSTERS_X; ++x) {
+                const auto ndcX0 = -1.0f + 2.0f * static_cast<float>(x) / CLUSTERS_X;
+                const auto ndcX1 = -1.0f + 2.0f * static_cast<float>(x + 1) / CLUSTERS_X;
+                auto &[min, max] = m_bounds[(slice * CLUSTERS_Y + y) * CLUSTERS_X + x];
+                min = glm::vec3(std::numeric_limits<float>::max());
+                max = glm::vec3(std::numeric_limits<float>::lowest());
+                for (const auto depth: {sliceNear, sliceFar}) {
+                    for (const auto ndcX: {ndcX0, ndcX1}) {
+                        for (const auto ndcY: {ndcY0, ndcY1}) {
+                            const auto corner = glm::vec3(ndcX * depth * tanX, ndcY * depth * tanY, -depth);
+                            min = glm::min(min, corner);
+                            max = glm::max(max, corner);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void ClusteredLights::assignSlice(const int slice) {
+    auto &lights = m_sliceLights[slice];
+    auto &counts = m_sliceCounts[slice];
+    lights.clear();
+
+    // Lights reaching the depth range of the slice at all.
+    const auto first = static_cast<std::size_t>(slice) * CLUSTERS_X * CLUSTERS_Y;
+    const auto sliceMin = m_bounds[first].min.z;
+    const auto sliceMax = m_bounds[first].max.z;
+    thread_local std::vector<int> candidates;
+    candidates.clear();
+    for (auto i = 0; i < m_spheres.size(); ++i) {
+        const auto &[center, radius] = m_spheres[i];
+        if (center.z + radius >= sliceMin && center.z - radius <= sliceMax)
+            candidates.push_back(i);
+    }
+
+    for (auto tile = 0; tile < CLUSTERS_X * CLUSTERS_Y; ++tile) {
+        const auto &[min, max] = m_bounds[first + tile];
+        const auto begin = lights.size();
+        for (const auto i: candidates) {
+            const auto &[center, radius] = m_spheres[i];
+            const auto offset = center - glm::clamp(center, min, max);
+            if (glm::dot(offset, offset) <= radius * radius)
+                lights.push_back(m_globalLights + i);
+        }
+        counts[tile] = static_cast<std::uint32_t>(lights.size() - begin);
+    }
+}
+
+void ClusteredLights::pickLights(const Object &object) {
+    // The lights adding the most at the nearest point of the bounds, faintest first.
+    struct Candidate {
+        float significance;
+        GLint index;
+    };
+    std::array<Candidate, OBJECT_LIGHTS> best{};
+    auto count = 0;
+    for (auto i = 0; i < m_localLights.size(); ++i) {
+        const auto &[position, range, attenuation, intensity] = m_localLights[i];
+        const auto distance = glm::length(position - glm::clamp(position, object.bounds.min, object.bounds.max));
+        if (distance > range)
+            continue;
+        const auto significance =
+                intensity / (attenuation.x + attenuation.y * distance + attenuation.z * distance * distance);
+        if (count == OBJECT_LIGHTS && significance <= best[0].significance)
+            continue;
+        // Insertion into the sorted list, replacing the faintest when it is full.
+        auto slot = 0;
+        if (count < OBJECT_LIGHTS) {
+            for (slot = count++; slot > 0 && best[slot - 1].significance > significance; --slot) {
+                best[slot] = best[slot - 1];
+            }
+        } else {
+            for (; slot + 1 < OBJECT_LIGHTS && best[slot + 1].significance < significance; ++slot) {
+                best[slot] = best[slot + 1];
+            }
+        }
+        best[slot] = {significance, m_globalLights + i};
+    }
+
+    // Brightest first, so that the shader can stop at the first empty slot.
+    const auto list = m_objectIndices.begin() + static_cast<std::ptrdiff_t>(object.transform) * OBJECT_LIGHTS;
+    for (auto i = 0; i < count; ++i) {
+        list[i] = best[count - 1 - i].index;
+    }
+}
+
+void ClusteredLights::upload(const BufferTexture &target, const void *const data, const std::size_t size) {
+    glBindBuffer(GL_TEXTURE_BUFFER, target.buffer);
+    glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(size), data, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
@@ -0,0 +1,137 @@
+#ifndef CLUSTERS_H
+#define CLUSTERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+#include "Light.h"
+#include "Shader.h"
+#include "ThreadPool.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Texture units of the light buffers, below the ones of the render queue.
+constexpr int LIGHT_DATA_UNIT = 13;
+constexpr int CLUSTER_UNIT = 12;
+constexpr int CLUSTER_LIGHTS_UNIT = 11;
+constexpr int OBJECT_LIGHTS_UNIT = 10;
+
+// How forward shading picks the lights of a fragment. Values match the lightCulling uniform of object.frag.
+enum class LightCulling {
+    None = 0, // every light of the uniform array
+    Clusters = 1, // the lights of the fragment's cluster
+    PerObject = 2, // the most significant lights of the object
+};
+
+struct ClusterStats {
+    int lights = 0;
+    int assignments = 0; // light indices over all clusters or objects
+    int maxPerCluster = 0;
+    int objects = 0;
+    double milliseconds = 0.0;
+};
+
+// Clustered forward lighting: the view frustum is split into a grid of clusters, screen tiles subdivided in depth
+// slices growing exponentially with the distance, and each cluster gets the list of lights whose range reaches it.
+// Fragments only evaluate the lights of their cluster, read by clusters.glsl from three buffer textures:
+//  - the lights, 6 RGBA32F texels each, directional ones first: they reach every cluster and are not listed;
+//  - per cluster, the offset and count of its lights in the index list (RG32UI);
+//  - the index list (R32I).
+// Lights are assigned one depth slice per job on the thread pool.
+//
+// Instead of clusters, objects can get their own list of the OBJECT_LIGHTS lights adding the most to their bounds,
+// indexed by instance transform (R32I, -1 past the last light). Objects reached by more lights lose the faintest.
+class ClusteredLights {
+public:
+    static constexpr int CLUSTERS_X = 16;
+    static constexpr int CLUSTERS_Y = 9;
+    static constexpr int CLUSTERS_Z = 24;
+    static constexpr int CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+    static constexpr int OBJECT_LIGHTS = 8;
+
+    explicit ClusteredLights(ThreadPool &threadPool);
+
+    ~ClusteredLights();
+
+    ClusteredLights(const ClusteredLights &) = delete;
+
+    ClusteredLights &operator=(const ClusteredLights &) = delete;
+
+    // Uploads the active lights and, with clusters, assigns them to the clusters of a perspective view. fovY is in
+    // degrees. Per-object lists are cleared.
+    void build(const LightManager &lights, LightCulling culling, const glm::mat4 &view, float fovY, float aspect,
+               float near, float far);
+
+    // Requests the list of lights of an instance, picked by buildObjectLists.
+    void addObject(std::uint32_t transform, const AABB &bounds);
+
+    // Picks the lights of every object added since build, spread over the thread pool, and uploads the lists of
+    // transformCount instances. Instances that were not added get empty lists.
+    void buildObjectLists(std::size_t transformCount);
+
+    // Binds the buffers, and sets the uniforms of a program including clusters.glsl. The program must be in use.
+    void bind(Shader *shader) const;
+
+    [[nodiscard]] const ClusterStats &getStats() const { return m_stats; }
+
+private:
+    struct BufferTexture {
+        GLuint buffer{}, texture{};
+    };
+
+    // Point and spot lights, indexed like the lights after the directional ones.
+    struct LocalLight {
+        glm::vec3 position;
+        float range;
+        glm::vec3 attenuation; // constant, linear, quadratic
+        float intensity;
+    };
+
+    struct Sphere {
+        glm::vec3 center;
+        float radius;
+    };
+
+    struct Object {
+        std::uint32_t transform;
+        AABB bounds;
+    };
+
+    struct Bounds {
+        glm::vec3 min, max;
+    };
+
+    ThreadPool &m_threadPool;
+    BufferTexture m_lightData, m_clusters, m_clusterLights, m_objectLights;
+
+    std::vector<glm::vec4> m_lightTexels;
+    std::vector<LocalLight> m_localLights;
+    std::vector<Sphere> m_spheres; // view space, indexed like m_localLights
+    int m_globalLights = 0;
+    std::array<Bounds, CLUSTER_COUNT> m_bounds{};
+    float m_fovY = 0.0f, m_aspect = 0.0f, m_near = 0.0f, m_far = 0.0f; // of the cluster bounds
+    glm::vec2 m_tileScale{0.0f}; // clusters per pixel
+
+    // Filled one slice per job, then concatenated.
+    std::array<std::vector<GLint>, CLUSTERS_Z> m_sliceLights;
+    std::array<std::array<std::uint32_t, CLUSTERS_X * CLUSTERS_Y>, CLUSTERS_Z> m_sliceCounts{};
+    std::vector<glm::uvec2> m_ranges;
+    std::vector<GLint> m_indices;
+    std::vector<Object> m_objects;
+    std::vector<GLint> m_objectIndices; // OBJECT_LIGHTS per transform
+    ClusterStats m_stats;
+
+    void computeBounds(float fovY, float aspect, float near, float far);
+
+    void assignSlice(int slice);
+
+    // Writes the most significant lights of the object to its list.
+    void pickLights(const Object &object);
+
+    static void upload(const BufferTexture &target, const void *data, std::size_t size);
+};
+
+#endif
@@ -0,0 +1,161 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+
+#include "Culling.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULLING_AVX
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULLING_SSE
+#endif
+
+void AABB::expand(const glm::vec3 &point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+
+void AABB::expand(const AABB &other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+}
+
+float AABB::getSurfaceArea() const {
+    const auto size = max - min;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+bool AABB::overlaps(const AABB &other) const {
+    return min.x <= other.max.x && max.x >= other.min.x && min.y <= other.max.y && max.y >= other.min.y &&
+           min.z <= other.max.z && max.z >= other.min.z;
+}
+
+AABB AABB::transform(const glm::mat4 &matrix) const {
+    // Arvo: the transformed extent along each axis is the sum of the absolute contributions of the box axes.
+    const auto center = glm::vec3(matrix * glm::vec4(getCenter(), 1.0f));
+    const auto extent = (max - min) * 0.5f;
+    const auto newExtent = glm::abs(glm::vec3(matrix[0])) * extent.x + glm::abs(glm::vec3(matrix[1])) * extent.y +
+                           glm::abs(glm::vec3(matrix[2])) * extent.z;
+    return {center - newExtent, center + newExtent};
+}
+
+void AABBList::clear() {
+    minX.clear();
+    minY.clear();
+    minZ.clear();
+    maxX.clear();
+    maxY.clear();
+    maxZ.clear();
+}
+
+void AABBList::push_back(const AABB &box) {
+    minX.push_back(box.min.x);
+    minY.push_back(box.min.y);
+    minZ.push_back(box.min.z);
+    maxX.push_back(box.max.x);
+    maxY.push_back(box.max.y);
+    maxZ.push_back(box.max.z);
+}
+
+Frustum::Frustum(const glm::mat4 &viewProjection) : m_viewProjection{viewProjection} {
+    // Gribb-Hartmann: each plane is the last row of the matrix plus or minus one of the others (glm is column-major).
+    for (auto i = 0; i < 3; ++i) {
+        for (auto side = 0; side < 2; ++side) {
+            auto &plane = m_planes[i * 2 + side];
+            const auto sign = side == 0 ? 1.0f : -1.0f;
+            for (auto column = 0; column < 4; ++column) {
+                plane[column] = viewProjection[column][3] + sign * viewProjection[column][i];
+            }
+            plane /= glm::length(glm::vec3(plane));
+        }
+    }
+}
+
+bool Frustum::intersects(const AABB &box) const {
+    for (const auto &plane: m_planes) {
+        // Corner of the box the furthest along the plane normal.
+        const auto corner = glm::vec3(plane.x >= 0.0f ? box.max.x : box.min.x,
+                                      plane.y >= 0.0f ? box.max.y : box.min.y,
+                                      plane.z >= 0.0f ? box.max.z : box.min.z);
+        if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+void Frustum::intersects(const AABBList &boxes, std::vector<std::uint8_t> &visible) const {
+    const auto count = boxes.size();
+    visible.resize(count);
+
+    // The corner tested against a plane only depends on the signs of its normal, so each plane reads one of the two
+    // arrays of every component for the whole batch.
+    struct PlaneCorners {
+        const float *x, *y, *z;
+        glm::vec4 plane;
+    };
+    std::array<PlaneCorners, 6> planes{};
+    for (auto i = 0; i < m_planes.size(); ++i) {
+        const auto &plane = m_planes[i];
+        planes[i] = {
+            plane.x >= 0.0f ? boxes.maxX.data() : boxes.minX.data(),
+            plane.y >= 0.0f ? boxes.maxY.data() : boxes.minY.data(),
+            plane.z >= 0.0f ? boxes.maxZ.data() : boxes.minZ.data(),
+            plane
+        };
+    }
+
+    std::size_t i = 0;
+#if defined(CULLING_AVX)
+    __m256 wide[6][4];
+    for (auto p = 0; p < planes.size(); ++p) {
+        for (auto c = 0; c < 4; ++c) {
+            wide[p][c] = _mm256_set1_ps(planes[p].plane[c]);
+        }
+    }
+    for (; i + 8 <= count; i += 8) {
+        auto inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (auto p = 0; p < planes.size(); ++p) {
+            const auto &[x, y, z, plane] = planes[p];
+            auto distance = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(x + i), wide[p][0]), wide[p][3]);
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_loadu_ps(y + i), wide[p][1]));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_loadu_ps(z + i), wide[p][2]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+        const auto mask = _mm256_movemask_ps(inside);
+        for (auto lane = 0; lane < 8; ++lane) {
+            visible[i + lane] = static_cast<std::uint8_t>(mask >> lane & 1);
+        }
+    }
+#elif defined(CULLING_SSE)
+    __m128 wide[6][4];
+    for (auto p = 0; p < planes.size(); ++p) {
+        for (auto c = 0; c < 4; ++c) {
+            wide[p][c] = _mm_set1_ps(planes[p].plane[c]);
+        }
+    }
+    for (; i + 4 <= count; i += 4) {
+        auto inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+        for (auto p = 0; p < planes.size(); ++p) {
+            const auto &[x, y, z, plane] = planes[p];
+            auto distance = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + i), wide[p][0]), wide[p][3]);
+            distance = _mm_add_ps(distance, _mm_mul_ps(_mm_loadu_ps(y + i), wide[p][1]));
+            distance = _mm_add_ps(distance, _mm_mul_ps(_mm_loadu_ps(z + i), wide[p][2]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+        }
+        const auto mask = _mm_movemask_ps(inside);
+        for (auto lane = 0; lane < 4; ++lane) {
+            visible[i + lane] = static_cast<std::uint8_t>(mask >> lane & 1);
+        }
+    }
+#endif
+
+    // Remaining boxes, or all of them without SIMD support.
+    for (; i < count; ++i) {
+        auto inside = true;
+        for (const auto &[x, y, z, plane]: planes) {
+            inside &= plane.x * x[i] + plane.y * y[i] + plane.z * z[i] + plane.w >= 0.0f;
+        }
+        visible[i] = static_cast<std::uint8_t>(inside);
+    }
+}
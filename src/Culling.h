@@ -0,0 +1,73 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+struct AABB {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+    void expand(const glm::vec3 &point);
+
+    void expand(const AABB &other);
+
+    [[nodiscard]] glm::vec3 getCenter() const { return (min + max) * 0.5f; }
+
+    [[nodiscard]] float getSurfaceArea() const;
+
+    [[nodiscard]] bool overlaps(const AABB &other) const;
+
+    bool operator==(const AABB &other) const = default;
+
+    // Smallest axis-aligned box containing this one once transformed.
+    [[nodiscard]] AABB transform(const glm::mat4 &matrix) const;
+};
+
+// Boxes stored component by component, so that batches of them can be tested with SIMD instructions.
+struct AABBList {
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+
+    void clear();
+
+    void push_back(const AABB &box);
+
+    [[nodiscard]] std::size_t size() const { return minX.size(); }
+};
+
+struct CullStats {
+    int tested = 0;
+    int visible = 0;
+    double milliseconds = 0.0; // time spent in the batch tests
+};
+
+class Frustum {
+public:
+    Frustum() = default;
+
+    // Extracts the six planes (left, right, bottom, top, near, far) from a view-projection matrix. Plane normals
+    // point inside the frustum.
+    explicit Frustum(const glm::mat4 &viewProjection);
+
+    // Conservative: boxes near a corner of the frustum may be reported as visible.
+    [[nodiscard]] bool intersects(const AABB &box) const;
+
+    // Batch version of intersects(): visible[i] is set to 1 if boxes[i] intersects the frustum, 0 otherwise. Uses
+    // AVX or SSE when the target supports them.
+    void intersects(const AABBList &boxes, std::vector<std::uint8_t> &visible) const;
+
+    [[nodiscard]] const std::array<glm::vec4, 6> &getPlanes() const { return m_planes; }
+
+    [[nodiscard]] const glm::mat4 &getViewProjection() const { return m_viewProjection; }
+
+private:
+    std::array<glm::vec4, 6> m_planes{};
+    glm::mat4 m_viewProjection{1.0f};
+};
+
+#endif
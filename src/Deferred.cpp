@@ -0,0 +1,253 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Deferred.h"
+
+#include <cstring>
+#include <utility>
+
+// Unit box around the origin, vertex i at (i & 1, i & 2, i & 4) with -0.5 or 0.5 on each axis.
+constexpr std::array<GLuint, 36> VOLUME_INDICES = {
+    0, 4, 6, 0, 6, 2, // -x
+    1, 3, 7, 1, 7, 5, // +x
+    0, 1, 5, 0, 5, 4, // -y
+    2, 6, 7, 2, 7, 3, // +y
+    0, 2, 3, 0, 3, 1, // -z
+    4, 5, 7, 4, 7, 6, // +z
+};
+
+DeferredRenderer::DeferredRenderer(ShaderManager &shaders, const std::string &shaderDir) : m_shaders{shaders} {
+    shaders.add("deferred_light", shaderDir + "deferred_light.vert", shaderDir + "deferred_light.frag");
+    shaders.add("deferred_composite", shaderDir + "fullscreen.vert", shaderDir + "deferred_composite.frag");
+
+    glGenFramebuffers(1, &m_framebuffer);
+    glGenVertexArrays(1, &m_screenVao);
+
+    std::array<glm::vec3, 8> corners{};
+    for (auto i = 0; i < corners.size(); ++i) {
+        corners[i] = glm::vec3(i & 1 ? 0.5f : -0.5f, i & 2 ? 0.5f : -0.5f, i & 4 ? 0.5f : -0.5f);
+    }
+    glGenVertexArrays(1, &m_volumeVao);
+    glGenBuffers(1, &m_volumeVbo);
+    glGenBuffers(1, &m_volumeEbo);
+    glBindVertexArray(m_volumeVao);
+    glBindBuffer(GL_ARRAY_BUFFER, m_volumeVbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_volumeEbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(VOLUME_INDICES), VOLUME_INDICES.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), static_cast<void *>(nullptr));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+DeferredRenderer::~DeferredRenderer() {
+    glDeleteBuffers(1, &m_volumeEbo);
+    glDeleteBuffers(1, &m_volumeVbo);
+    glDeleteVertexArrays(1, &m_volumeVao);
+    glDeleteVertexArrays(1, &m_screenVao);
+    glDeleteRenderbuffers(1, &m_depthStencil);
+    glDeleteTextures(TARGET_COUNT, m_targets.data());
+    glDeleteFramebuffers(1, &m_framebuffer);
+}
+
+bool DeferredRenderer::isReady() const {
+    return m_shaders.isReady("deferred_light") && m_shaders.isReady("deferred_composite");
+}
+
+void DeferredRenderer::beginGeometry() {
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_target);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] != m_width || viewport[3] != m_height)
+        resize(viewport[2], viewport[3]);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    // Outputs of object.frag by location: lighting, the weights of transparency (unused), then the G-buffer.
+    constexpr std::array<GLenum, 6> drawBuffers = {
+        GL_COLOR_ATTACHMENT0 + Lighting, GL_NONE, GL_COLOR_ATTACHMENT0 + Normal, GL_COLOR_ATTACHMENT0 + Albedo,
+        GL_COLOR_ATTACHMENT0 + Specular, GL_COLOR_ATTACHMENT0 + Depth
+    };
+    glDrawBuffers(static_cast<GLsizei>(drawBuffers.size()), drawBuffers.data());
+
+    // Draw buffers are cleared by their index in the list above. Albedo alpha 0 marks pixels without a lit surface.
+    constexpr std::array zero = {0.0f, 0.0f, 0.0f, 0.0f};
+    constexpr std::array far = {1.0f, 0.0f, 0.0f, 0.0f};
+    for (const auto buffer: {0, 2, 3, 4}) {
+        glClearBufferfv(GL_COLOR, buffer, zero.data());
+    }
+    glClearBufferfv(GL_COLOR, 5, far.data());
+    glDepthMask(GL_TRUE);
+    glStencilMask(0xFF);
+    glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+}
+
+void DeferredRenderer::shade(const LightManager &lights, const ShadowCascades &shadows, const ShadowAtlas &atlas,
+                             RingBuffer &ring, const float shininess) {
+    // Light volumes and full-screen triangles must be filled, even in wireframe.
+    GLint polygonMode[2];
+    glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    const bool depthTest = glIsEnabled(GL_DEPTH_TEST);
+    GLint depthFunc;
+    glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+
+    // Every light adds to the light emitted by the surfaces.
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0 + Lighting);
+    glDepthMask(GL_FALSE);
+    glStencilMask(0xFF);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    const auto lightShader = m_shaders.get("deferred_light");
+    lightShader->use();
+    for (auto unit = 0; const auto &[target, sampler]: {
+             std::pair{Normal, "gNormal"}, std::pair{Albedo, "gAlbedo"}, std::pair{Specular, "gSpecular"},
+             std::pair{Depth, "gDepth"}
+         }) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, m_targets[target]);
+        lightShader->setInt(sampler, unit++);
+    }
+    lightShader->setFloat("shininess", shininess);
+    lightShader->setBlockBinding("Frame", FRAME_BLOCK_BINDING);
+    shadows.bind(lightShader);
+    atlas.bind(lightShader);
+
+    // Boxes of the lights with bounds, in the order they are drawn, one per aligned slot. There is always one, so that
+    // the block is backed even for full-screen lights.
+    m_volumes.clear();
+    lights.forEachActive([this](const Light &light) {
+        if (const auto bounds = light.getBounds()) {
+            const auto model = glm::translate(glm::mat4(1.0f), bounds->getCenter());
+            m_volumes.push_back(glm::scale(model, bounds->max - bounds->min));
+        }
+    });
+    if (m_volumes.empty())
+        m_volumes.emplace_back(1.0f);
+    const auto alignment = RingBuffer::getUniformAlignment();
+    const auto stride = (static_cast<GLsizeiptr>(sizeof(glm::mat4)) + alignment - 1) & ~(alignment - 1);
+    const auto volumes = ring.allocate(stride * static_cast<GLsizeiptr>(m_volumes.size()), alignment);
+    for (std::size_t i = 0; i < m_volumes.size(); ++i) {
+        std::memcpy(volumes.data + static_cast<GLsizeiptr>(i) * stride, &m_volumes[i], sizeof(glm::mat4));
+    }
+    const auto bindVolume = [&](const std::size_t i) {
+        ring.bindRange(GL_UNIFORM_BUFFER, VOLUME_BLOCK_BINDING,
+                       {volumes.buffer, volumes.offset + static_cast<GLsizeiptr>(i) * stride, sizeof(glm::mat4)});
+    };
+    lightShader->setBlockBinding("Volume", VOLUME_BLOCK_BINDING);
+    bindVolume(0);
+
+    m_stats = {};
+    std::size_t volume = 0;
+    auto shadowPending = true; // the first directional light casts the shadows
+    lights.forEachActive([&](const Light &light) {
+        light.setShaderUniforms(lightShader, "light");
+        const auto shadowed = shadowPending && light.getType() == Light::Type::Directional;
+        lightShader->setBool("shadowed", shadowed);
+        shadowPending = shadowPending && !shadowed;
+        m_stats.lights++;
+
+        const auto bounds = light.getBounds();
+        if (!bounds) {
+            lightShader->setBool("volume", false);
+            glDisable(GL_DEPTH_TEST);
+            glDisable(GL_STENCIL_TEST);
+            glBindVertexArray(m_screenVao);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            return;
+        }
+
+        lightShader->setBool("volume", true);
+        bindVolume(volume++);
+        glBindVertexArray(m_volumeVao);
+
+        // Surfaces in front of a back face but behind every front face are inside the box: the count of back faces
+        // minus front faces in front of which the depth test fails is not zero. The camera may be inside the box, its
+        // front faces are then clipped away.
+        glClear(GL_STENCIL_BUFFER_BIT);
+        glEnable(GL_STENCIL_TEST);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glStencilFunc(GL_ALWAYS, 0, 0);
+        glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+        glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+        glDrawElements(GL_TRIANGLES, VOLUME_INDICES.size(), GL_UNSIGNED_INT, nullptr);
+
+        // Back faces cover the box wherever the camera is, each marked pixel is shaded once.
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
+        glDrawElements(GL_TRIANGLES, VOLUME_INDICES.size(), GL_UNSIGNED_INT, nullptr);
+        glDisable(GL_CULL_FACE);
+        m_stats.volumes++;
+    });
+
+    // Lit surfaces cover what was drawn before them, such as light proxies, only where they are nearer.
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(m_target));
+    glDisable(GL_BLEND);
+    glDisable(GL_STENCIL_TEST);
+    glDepthMask(GL_TRUE);
+    depthTest ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+
+    const auto compositeShader = m_shaders.get("deferred_composite");
+    compositeShader->use();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_targets[Lighting]);
+    compositeShader->setInt("lighting", 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_targets[Depth]);
+    compositeShader->setInt("gDepth", 1);
+    glBindVertexArray(m_screenVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindVertexArray(0);
+    glDepthFunc(static_cast<GLenum>(depthFunc));
+    glPolygonMode(GL_FRONT_AND_BACK, static_cast<GLenum>(polygonMode[0]));
+}
+
+void DeferredRenderer::resize(const int width, const int height) {
+    m_width = width;
+    m_height = height;
+    if (width <= 0 || height <= 0)
+        return; // minimized, the old targets are kept
+
+    constexpr std::array<std::pair<GLint, GLenum>, TARGET_COUNT> formats = {
+        {
+            {GL_RGBA16F, GL_RGBA}, // lighting
+            {GL_RGBA16F, GL_RGBA}, // normal
+            {GL_RGBA8, GL_RGBA}, // albedo
+            {GL_RGBA8, GL_RGBA}, // specular
+            {GL_R32F, GL_RED}, // depth
+        }
+    };
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    for (auto target = 0; target < TARGET_COUNT; ++target) {
+        auto &texture = m_targets[target];
+        if (texture == 0)
+            glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, formats[target].first, width, height, 0, formats[target].second, GL_FLOAT,
+                     nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + target, GL_TEXTURE_2D, texture, 0);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Same format as the default framebuffer, for the depth blits of GPU occlusion culling.
+    if (m_depthStencil == 0)
+        glGenRenderbuffers(1, &m_depthStencil);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthStencil);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_depthStencil);
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(m_target));
+}
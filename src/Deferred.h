@@ -0,0 +1,72 @@
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Light.h"
+#include "RingBuffer.h"
+#include "Shader.h"
+#include "Shadows.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+struct DeferredStats {
+    int lights = 0;
+    int volumes = 0; // lights drawn as the box of their range rather than over the whole screen
+};
+
+// Uniform buffer binding of the box of the light being drawn, declared by deferred_light.vert.
+constexpr GLuint VOLUME_BLOCK_BINDING = 1;
+
+// Deferred shading of the opaque passes. Surfaces are first written to a G-buffer: normal, albedo, specular and
+// depth, plus the light they emit. Each light is then drawn once, reading the G-buffer:
+//  - directional lights, reaching everything, over the whole screen;
+//  - point and spot lights over the box of their attenuation range. A stencil pass keeps the pixels whose surface is
+//    inside the box, so that only surfaces the light can reach are shaded.
+// The lit surfaces are finally copied to the framebuffer with their depth, and the forward passes go on from there.
+// The cost is one shading per light and covered pixel, whatever the overdraw.
+class DeferredRenderer {
+public:
+    // The light and composite programs are added to the shader manager.
+    DeferredRenderer(ShaderManager &shaders, const std::string &shaderDir);
+
+    ~DeferredRenderer();
+
+    DeferredRenderer(const DeferredRenderer &) = delete;
+
+    DeferredRenderer &operator=(const DeferredRenderer &) = delete;
+
+    // The light and composite programs are linked, nothing can be shaded before.
+    [[nodiscard]] bool isReady() const;
+
+    // Draws into the G-buffer from now on, cleared. To be called before the opaque passes.
+    void beginGeometry();
+
+    // Shades the G-buffer with every active light and copies the result to the framebuffer bound on beginGeometry.
+    // The camera is read from the FrameConstants bound to FRAME_BLOCK_BINDING. The boxes of the lights are written into
+    // the ring buffer together, each draw binds its own.
+    void shade(const LightManager &lights, const ShadowCascades &shadows, const ShadowAtlas &atlas, RingBuffer &ring,
+               float shininess);
+
+    [[nodiscard]] const DeferredStats &getStats() const { return m_stats; }
+
+private:
+    enum Target { Lighting = 0, Normal, Albedo, Specular, Depth, TARGET_COUNT };
+
+    const ShaderManager &m_shaders;
+    GLuint m_framebuffer{}, m_depthStencil{};
+    std::array<GLuint, TARGET_COUNT> m_targets{};
+    GLuint m_volumeVao{}, m_volumeVbo{}, m_volumeEbo{};
+    GLuint m_screenVao{}; // no attributes, full-screen triangles are generated from gl_VertexID
+    GLint m_target = 0;
+    int m_width = 0, m_height = 0;
+    DeferredStats m_stats;
+    std::vector<glm::mat4> m_volumes; // scratch, model matrices of the light boxes
+
+    void resize(int width, int height);
+};
+
+#endif
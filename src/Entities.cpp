@@ -0,0 +1,111 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+
+#include "Entities.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+Entity EntityStorage::create(std::shared_ptr<Model> model, const ModelMatrix &placement, const Entity parent) {
+    std::uint32_t slot;
+    if (m_freeSlots.empty()) {
+        slot = static_cast<std::uint32_t>(m_slots.size());
+        m_slots.emplace_back();
+    } else {
+        slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    }
+    const auto index = static_cast<std::uint32_t>(m_entities.size());
+    m_slots[slot].index = index;
+    const Entity entity{slot, m_slots[slot].generation};
+
+    const auto parentNode = isAlive(parent) ? m_nodes[getIndex(parent)] : SceneGraph::NO_PARENT;
+    // The local transform is set by the next update, the placement being dirty.
+    const auto node = m_graph.add(glm::mat4(1.0f), glm::mat3(1.0f), parentNode);
+    m_entities.push_back(entity);
+    m_models.push_back(std::move(model));
+    m_visible.push_back(1);
+    m_outlined.push_back(0);
+    m_placements.push_back(placement);
+    m_worlds.emplace_back(1.0f);
+    m_normals.emplace_back(1.0f);
+    m_nodes.push_back(node);
+    m_nodeEntities.push_back(index);
+    return entity;
+}
+
+void EntityStorage::destroy(const Entity entity) {
+    if (!isAlive(entity))
+        return;
+    const auto nodes = m_graph.remove(m_nodes[getIndex(entity)]);
+    std::vector<std::uint32_t> removed;
+    for (std::size_t node = 0; node < nodes.size(); ++node) {
+        if (nodes[node] == SceneGraph::NO_PARENT)
+            removed.push_back(m_nodeEntities[node]);
+    }
+    for (auto &node: m_nodes) {
+        node = nodes[node];
+    }
+    // From the last index, so that the entity moved into each place is never one to remove.
+    std::ranges::sort(removed, std::greater{});
+    for (const auto i: removed) {
+        swapAndPop(i);
+    }
+    m_nodeEntities.resize(m_graph.size());
+    for (std::size_t i = 0; i < m_nodes.size(); ++i) {
+        m_nodeEntities[m_nodes[i]] = static_cast<std::uint32_t>(i);
+    }
+}
+
+bool EntityStorage::isAlive(const Entity entity) const {
+    return entity.generation != 0 && entity.slot < m_slots.size() &&
+           m_slots[entity.slot].generation == entity.generation;
+}
+
+Entity EntityStorage::getParent(const std::size_t i) const {
+    const auto parent = m_graph.getParent(m_nodes[i]);
+    return parent == SceneGraph::NO_PARENT ? Entity{} : m_entities[m_nodeEntities[parent]];
+}
+
+void EntityStorage::setParent(const std::size_t i, const Entity parent) {
+    m_graph.setParent(m_nodes[i], isAlive(parent) ? m_nodes[getIndex(parent)] : SceneGraph::NO_PARENT);
+}
+
+std::span<const std::uint32_t> EntityStorage::update() {
+    for (const auto i: m_placements.update()) {
+        m_graph.setLocal(m_nodes[i], m_placements.getWorld(i), m_placements.getNormal(i));
+    }
+    m_updated.clear();
+    for (const auto node: m_graph.update()) {
+        const auto i = m_nodeEntities[node];
+        m_worlds[i] = m_graph.getWorld(node);
+        m_normals[i] = m_graph.getWorldNormal(node);
+        m_updated.push_back(i);
+    }
+    return m_updated;
+}
+
+void EntityStorage::swapAndPop(const std::size_t i) {
+    auto &slot = m_slots[m_entities[i].slot];
+    // Generation 0 is the null handle's.
+    slot.generation = slot.generation == std::numeric_limits<std::uint32_t>::max() ? 1 : slot.generation + 1;
+    m_freeSlots.push_back(m_entities[i].slot);
+
+    const auto last = m_entities.size() - 1;
+    const auto at = [i, last](auto &components) {
+        if (i != last)
+            components[i] = std::move(components[last]);
+        components.pop_back();
+    };
+    at(m_entities);
+    at(m_models);
+    at(m_visible);
+    at(m_outlined);
+    at(m_worlds);
+    at(m_normals);
+    at(m_nodes);
+    m_placements.swapAndPop(i);
+    if (i != last)
+        m_slots[m_entities[i].slot].index = static_cast<std::uint32_t>(i);
+}
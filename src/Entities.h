@@ -0,0 +1,110 @@
+#ifndef ENTITIES_H
+#define ENTITIES_H
+
+#include <glm/glm.hpp>
+
+#include "Transform.h"
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+class Model;
+
+// Handle of an entity, stable while the entity lives. Its slot is reused once the entity is destroyed, with another
+// generation: handles of destroyed entities are detected instead of reaching the new one.
+struct Entity {
+    std::uint32_t slot = 0;
+    std::uint32_t generation = 0; // 0 for the null handle, never alive
+
+    bool operator==(const Entity &other) const = default;
+};
+
+// Components of the scene entities, in dense arrays indexed alike: the first size() indices are the living entities,
+// with nothing in between. Per-frame loops read the arrays they need from start to end. Destroying an entity moves the
+// last one into its place, indices are only valid until then, handles are kept.
+//
+// Entities form a hierarchy through a SceneGraph, ordered by creation rather than like the dense arrays: parents must
+// be created before their children. Placements are relative to the parent, world transforms are copied back into the
+// dense arrays for the entities whose transform changed.
+class EntityStorage {
+public:
+    Entity create(std::shared_ptr<Model> model, const ModelMatrix &placement, Entity parent = {});
+
+    // Destroys the entity and its descendants. Destroyed handles are ignored.
+    void destroy(Entity entity);
+
+    [[nodiscard]] bool isAlive(Entity entity) const;
+
+    // Dense index of a living entity.
+    [[nodiscard]] std::size_t getIndex(const Entity entity) const { return m_slots[entity.slot].index; }
+
+    [[nodiscard]] std::size_t size() const { return m_entities.size(); }
+
+    [[nodiscard]] bool empty() const { return m_entities.empty(); }
+
+    // Components, by dense index.
+    [[nodiscard]] std::span<const Entity> getEntities() const { return m_entities; }
+
+    [[nodiscard]] std::span<const std::shared_ptr<Model> > getModels() const { return m_models; }
+
+    [[nodiscard]] std::span<const std::uint8_t> getVisible() const { return m_visible; }
+
+    [[nodiscard]] std::span<const std::uint8_t> getOutlined() const { return m_outlined; }
+
+    [[nodiscard]] std::span<const glm::mat4> getWorlds() const { return m_worlds; }
+
+    [[nodiscard]] std::span<const glm::mat3> getNormals() const { return m_normals; }
+
+    void setVisible(const std::size_t i, const bool visible) { m_visible[i] = visible; }
+
+    void setOutlined(const std::size_t i, const bool outlined) { m_outlined[i] = outlined; }
+
+    [[nodiscard]] ModelMatrix getPlacement(const std::size_t i) const { return m_placements.get(i); }
+
+    void setPlacement(const std::size_t i, const ModelMatrix &placement) { m_placements.set(i, placement); }
+
+    // The null handle for roots.
+    [[nodiscard]] Entity getParent(std::size_t i) const;
+
+    // Parents are created before their children, false otherwise.
+    [[nodiscard]] bool canParent(std::size_t parent, std::size_t child) const { return m_nodes[parent] < m_nodes[child]; }
+
+    // The null handle makes the entity a root.
+    void setParent(std::size_t i, Entity parent);
+
+    // Computes the world transforms of the entities that moved, along with their descendants. Returns their dense
+    // indices.
+    std::span<const std::uint32_t> update();
+
+    [[nodiscard]] const TransformStats &getTransformStats() const { return m_placements.getStats(); }
+
+private:
+    struct Slot {
+        std::uint32_t index = 0; // dense, while alive
+        std::uint32_t generation = 1;
+    };
+
+    std::vector<Slot> m_slots;
+    std::vector<std::uint32_t> m_freeSlots;
+
+    // Dense components.
+    std::vector<Entity> m_entities;
+    std::vector<std::shared_ptr<Model> > m_models;
+    std::vector<std::uint8_t> m_visible;
+    std::vector<std::uint8_t> m_outlined;
+    TransformCache m_placements;
+    std::vector<glm::mat4> m_worlds;
+    std::vector<glm::mat3> m_normals;
+    std::vector<std::uint32_t> m_nodes; // in m_graph
+
+    SceneGraph m_graph;
+    std::vector<std::uint32_t> m_nodeEntities; // dense index of each node
+    std::vector<std::uint32_t> m_updated;
+
+    // Moves the last entity into the place of this one and frees its slot.
+    void swapAndPop(std::size_t i);
+};
+
+#endif
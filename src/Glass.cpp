@@ -0,0 +1,51 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <imgui.h>
+
+#include "Glass.h"
+
+#include <algorithm>
+#include <numbers>
+#include <random>
+
+constexpr int MAX_PANES = 100000;
+
+GlassPanes::GlassPanes(const std::string &texturePath)
+    : m_field{texturePath, glm::vec2(-0.5f), glm::vec2(0.5f)} {
+    scatter();
+}
+
+void GlassPanes::widgets() {
+    if (ImGui::CollapsingHeader("Glass panes")) {
+        ImGui::Checkbox("Draw##Glass", &m_enabled);
+        ImGui::InputInt("Seed##Glass", &m_seed);
+        ImGui::SliderInt("Panes##Glass", &m_paneCount, 0, MAX_PANES);
+        ImGui::SliderFloat("Region size##Glass", &m_regionSize, 1.0f, 200.0f);
+        ImGui::SliderFloat("Chunk size##Glass", &m_chunkSize, 1.0f, 50.0f);
+        ImGui::DragFloatRange2("Height##Glass", &m_minHeight, &m_maxHeight, 0.1f, -10.0f, 20.0f);
+        if (ImGui::Button("Scatter##Glass"))
+            scatter();
+        ImGui::Text("Visible: %d panes", m_field.getVisibleInstances());
+    }
+}
+
+void GlassPanes::scatter() {
+    std::uniform_real_distribution<float> height(m_minHeight, std::max(m_minHeight, m_maxHeight));
+    std::uniform_real_distribution<float> angle(0.0f, std::numbers::pi_v<float>);
+    const auto place = [&](const float x, const float z, std::mt19937 &rng) {
+        const glm::vec3 position(x, height(rng), z);
+        auto model = glm::translate(glm::mat4(1.0f), position);
+        model = glm::rotate(model, angle(rng), glm::vec3(0.0f, 1.0f, 0.0f));
+        // The quad is a unit square around its center, whatever its rotation.
+        return QuadField::Instance{model, position, {position - glm::vec3(0.5f), position + glm::vec3(0.5f)}};
+    };
+    m_field.scatter(m_seed, m_paneCount, m_regionSize, m_chunkSize, place);
+}
+
+void GlassPanes::submit(RenderQueue &queue, Shader *const shader, const Frustum &frustum) {
+    if (m_enabled)
+        m_field.submit(queue, shader, frustum);
+    else
+        m_field.clearStats();
+}
@@ -0,0 +1,36 @@
+#ifndef GLASS_H
+#define GLASS_H
+
+#include "Culling.h"
+#include "QuadField.h"
+#include "RenderQueue.h"
+#include "Shader.h"
+
+#include <string>
+
+// Tinted window panes standing in a box above the ground, in a quad field like grass blades. Each visible pane is
+// sorted back to front with every other transparent instance.
+class GlassPanes {
+public:
+    explicit GlassPanes(const std::string &texturePath);
+
+    void widgets();
+
+    // Same seed and settings give the same panes.
+    void scatter();
+
+    void submit(RenderQueue &queue, Shader *shader, const Frustum &frustum);
+
+private:
+    QuadField m_field;
+
+    bool m_enabled = true;
+    int m_seed = 1;
+    int m_paneCount = 200;
+    float m_regionSize = 20.0f;
+    float m_chunkSize = 4.0f;
+    float m_minHeight = 0.5f;
+    float m_maxHeight = 3.0f;
+};
+
+#endif
@@ -0,0 +1,275 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+
+#include "HiZ.h"
+
+#include <algorithm>
+#include <bit>
+
+constexpr GLuint CULL_GROUP_SIZE = 64;
+constexpr GLuint PYRAMID_GROUP_SIZE = 8;
+
+HiZCuller::HiZCuller(ShaderManager &shaders, const std::string &shaderDir) : m_shaders{shaders} {
+    shaders.add("depth_pyramid", shaderDir + "depth_pyramid.comp");
+    shaders.add("occlusion_cull", shaderDir + "occlusion_cull.comp");
+
+    glGenBuffers(1, &m_instanceBuffer);
+    glGenBuffers(1, &m_visibilityBuffer);
+    glGenBuffers(1, &m_counterBuffer);
+    for (auto &readback: m_readbacks) {
+        glGenBuffers(1, &readback.buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, readback.buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, 2 * sizeof(GLuint), nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glGenBuffers(2, m_commandBuffers.data());
+    glGenBuffers(2, m_indexBuffers.data());
+    glGenTextures(2, m_indexTextures.data());
+    glGenFramebuffers(1, &m_depthFramebuffer);
+
+    for (auto phase = 0; phase < 2; ++phase) {
+        glBindBuffer(GL_TEXTURE_BUFFER, m_indexBuffers[phase]);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(GLint), nullptr, GL_STREAM_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, m_indexTextures[phase]);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, m_indexBuffers[phase]);
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+HiZCuller::~HiZCuller() {
+    glDeleteFramebuffers(1, &m_depthFramebuffer);
+    glDeleteTextures(1, &m_depthTexture);
+    glDeleteTextures(1, &m_pyramid);
+    glDeleteTextures(2, m_indexTextures.data());
+    glDeleteBuffers(2, m_indexBuffers.data());
+    glDeleteBuffers(2, m_commandBuffers.data());
+    for (const auto &[buffer, fence, tested]: m_readbacks) {
+        if (fence)
+            glDeleteSync(fence);
+        glDeleteBuffers(1, &buffer);
+    }
+    glDeleteBuffers(1, &m_counterBuffer);
+    glDeleteBuffers(1, &m_visibilityBuffer);
+    glDeleteBuffers(1, &m_instanceBuffer);
+}
+
+bool HiZCuller::isSupported() {
+    return GLAD_GL_VERSION_4_3 != 0;
+}
+
+bool HiZCuller::isReady() const {
+    return m_shaders.isReady("depth_pyramid") && m_shaders.isReady("occlusion_cull");
+}
+
+void HiZCuller::reset(const std::size_t objectCount) {
+    m_objectCount = objectCount;
+    m_visibilityValid = false;
+}
+
+void HiZCuller::begin(const glm::mat4 &viewProjection) {
+    // Copies are read from the oldest, only once their fence is passed: reading them does not wait.
+    for (auto i = 0; i < READBACK_FRAMES; ++i) {
+        auto &[buffer, fence, tested] = m_readbacks[(m_readback + i) % READBACK_FRAMES];
+        if (!fence)
+            continue;
+        const auto status = glClientWaitSync(fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync(fence);
+        fence = nullptr;
+        std::array<GLuint, 2> drawn{};
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(drawn), drawn.data());
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        m_stats = {tested, static_cast<int>(drawn[Early]), static_cast<int>(drawn[Late])};
+    }
+    if (m_instances.empty())
+        m_stats = {};
+
+    m_viewProjection = viewProjection;
+    m_instances.clear();
+    m_commands.clear();
+}
+
+void HiZCuller::beginGroup() {
+    m_groupInstances = m_instances.size();
+    m_groupCommands = m_commands.size();
+}
+
+void HiZCuller::addInstance(const std::uint32_t object, const std::uint32_t transform, const AABB &bounds) {
+    m_instances.push_back({
+        glm::vec4(bounds.min, 1.0f), glm::vec4(bounds.max, 1.0f), object, transform,
+        static_cast<std::uint32_t>(m_groupCommands), 0, static_cast<std::uint32_t>(m_groupInstances), {}
+    });
+}
+
+HiZCuller::Draws HiZCuller::addDraw(const GLsizei indexCount, const GLuint firstIndex, const GLint baseVertex) {
+    const auto command = m_commands.size();
+    m_commands.push_back({static_cast<GLuint>(indexCount), 0, firstIndex, baseVertex, 0});
+    for (auto i = m_groupInstances; i < m_instances.size(); ++i) {
+        m_instances[i].commandCount++;
+    }
+
+    const auto draw = [&](const Phase phase) {
+        return IndirectDraw{
+            m_commandBuffers[phase], static_cast<GLintptr>(command * sizeof(DrawElementsIndirectCommand)),
+            m_indexTextures[phase], static_cast<std::uint32_t>(m_groupInstances)
+        };
+    };
+    return {draw(Early), draw(Late)};
+}
+
+void HiZCuller::submit(RenderQueue &queue) {
+    if (m_instances.empty())
+        return;
+    queue.addCallback(RenderPass::Opaque, [this] {
+        upload();
+        cull(Early);
+    });
+    queue.addCallback(RenderPass::OpaqueLate, [this] {
+        buildPyramid();
+        cull(Late);
+        readBack();
+    });
+}
+
+void HiZCuller::upload() {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_instanceBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(m_instances.size() * sizeof(Instance)),
+                 m_instances.data(), GL_STREAM_DRAW);
+    // Instance counts start at 0 in both phases, and are filled in by the culling.
+    for (auto phase = 0; phase < 2; ++phase) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_commandBuffers[phase]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER,
+                     static_cast<GLsizeiptr>(m_commands.size() * sizeof(DrawElementsIndirectCommand)),
+                     m_commands.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_indexBuffers[phase]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(m_instances.size() * sizeof(GLint)), nullptr,
+                     GL_STREAM_DRAW);
+    }
+    if (!m_visibilityValid) {
+        const std::vector<GLuint> visible(std::max<std::size_t>(m_objectCount, 1), 1);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_visibilityBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(visible.size() * sizeof(GLuint)),
+                     visible.data(), GL_DYNAMIC_DRAW);
+        m_visibilityValid = true;
+    }
+    constexpr std::array<GLuint, 2> drawn{};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counterBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(drawn), drawn.data(), GL_STREAM_READ);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void HiZCuller::buildPyramid() {
+    // The depth is read from the framebuffer being drawn to, the default one or a G-buffer.
+    GLint target;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] != m_width || viewport[3] != m_height)
+        resize(viewport[2], viewport[3]);
+    if (m_levels == 0) {
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+        return;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, target);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_depthFramebuffer);
+    glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+
+    // Each level is reduced from the one above, level 0 from the copy of the depth buffer.
+    const auto pyramidShader = m_shaders.get("depth_pyramid");
+    pyramidShader->use();
+    pyramidShader->setInt("source", 0);
+    glActiveTexture(GL_TEXTURE0);
+    for (auto level = 0; level < m_levels; ++level) {
+        glBindTexture(GL_TEXTURE_2D, level == 0 ? m_depthTexture : m_pyramid);
+        pyramidShader->setInt("sourceLevel", std::max(0, level - 1));
+        glBindImageTexture(0, m_pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        const auto width = static_cast<GLuint>(std::max(1, m_pyramidWidth >> level));
+        const auto height = static_cast<GLuint>(std::max(1, m_pyramidHeight >> level));
+        glDispatchCompute((width + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE,
+                          (height + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+}
+
+void HiZCuller::resize(const int width, const int height) {
+    m_width = width;
+    m_height = height;
+    glDeleteTextures(1, &m_depthTexture);
+    glDeleteTextures(1, &m_pyramid);
+    m_depthTexture = 0;
+    m_pyramid = 0;
+    m_levels = 0;
+    if (width <= 0 || height <= 0)
+        return; // minimized
+
+    // Blits between depth buffers need the same format as the default framebuffer.
+    glGenTextures(1, &m_depthTexture);
+    glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_depthFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, m_depthTexture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // Power of two sizes: every texel of a level covers exactly 2x2 texels of the one above.
+    m_pyramidWidth = static_cast<int>(std::bit_floor(static_cast<unsigned>(width)));
+    m_pyramidHeight = static_cast<int>(std::bit_floor(static_cast<unsigned>(height)));
+    m_levels = static_cast<int>(std::bit_width(static_cast<unsigned>(std::max(m_pyramidWidth, m_pyramidHeight))));
+    glGenTextures(1, &m_pyramid);
+    glBindTexture(GL_TEXTURE_2D, m_pyramid);
+    glTexStorage2D(GL_TEXTURE_2D, m_levels, GL_R32F, m_pyramidWidth, m_pyramidHeight);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void HiZCuller::cull(const Phase phase) {
+    // Without a pyramid, such as when minimized, the late phase draws nothing.
+    if (phase == Late && m_levels == 0)
+        return;
+
+    const auto cullShader = m_shaders.get("occlusion_cull");
+    cullShader->use();
+    cullShader->setInt("instanceCount", static_cast<int>(m_instances.size()));
+    cullShader->setBool("late", phase == Late);
+    if (phase == Late) {
+        cullShader->setMat4("viewProjection", m_viewProjection);
+        cullShader->setInt("depthPyramid", 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, m_pyramid);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_visibilityBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_commandBuffers[phase]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_indexBuffers[phase]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_counterBuffer);
+    const auto count = static_cast<GLuint>(m_instances.size());
+    glDispatchCompute((count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+    // Commands are read by the indirect draws, instance indices through a buffer texture.
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void HiZCuller::readBack() {
+    auto &[buffer, fence, tested] = m_readbacks[m_readback];
+    // Still not read after READBACK_FRAMES frames: this frame's counters are dropped rather than waited for.
+    if (fence)
+        return;
+    // The counters are written by the culling, with atomics.
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_COPY_READ_BUFFER, m_counterBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 2 * sizeof(GLuint));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    tested = static_cast<int>(m_instances.size());
+    m_readback = (m_readback + 1) % READBACK_FRAMES;
+}
@@ -0,0 +1,137 @@
+#ifndef HI_Z_H
+#define HI_Z_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+#include "RenderQueue.h"
+#include "Shader.h"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct HiZStats {
+    int tested = 0;
+    int early = 0; // drawn because they were visible in the previous frame
+    int late = 0; // found visible in this frame's depth pyramid
+};
+
+// Occlusion culling on the GPU against a hierarchical depth buffer, in two phases per frame:
+//  - early: the instances visible in the previous frame are drawn, without any test;
+//  - late: a max-depth pyramid is built from the depth written so far and every instance is tested against it. The
+//    visible ones that were not drawn yet are drawn, and the results are kept for the early phase of the next frame.
+// An instance that comes into view is drawn in the frame it appears, so nothing pops in. Both phases are indirect
+// draws, whose instance counts and instance lists are written by compute shaders: culling never waits for the GPU.
+//
+// Visibility is tracked per object, instances are regrouped every frame. Requires OpenGL 4.3.
+class HiZCuller {
+public:
+    // Indirect draws of a mesh in both phases.
+    struct Draws {
+        IndirectDraw early;
+        IndirectDraw late;
+    };
+
+    // The compute programs are added to the shader manager.
+    HiZCuller(ShaderManager &shaders, const std::string &shaderDir);
+
+    ~HiZCuller();
+
+    HiZCuller(const HiZCuller &) = delete;
+
+    HiZCuller &operator=(const HiZCuller &) = delete;
+
+    // Compute shaders, storage buffers and indirect draws.
+    [[nodiscard]] static bool isSupported();
+
+    // The compute programs are linked, nothing can be culled before.
+    [[nodiscard]] bool isReady() const;
+
+    // Objects were added, removed or reordered: what was known about them is dropped, and all of them are drawn in
+    // the next early phase.
+    void reset(std::size_t objectCount);
+
+    // Clears the instances of the previous frame, and reads the statistics of the frames the GPU is done with.
+    void begin(const glm::mat4 &viewProjection);
+
+    // Starts a group of instances drawn by the same meshes.
+    void beginGroup();
+
+    // The transform is the index returned by RenderQueue::addTransform.
+    void addInstance(std::uint32_t object, std::uint32_t transform, const AABB &bounds);
+
+    // Adds a draw of the visible instances of the current group, once all of them are added.
+    [[nodiscard]] Draws addDraw(GLsizei indexCount, GLuint firstIndex, GLint baseVertex);
+
+    // Runs the culling of each phase right before the opaque pass it draws in.
+    void submit(RenderQueue &queue);
+
+    // Statistics are read back a few frames late, once the GPU is done with them, not to wait for it.
+    [[nodiscard]] const HiZStats &getStats() const { return m_stats; }
+
+private:
+    enum Phase { Early = 0, Late = 1 };
+
+    // std430 layout of occlusion_cull.comp.
+    struct Instance {
+        glm::vec4 boundsMin;
+        glm::vec4 boundsMax;
+        std::uint32_t object;
+        std::uint32_t transform;
+        std::uint32_t firstCommand;
+        std::uint32_t commandCount;
+        std::uint32_t firstSlot;
+        std::uint32_t padding[3];
+    };
+
+    static_assert(sizeof(Instance) == 64, "std430 rounds the struct size up to the alignment of vec4");
+
+    // Copy of the counters of a frame, read once its fence is passed.
+    struct Readback {
+        GLuint buffer = 0;
+        GLsync fence = nullptr; // set while the copy is pending
+        int tested = 0;
+    };
+
+    static constexpr int READBACK_FRAMES = 3;
+
+    const ShaderManager &m_shaders;
+
+    GLuint m_instanceBuffer{}, m_visibilityBuffer{}, m_counterBuffer{};
+    std::array<Readback, READBACK_FRAMES> m_readbacks{};
+    int m_readback = 0; // next one written, the oldest
+    std::array<GLuint, 2> m_commandBuffers{};
+    std::array<GLuint, 2> m_indexBuffers{}, m_indexTextures{};
+
+    // Copy of the depth buffer, and its max pyramid sized to the powers of two below.
+    GLuint m_depthTexture{}, m_depthFramebuffer{}, m_pyramid{};
+    int m_width = 0, m_height = 0;
+    int m_pyramidWidth = 0, m_pyramidHeight = 0;
+    int m_levels = 0;
+
+    glm::mat4 m_viewProjection{1.0f};
+    std::vector<Instance> m_instances;
+    std::vector<DrawElementsIndirectCommand> m_commands;
+    std::size_t m_groupInstances = 0; // first instance of the current group
+    std::size_t m_groupCommands = 0;
+    std::size_t m_objectCount = 0;
+    bool m_visibilityValid = false;
+    HiZStats m_stats;
+
+    void upload();
+
+    // Copies the depth buffer and reduces it into the pyramid.
+    void buildPyramid();
+
+    void resize(int width, int height);
+
+    void cull(Phase phase);
+
+    // Copies the counters of this frame into the next readback buffer, unless it is still pending.
+    void readBack();
+};
+
+#endif
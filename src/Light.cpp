@@ -7,7 +7,11 @@
 #include "Light.h"
 #include "Shader.h"
 
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <limits>
+#include <random>
 
 Light::Light(const glm::vec3 ambient, const glm::vec3 diffuse, const glm::vec3 specular, const Type type)
     : m_ambient{ambient}, m_diffuse{diffuse}, m_specular{specular}, m_type{type} {
@@ -39,11 +43,17 @@ Light::Type Light::getType() const {
     return m_type;
 }
 
+float Light::getIntensity() const {
+    const auto brightest = glm::max(m_ambient, glm::max(m_diffuse, m_specular));
+    return glm::dot(brightest, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
 void Light::setBaseUniforms(Shader *const shader, const std::string &name) const {
     shader->setVec3(name + ".ambient", m_ambient);
     shader->setVec3(name + ".diffuse", m_diffuse);
     shader->setVec3(name + ".specular", m_specular);
     shader->setInt(name + ".type", static_cast<int>(m_type));
+    shader->setInt(name + ".shadow", m_shadow);
 }
 
 DirectionalLight::DirectionalLight(glm::vec3 direction, glm::vec3 ambient, glm::vec3 diffuse,
@@ -62,7 +72,7 @@ void DirectionalLight::setShaderUniforms(Shader *const shader, const std::string
     shader->setVec3(name + ".direction", m_direction);
 }
 
-void DirectionalLight::draw(Shader *const shader) {
+void DirectionalLight::submit(RenderQueue &queue, Shader *const shader, const GLuint vao) const {
     // no-op
 }
 
@@ -75,7 +85,7 @@ PointLight::PointLight(glm::vec3 position, glm::vec3 ambient, glm::vec3 diffuse,
 void PointLight::widgets() {
     Light::widgets();
     ImGui::SliderFloat3("Position", glm::value_ptr(m_position), -10.0f, 10.0f);
-    attenuationWidgets(m_constant, m_linear, m_quadratic);
+    attenuationWidgets(m_constant, m_linear, m_quadratic, getIntensity());
 }
 
 void PointLight::setShaderUniforms(Shader *const shader, const std::string &name) const {
@@ -87,12 +97,26 @@ void PointLight::setShaderUniforms(Shader *const shader, const std::string &name
     shader->setFloat(name + ".quadratic", m_quadratic);
 }
 
-void PointLight::draw(Shader *const shader) {
+void PointLight::submit(RenderQueue &queue, Shader *const shader, const GLuint vao) const {
     auto model = glm::translate(glm::mat4(1.0f), m_position);
     model = glm::scale(model, glm::vec3(0.2f));
-    shader->setMat4("model", model);
-    shader->setVec3("lightColor", m_diffuse);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
+    DrawPacket packet;
+    packet.pass = RenderPass::Light;
+    packet.shader = shader;
+    packet.vao = vao;
+    packet.count = 36;
+    packet.transform = queue.addTransform(model);
+    packet.color = m_diffuse;
+    queue.submit(packet);
+}
+
+float PointLight::getRange() const {
+    return attenuationRange(m_constant, m_linear, m_quadratic, getIntensity());
+}
+
+std::optional<AABB> PointLight::getBounds() const {
+    const auto range = getRange();
+    return AABB{m_position - glm::vec3(range), m_position + glm::vec3(range)};
 }
 
 SpotLight::SpotLight(glm::vec3 position, glm::vec3 direction, glm::vec3 ambient, glm::vec3 diffuse, glm::vec3 specular,
@@ -107,7 +131,7 @@ void SpotLight::widgets() {
     Light::widgets();
     ImGui::SliderFloat("Cut-off", &m_cutOff, 0.0f, 90.0f);
     ImGui::SliderFloat("Outer cut-off", &m_outerCutOff, m_cutOff, 90.0f);
-    attenuationWidgets(m_constant, m_linear, m_quadratic);
+    attenuationWidgets(m_constant, m_linear, m_quadratic, getIntensity());
 }
 
 void SpotLight::setShaderUniforms(Shader *const shader, const std::string &name) const {
@@ -124,11 +148,31 @@ void SpotLight::setShaderUniforms(Shader *const shader, const std::string &name)
     shader->setFloat(name + ".quadratic", m_quadratic);
 }
 
-void SpotLight::draw(Shader *const shader) {
+void SpotLight::submit(RenderQueue &queue, Shader *const shader, const GLuint vao) const {
+}
+
+float SpotLight::getRange() const {
+    return attenuationRange(m_constant, m_linear, m_quadratic, getIntensity());
+}
+
+std::optional<AABB> SpotLight::getBounds() const {
+    const auto range = getRange();
+    return AABB{m_position - glm::vec3(range), m_position + glm::vec3(range)};
 }
 
-void attenuationWidgets(const float c, const float l, const float q) {
+void attenuationWidgets(const float c, const float l, const float q, const float intensity) {
     ImGui::Text("Attenuation: (c, l, q) = (%.2f, %.2f, %.2f)", c, l, q);
+    ImGui::Text("Range: %.2f (intensity %.2f)", attenuationRange(c, l, q, intensity), intensity);
+}
+
+float attenuationRange(const float c, const float l, const float q, const float intensity, const float cutoff) {
+    // Positive root of q * d^2 + l * d + (c - intensity / cutoff) = 0.
+    const auto threshold = intensity / cutoff;
+    if (threshold <= c)
+        return 0.0f; // below the cutoff even at the light
+    if (q <= 0.0f)
+        return l > 0.0f ? (threshold - c) / l : std::numeric_limits<float>::max();
+    return (-l + std::sqrt(l * l - 4.0f * q * (c - threshold))) / (2.0f * q);
 }
 
 LightManager::LightManager(): m_activeLightsCount{0},
@@ -220,6 +264,16 @@ void LightManager::widgets() {
             }
         }
 
+        ImGui::SeparatorText("Scatter point lights");
+        ImGui::SliderInt("Count##Scatter", &m_scatterCount, 1, 4096);
+        ImGui::SliderFloat("Radius##Scatter", &m_scatterRadius, 1.0f, 100.0f);
+        ImGui::SameLine();
+        if (ImGui::Button("Scatter"))
+            scatterPointLights();
+        if (m_activeLightsCount + m_flashLightOn > MAX_UNIFORM_LIGHTS)
+            ImGui::TextDisabled("Forward lighting without clusters uses the first %d lights only",
+                                MAX_UNIFORM_LIGHTS);
+
         ImGui::SeparatorText("Lights");
         int removeIndex = -1;
         for (auto i = 0; i < m_lights.size(); ++i) {
@@ -249,8 +303,11 @@ void LightManager::widgets() {
                 }
             }
             ImGui::PopStyleColor(3);
+            m_lights[i].expanded = treeNode;
             if (treeNode) {
                 light->widgets();
+                if (const auto objects = m_lights[i].objectsInRange; objects >= 0)
+                    ImGui::Text("Objects in range: %d", objects);
                 ImGui::TreePop();
             }
             ImGui::PopID();
@@ -272,29 +329,64 @@ void LightManager::add(std::unique_ptr<Light> light) {
     m_activeLightsCount++;
 }
 
+void LightManager::scatterPointLights() {
+    // Small saturated lights, reaching a few units around them.
+    std::mt19937 rng(static_cast<std::mt19937::result_type>(m_lights.size()));
+    std::uniform_real_distribution<float> horizontal(-m_scatterRadius, m_scatterRadius);
+    std::uniform_real_distribution<float> height(0.0f, 3.0f);
+    std::uniform_real_distribution<float> hue(0.0f, 1.0f);
+    for (auto i = 0; i < m_scatterCount; ++i) {
+        float r, g, b;
+        ImGui::ColorConvertHSVtoRGB(hue(rng), 0.8f, 1.0f, r, g, b);
+        const auto color = glm::vec3(r, g, b);
+        add(std::make_unique<PointLight>(glm::vec3(horizontal(rng), height(rng), horizontal(rng)), glm::vec3(0.0f),
+                                         color, color, 1.0f, 0.7f, 1.8f));
+    }
+}
+
 void LightManager::update(const Camera *const camera) {
     m_flashlight.setDirection(camera->getFront());
     m_flashlight.setPosition(camera->getPosition());
 }
 
 void LightManager::setShaderUniforms(Shader *const shader) const {
-    for (int i = 0; const auto &[light, active]: m_lights) {
-        if (!active) continue; // skip inactive lights
-        const auto name = fmt::format("lights[{}]", i++);
-        light->setShaderUniforms(shader, name);
+    // Lights past the size of the array are left out, the clustered and deferred paths have no limit.
+    auto size = 0;
+    forEachActive([&](const Light &light) {
+        if (size < MAX_UNIFORM_LIGHTS)
+            light.setShaderUniforms(shader, fmt::format("lights[{}]", size++));
+    });
+    shader->setInt("lightCount", size);
+}
+
+void LightManager::forEachActive(const std::function<void(const Light &)> &function) const {
+    for (const auto &info: m_lights) {
+        if (info.active)
+            function(*info.light);
     }
-    auto size = m_activeLightsCount;
-    if (m_flashLightOn) {
-        const auto name = fmt::format("lights[{}]", size++);
-        m_flashlight.setShaderUniforms(shader, name);
+    if (m_flashLightOn)
+        function(m_flashlight);
+}
+
+void LightManager::submit(RenderQueue &queue, Shader *const shader) const {
+    for (const auto &info: m_lights) {
+        if (!info.active) continue;
+        info.light->submit(queue, shader, m_lightVao);
     }
-    shader->setInt("lightCount", size);
 }
 
-void LightManager::draw(Shader *const shader) const {
-    glBindVertexArray(m_lightVao);
-    for (const auto &[light, active]: m_lights) {
-        if (!active) continue;
-        light->draw(shader);
+void LightManager::countObjectsInRange(const std::function<int(const AABB &)> &count) {
+    for (auto &info: m_lights) {
+        if (!info.expanded)
+            continue;
+        const auto bounds = info.light->getBounds();
+        info.objectsInRange = bounds ? count(*bounds) : -1;
+    }
+}
+
+void LightManager::assignShadows(const std::function<int(const Light &)> &shadow) {
+    for (auto &info: m_lights) {
+        info.light->setShadow(info.active ? shadow(*info.light) : -1);
     }
+    m_flashlight.setShadow(m_flashLightOn ? shadow(m_flashlight) : -1);
 }
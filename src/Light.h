@@ -6,7 +6,12 @@
 #include <glm/glm.hpp>
 
 #include "Camera.h"
+#include "Culling.h"
+#include "RenderQueue.h"
 
+#include <functional>
+#include <limits>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -20,6 +25,9 @@ constexpr auto CONSTANT = 1.0f;
 constexpr auto LINEAR = 0.09f;
 constexpr auto QUADRATIC = 0.032f;
 
+// Size of the lights array of object.frag.
+constexpr int MAX_UNIFORM_LIGHTS = 30;
+
 constexpr auto CUTOFF = 12.0f; // in degrees
 constexpr auto OUTER_CUTOFF = 20.0f; // in degrees
 
@@ -35,10 +43,31 @@ public:
 
     virtual void widgets();
 
-    virtual void draw(Shader *shader) = 0;
+    // Submits the proxy geometry showing where the light is, if any.
+    virtual void submit(RenderQueue &queue, Shader *shader, GLuint vao) const = 0;
+
+    // Distance past which the light has no visible effect, infinite for lights reaching everything.
+    [[nodiscard]] virtual float getRange() const { return std::numeric_limits<float>::infinity(); }
+
+    // Region outside which the light has no visible effect, none for lights reaching everything.
+    [[nodiscard]] virtual std::optional<AABB> getBounds() const { return std::nullopt; }
+
+    // Luminance of the brightest of its colors, what the light adds at most to a white surface before attenuation.
+    [[nodiscard]] float getIntensity() const;
 
     Type getType() const;
 
+    [[nodiscard]] const glm::vec3 &getAmbient() const { return m_ambient; }
+
+    [[nodiscard]] const glm::vec3 &getDiffuse() const { return m_diffuse; }
+
+    [[nodiscard]] const glm::vec3 &getSpecular() const { return m_specular; }
+
+    // First view of the light in the shadow atlas (shadows.glsl), -1 without a shadow.
+    [[nodiscard]] int getShadow() const { return m_shadow; }
+
+    void setShadow(const int shadow) { m_shadow = shadow; }
+
 protected:
     Light(glm::vec3 ambient, glm::vec3 diffuse, glm::vec3 specular, Type type);
 
@@ -50,6 +79,7 @@ protected:
 
 private:
     Type m_type;
+    int m_shadow = -1;
 };
 
 class DirectionalLight final : public Light {
@@ -64,7 +94,7 @@ public:
 
     [[nodiscard]] const glm::vec3 &getDirection() const { return m_direction; }
 
-    void draw(Shader *shader) override;
+    void submit(RenderQueue &queue, Shader *shader, GLuint vao) const override;
 
 private:
     glm::vec3 m_direction;
@@ -88,7 +118,11 @@ public:
 
     [[nodiscard]] float getQuadratic() const { return m_quadratic; }
 
-    void draw(Shader *shader) override;
+    void submit(RenderQueue &queue, Shader *shader, GLuint vao) const override;
+
+    [[nodiscard]] float getRange() const override;
+
+    [[nodiscard]] std::optional<AABB> getBounds() const override;
 
 private:
     glm::vec3 m_position;
@@ -127,7 +161,12 @@ public:
 
     [[nodiscard]] float getQuadratic() const { return m_quadratic; }
 
-    void draw(Shader *shader) override;
+    void submit(RenderQueue &queue, Shader *shader, GLuint vao) const override;
+
+    [[nodiscard]] float getRange() const override;
+
+    // The whole sphere of the attenuation range, the cone is not taken into account.
+    [[nodiscard]] std::optional<AABB> getBounds() const override;
 
 private:
     glm::vec3 m_position;
@@ -141,7 +180,13 @@ private:
     float m_quadratic;
 };
 
-void attenuationWidgets(float c, float l, float q);
+// Below this, a light adds less than the smallest step of an 8-bit color.
+constexpr auto LUMINANCE_CUTOFF = 1.0f / 256.0f;
+
+void attenuationWidgets(float c, float l, float q, float intensity);
+
+// Distance at which intensity / (c + l * d + q * d^2) falls below the cutoff.
+float attenuationRange(float c, float l, float q, float intensity = 1.0f, float cutoff = LUMINANCE_CUTOFF);
 
 class LightManager {
 public:
@@ -157,22 +202,38 @@ public:
 
     void setShaderUniforms(Shader *shader) const;
 
-    void draw(Shader *shader) const;
+    void submit(RenderQueue &queue, Shader *shader) const;
 
     void toggleFlashLight() { m_flashLightOn = !m_flashLightOn; }
 
+    // Calls the function on every light the objects are lit by, the flashlight included when it is on.
+    void forEachActive(const std::function<void(const Light &)> &function) const;
+
+    // Counts the objects reached by the lights with bounds whose widgets are open, the only place the count is shown.
+    void countObjectsInRange(const std::function<int(const AABB &)> &count);
+
+    // Sets the shadow index of the active lights to what the function returns for them, -1 for the others.
+    void assignShadows(const std::function<int(const Light &)> &shadow);
+
 private:
     struct LightInfo {
         std::unique_ptr<Light> light;
         bool active;
+        int objectsInRange = -1; // -1 for lights without bounds
+        bool expanded = false; // tree node open in the widgets
     };
 
     std::vector<LightInfo> m_lights;
     int m_activeLightsCount;
     SpotLight m_flashlight;
     int m_selectedLight;
+    int m_scatterCount = 256;
+    float m_scatterRadius = 20.0f;
     GLuint m_lightVao{}, m_lightVbo{};
     bool m_flashLightOn;
+
+    // Adds point lights at random positions around the origin.
+    void scatterPointLights();
 };
 
 #endif
@@ -9,65 +9,271 @@
 #include "Model.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <chrono>
 #include <imgui.h>
+#include <numeric>
 #include <unordered_map>
 
 std::unordered_map<std::string, std::weak_ptr<Texture>> loadedTextures;
 
 const std::string MODEL_DIR = "assets/models/";
 const std::string TEXTURE_DIR = "assets/textures/";
+const std::string SHADER_DIR = "assets/shaders/";
 
-Mesh::Mesh(const std::vector<Vertex> &vertices,
+// Occluders are rasterized on the CPU every frame, detailed models are not
+// worth it.
+constexpr std::size_t MAX_OCCLUDER_TRIANGLES = 2000;
+constexpr float MIN_OCCLUDER_COVERAGE = 0.002f; // of the screen
+
+MeshPool::MeshPool() {
+  glGenVertexArrays(1, &m_vao);
+  glGenVertexArrays(1, &m_positionVao);
+  glGenVertexArrays(1, &m_casterVao);
+  glGenBuffers(1, &m_vertices.buffer);
+  glGenBuffers(1, &m_positions.buffer);
+  glGenBuffers(1, &m_indices.buffer);
+  glGenBuffers(1, &m_instanceBuffer);
+  m_vertices.elementSize = sizeof(Vertex);
+  m_positions.elementSize = sizeof(glm::vec3);
+  m_indices.elementSize = sizeof(unsigned int);
+  setupVao();
+}
+
+MeshPool::~MeshPool() {
+  glDeleteVertexArrays(1, &m_vao);
+  glDeleteVertexArrays(1, &m_positionVao);
+  glDeleteVertexArrays(1, &m_casterVao);
+  glDeleteBuffers(1, &m_vertices.buffer);
+  glDeleteBuffers(1, &m_positions.buffer);
+  glDeleteBuffers(1, &m_indices.buffer);
+  glDeleteBuffers(1, &m_instanceBuffer);
+}
+
+MeshPool::Range MeshPool::add(const std::vector<Vertex> &vertices,
+                              const std::vector<unsigned int> &indices) {
+  const auto vertexCapacity = m_vertices.capacity;
+  const auto positionCapacity = m_positions.capacity;
+  const auto indexCapacity = m_indices.capacity;
+  Range range;
+  range.vertexCount = static_cast<GLsizei>(vertices.size());
+  range.indexCount = static_cast<GLsizei>(indices.size());
+  range.baseVertex = static_cast<GLint>(m_vertices.allocate(vertices.size()));
+  // Same requests on the same free list: the positions land at the same offset.
+  [[maybe_unused]] const auto positionOffset =
+      m_positions.allocate(vertices.size());
+  assert(positionOffset == static_cast<std::size_t>(range.baseVertex));
+  range.firstIndex = static_cast<GLuint>(m_indices.allocate(indices.size()));
+  if (m_vertices.capacity != vertexCapacity ||
+      m_positions.capacity != positionCapacity ||
+      m_indices.capacity != indexCapacity)
+    setupVao();
+
+  // Indices stay relative to the mesh, draws give the base vertex.
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_vertices.buffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, range.baseVertex * sizeof(Vertex),
+                  vertices.size() * sizeof(Vertex), vertices.data());
+  std::vector<glm::vec3> positions;
+  positions.reserve(vertices.size());
+  for (const auto &vertex : vertices)
+    positions.push_back(vertex.position);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_positions.buffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, range.baseVertex * sizeof(glm::vec3),
+                  positions.size() * sizeof(glm::vec3), positions.data());
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_indices.buffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, range.firstIndex * sizeof(unsigned int),
+                  indices.size() * sizeof(unsigned int), indices.data());
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  return range;
+}
+
+void MeshPool::release(const Range &range) {
+  m_vertices.release(range.baseVertex, range.vertexCount);
+  m_positions.release(range.baseVertex, range.vertexCount);
+  m_indices.release(range.firstIndex, range.indexCount);
+}
+
+void MeshPool::reserveInstances(const std::size_t count) {
+  if (count <= m_instanceCapacity)
+    return;
+  m_instanceCapacity = std::bit_ceil(count);
+  std::vector<GLint> instances(m_instanceCapacity);
+  std::iota(instances.begin(), instances.end(), 0);
+  glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+  glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(GLint),
+               instances.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void MeshPool::setupVao() const {
+  glBindVertexArray(m_vao);
+
+  glBindBuffer(GL_ARRAY_BUFFER, m_vertices.buffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indices.buffer);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        static_cast<void *>(nullptr));
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<void *>(offsetof(Vertex, normal)));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<void *>(offsetof(Vertex, texCoords)));
+  glEnableVertexAttribArray(2);
+
+  // Instance i of a draw reads its base instance + i.
+  const auto setupInstances = [this] {
+    glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+    glVertexAttribIPointer(INSTANCE_ATTRIBUTE, 1, GL_INT, sizeof(GLint),
+                           static_cast<void *>(nullptr));
+    glVertexAttribDivisor(INSTANCE_ATTRIBUTE, 1);
+    glEnableVertexAttribArray(INSTANCE_ATTRIBUTE);
+  };
+  setupInstances();
+
+  const auto setupPositions = [this](const GLuint vao) {
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, m_positions.buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indices.buffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3),
+                          static_cast<void *>(nullptr));
+    glEnableVertexAttribArray(0);
+  };
+  setupPositions(m_positionVao);
+  setupInstances();
+  // Disabled, the instance attribute reads a constant.
+  setupPositions(m_casterVao);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+std::size_t MeshPool::Arena::allocate(const std::size_t count) {
+  if (count == 0)
+    return 0;
+  auto it = std::ranges::find_if(
+      free, [count](const auto &block) { return block.second >= count; });
+  if (it == free.end()) {
+    grow(count);
+    it = std::ranges::find_if(
+        free, [count](const auto &block) { return block.second >= count; });
+  }
+  const auto offset = it->first;
+  it->first += count;
+  it->second -= count;
+  if (it->second == 0)
+    free.erase(it);
+  return offset;
+}
+
+void MeshPool::Arena::release(const std::size_t offset,
+                              const std::size_t count) {
+  if (count == 0)
+    return;
+  // Blocks are kept sorted, adjacent ones are merged.
+  auto next = std::ranges::lower_bound(
+      free, offset, std::less{}, &std::pair<std::size_t, std::size_t>::first);
+  next = free.insert(next, {offset, count});
+  if (const auto after = next + 1;
+      after != free.end() && next->first + next->second == after->first) {
+    next->second += after->second;
+    free.erase(after);
+  }
+  if (next != free.begin()) {
+    if (const auto before = next - 1;
+        before->first + before->second == next->first) {
+      before->second += next->second;
+      free.erase(next);
+    }
+  }
+}
+
+void MeshPool::Arena::grow(const std::size_t count) {
+  const auto newCapacity = std::max(capacity * 2, capacity + count);
+  GLuint newBuffer;
+  glGenBuffers(1, &newBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+  glBufferData(GL_COPY_WRITE_BUFFER,
+               static_cast<GLsizeiptr>(newCapacity * elementSize), nullptr,
+               GL_STATIC_DRAW);
+  if (capacity > 0) {
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        static_cast<GLsizeiptr>(capacity * elementSize));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  glDeleteBuffers(1, &buffer);
+  buffer = newBuffer;
+
+  const auto oldCapacity = capacity;
+  capacity = newCapacity;
+  release(oldCapacity, newCapacity - oldCapacity);
+}
+
+Mesh::Mesh(MeshPool &pool, const std::vector<Vertex> &vertices,
            const std::vector<unsigned int> &indices,
            const std::vector<std::shared_ptr<Texture>> &textures)
-    : m_vertices{vertices}, m_indices{indices}, m_textures{textures} {
+    : m_pool{&pool}, m_vertices{vertices}, m_indices{indices},
+      m_textures{textures} {
   setupMesh();
 }
 
 Mesh::~Mesh() {
-  if (m_vao != 0)
-    glDeleteVertexArrays(1, &m_vao);
-  if (m_vbo != 0)
-    glDeleteBuffers(1, &m_vbo);
-  if (m_ebo != 0)
-    glDeleteBuffers(1, &m_ebo);
+  if (m_pool)
+    m_pool->release(m_range);
 }
 
 Mesh::Mesh(Mesh &&other) noexcept {
-  m_vao = other.m_vao;
-  m_vbo = other.m_vbo;
-  m_ebo = other.m_ebo;
+  m_pool = other.m_pool;
+  m_range = other.m_range;
   m_vertices = std::move(other.m_vertices);
   m_indices = std::move(other.m_indices);
   m_textures = std::move(other.m_textures);
-  other.m_vao = 0;
-  other.m_vbo = 0;
-  other.m_ebo = 0;
+  m_textureSet = std::move(other.m_textureSet);
+  m_bounds = other.m_bounds;
+  other.m_pool = nullptr;
 }
 
 Mesh &Mesh::operator=(Mesh &&other) noexcept {
   if (this != &other) {
-    m_vao = other.m_vao;
-    m_vbo = other.m_vbo;
-    m_ebo = other.m_ebo;
+    if (m_pool)
+      m_pool->release(m_range);
+    m_pool = other.m_pool;
+    m_range = other.m_range;
     m_vertices = std::move(other.m_vertices);
     m_indices = std::move(other.m_indices);
     m_textures = std::move(other.m_textures);
+    m_textureSet = std::move(other.m_textureSet);
+    m_bounds = other.m_bounds;
 
-    other.m_vao = 0;
-    other.m_vbo = 0;
-    other.m_ebo = 0;
+    other.m_pool = nullptr;
   }
   return *this;
 }
 
-void Mesh::draw(Shader *const shader) const {
+void Mesh::submit(RenderQueue &queue, DrawPacket packet) const {
+  packet.textures = &m_textureSet;
+  packet.vao = m_pool->getVao();
+  packet.depthVao = m_pool->getPositionVao();
+  packet.count = m_range.indexCount;
+  packet.firstIndex = m_range.firstIndex;
+  packet.baseVertex = m_range.baseVertex;
+  packet.indexed = true;
+  packet.mergeable = true;
+  queue.submit(packet);
+}
+
+void Mesh::setupMesh() {
+  for (const auto &vertex : m_vertices)
+    m_bounds.expand(vertex.position);
+
   auto diffuseNr = 1;
   auto specularNr = 1;
-
-  for (auto i = 0; i < m_textures.size(); ++i) {
-    auto &texture = m_textures[i];
-    texture->setUnit(i);
+  std::vector<TextureBinding> bindings;
+  for (const auto &texture : m_textures) {
     std::string name;
     int number;
     switch (texture->getType()) {
@@ -81,51 +287,23 @@ void Mesh::draw(Shader *const shader) const {
       break;
     }
     name = fmt::format("material.texture_{}{}", name, number);
-    shader->setInt(name, i);
-    texture->bind();
+    bindings.push_back({texture.get(), name});
   }
+  m_textureSet = TextureSet{std::move(bindings)};
 
-  glBindVertexArray(m_vao);
-  glDrawElements(GL_TRIANGLES, m_indices.size(), GL_UNSIGNED_INT, nullptr);
-  glBindVertexArray(0);
+  m_range = m_pool->add(m_vertices, m_indices);
 }
 
-void Mesh::setupMesh() {
-  glGenVertexArrays(1, &m_vao);
-  glGenBuffers(1, &m_vbo);
-  glGenBuffers(1, &m_ebo);
-
-  glBindVertexArray(m_vao);
-
-  glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
-  glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(Vertex),
-               m_vertices.data(), GL_STATIC_DRAW);
-
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(unsigned int),
-               m_indices.data(), GL_STATIC_DRAW);
-
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                        static_cast<void *>(nullptr));
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                        reinterpret_cast<void *>(offsetof(Vertex, normal)));
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                        reinterpret_cast<void *>(offsetof(Vertex, texCoords)));
-  glEnableVertexAttribArray(2);
-
-  glBindVertexArray(0);
+Model::Model(const std::string &path, MeshPool &pool) {
+  loadModel(path, pool);
 }
 
-Model::Model(const std::string &path) { loadModel(path); }
-
-void Model::draw(Shader *const shader) const {
+void Model::submit(RenderQueue &queue, const DrawPacket &packet) const {
   for (const auto &mesh : m_meshes)
-    mesh.draw(shader);
+    mesh.submit(queue, packet);
 }
 
-void Model::loadModel(const std::string &path) {
+void Model::loadModel(const std::string &path, MeshPool &pool) {
   Assimp::Importer importer;
   const auto scene =
       importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
@@ -139,20 +317,44 @@ void Model::loadModel(const std::string &path) {
 
   m_directory = get_directory(path);
 
-  processNode(scene->mRootNode, scene);
+  processNodes(scene, pool);
+
+  for (const auto &mesh : m_meshes) {
+    m_bounds.expand(mesh.getBounds());
+    m_triangleCount += mesh.getIndices().size() / 3;
+  }
 }
 
-void Model::processNode(const aiNode *node, const aiScene *scene) {
-  for (auto i = 0; i < node->mNumMeshes; ++i) {
-    const auto mesh = scene->mMeshes[node->mMeshes[i]];
-    m_meshes.push_back(processMesh(mesh, scene));
+void Model::processNodes(const aiScene *scene, MeshPool &pool) {
+  // Breadth-first: every node is added after its parent, with the index of
+  // the parent.
+  std::vector<std::pair<const aiNode *, std::uint32_t>> nodes{
+      {scene->mRootNode, SceneGraph::NO_PARENT}};
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    const auto [node, parent] = nodes[i];
+    // Assimp matrices are row-major.
+    const auto local =
+        glm::transpose(glm::make_mat4(&node->mTransformation.a1));
+    const auto index = m_nodes.add(
+        local, glm::transpose(glm::inverse(glm::mat3(local))), parent);
+    for (auto j = 0; j < node->mNumChildren; ++j)
+      nodes.emplace_back(node->mChildren[j], index);
   }
-  for (auto i = 0; i < node->mNumChildren; ++i) {
-    processNode(node->mChildren[i], scene);
+  m_nodes.update();
+
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    const auto node = nodes[i].first;
+    for (auto j = 0; j < node->mNumMeshes; ++j) {
+      const auto mesh = scene->mMeshes[node->mMeshes[j]];
+      m_meshes.push_back(processMesh(mesh, scene, pool, m_nodes.getWorld(i),
+                                     m_nodes.getWorldNormal(i)));
+    }
   }
 }
 
-Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) const {
+Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene, MeshPool &pool,
+                        const glm::mat4 &transform,
+                        const glm::mat3 &normalMatrix) const {
   std::vector<Vertex> vertices;
   std::vector<unsigned int> indices;
   std::vector<std::shared_ptr<Texture>> textures;
@@ -166,13 +368,13 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) const {
     vec.x = mesh->mVertices[i].x;
     vec.y = mesh->mVertices[i].y;
     vec.z = mesh->mVertices[i].z;
-    vertex.position = vec;
+    vertex.position = glm::vec3(transform * glm::vec4(vec, 1.0f));
 
     // Normals.
     vec.x = mesh->mNormals[i].x;
     vec.y = mesh->mNormals[i].y;
     vec.z = mesh->mNormals[i].z;
-    vertex.normal = vec;
+    vertex.normal = glm::normalize(normalMatrix * vec);
 
     // Texture coordinates (we only support one set of texture coordinates).
     if (mesh->mTextureCoords[0]) {
@@ -200,7 +402,7 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) const {
   auto specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR);
   textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
 
-  return Mesh{vertices, indices, textures};
+  return Mesh{pool, vertices, indices, textures};
 }
 
 std::vector<std::shared_ptr<Texture>>
@@ -226,22 +428,11 @@ Model::loadMaterialTextures(const aiMaterial *const mat,
   return textures;
 }
 
-std::pair<glm::mat4, glm::mat3> ModelMatrix::compute() const {
-  auto model = glm::mat4(1.0f);
-  model = glm::translate(model, translation);
-  model = glm::scale(model, glm::vec3(scale));
-  model =
-      glm::rotate(model, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-  model =
-      glm::rotate(model, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-  model =
-      glm::rotate(model, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-  auto normalMatrix = glm::mat3(glm::transpose(glm::inverse(model)));
-  return {model, normalMatrix};
-}
-
-ModelManager::ModelManager()
-    : m_emission{TEXTURE_DIR + "emission.jpg", Texture::Type::Diffuse} {
+ModelManager::ModelManager(ThreadPool &threadPool, ShaderManager &shaders)
+    : m_occlusion{threadPool},
+      m_emission{TEXTURE_DIR + "emission.jpg", Texture::Type::Diffuse} {
+  if (HiZCuller::isSupported())
+    m_hiZ = std::make_unique<HiZCuller>(shaders, SHADER_DIR);
   loadObject(MODEL_DIR + "cube/cube.obj"); // default cube
 }
 
@@ -253,15 +444,56 @@ void ModelManager::widgets() {
         loadObject(*path);
     }
 
-    ImGui::SeparatorText("Outline");
-    ImGui::ColorEdit3("Color", glm::value_ptr(mOutlineColor));
-    ImGui::SliderInt("Thickness", &mOutlinePct, 1, 6);
+    ImGui::SeparatorText("Culling");
+    constexpr std::array cullingModes = {"Off", "Linear (SIMD)", "BVH"};
+    auto cullingMode = static_cast<int>(m_cullingMode);
+    if (ImGui::Combo("Frustum culling", &cullingMode, cullingModes.data(),
+                     cullingModes.size()))
+      m_cullingMode = static_cast<CullingMode>(cullingMode);
+    const auto [nodes, cost, rebuilds, rebuilding] = m_bvh.getStats();
+    ImGui::Text("BVH: %zu nodes, cost %.2f, %d rebuilds%s", nodes, cost,
+                rebuilds, rebuilding ? " (rebuilding...)" : "");
+    for (const auto count : {10'000, 100'000, 1'000'000}) {
+      if (count != 10'000)
+        ImGui::SameLine();
+      if (ImGui::Button(fmt::format("Benchmark {}k", count / 1000).c_str()))
+        m_benchmarks.push_back(benchmarkBVH(count));
+    }
+    for (const auto &[objects, build, refit, frustumQuery, rayQuery] :
+         m_benchmarks) {
+      ImGui::Text("%zu objects: build %.2f ms, refit 1%% %.3f ms, frustum "
+                  "%.3f ms, ray %.4f ms",
+                  objects, build, refit, frustumQuery, rayQuery);
+    }
+    constexpr std::array occlusionModes = {"Off", "CPU rasterizer",
+                                           "GPU depth pyramid"};
+    auto occlusionMode = static_cast<int>(m_occlusionMode);
+    if (ImGui::Combo("Occlusion culling", &occlusionMode,
+                     occlusionModes.data(), occlusionModes.size()))
+      m_occlusionMode = static_cast<OcclusionMode>(occlusionMode);
+    if (m_occlusionMode == OcclusionMode::CPU)
+      ImGui::SliderInt("Max occluders", &m_maxOccluders, 1, 256);
+    if (m_occlusionMode == OcclusionMode::GPU && !m_hiZ)
+      ImGui::TextDisabled("Requires OpenGL 4.3");
+    else if (m_occlusionMode == OcclusionMode::GPU && !m_hiZ->isReady())
+      ImGui::TextDisabled("Compiling...");
+
+    ImGui::SeparatorText("Copies");
+    ImGui::SliderInt("Count", &m_copyCount, 1, 10000);
+    if (ImGui::Button("Copy the last object") && !m_entities.empty())
+      addCopies(m_entities.size() - 1, m_copyCount);
 
     ImGui::SeparatorText("Objets");
-    int removeIndex = -1;
-
-    for (auto i = 0; i < m_objects.size(); ++i) {
-      ImGui::PushID(fmt::format("model_{}", i).c_str());
+    std::optional<Entity> removed;
+
+    const auto entities = m_entities.getEntities();
+    const auto visible = m_entities.getVisible();
+    const auto outlined = m_entities.getOutlined();
+    for (auto i = 0; i < entities.size(); ++i) {
+      // Indices change when objects are removed, handles keep the tree state.
+      ImGui::PushID(fmt::format("model_{}_{}", entities[i].slot,
+                                entities[i].generation)
+                        .c_str());
       const auto treeNode =
           ImGui::TreeNode(fmt::format("Object #{}", i).c_str());
       ImGui::PushStyleColor(ImGuiCol_Button, static_cast<ImVec4>(ImColor::HSV(
@@ -274,7 +506,7 @@ void ModelManager::widgets() {
           static_cast<ImVec4>(ImColor::HSV(0 / 7.0f, 0.8f, 0.8f)));
       ImGui::SameLine();
       if (ImGui::Button("Remove")) {
-        removeIndex = i;
+        removed = entities[i];
       }
       ImGui::PopStyleColor(3);
       ImGui::PushStyleColor(ImGuiCol_Button, static_cast<ImVec4>(ImColor::HSV(
@@ -286,78 +518,402 @@ void ModelManager::widgets() {
           ImGuiCol_ButtonActive,
           static_cast<ImVec4>(ImColor::HSV(1 / 7.0f, 0.8f, 0.8f)));
       ImGui::SameLine();
-      if (ImGui::Button("Hide")) {
-        auto &active = m_objects[i].active;
-        active = !active;
-      }
+      if (ImGui::Button("Hide"))
+        m_entities.setVisible(i, !visible[i]);
       ImGui::PopStyleColor(3);
       if (treeNode) {
-        auto &[translation, rotation, scale] = m_objects[i].model;
+        auto model = m_entities.getPlacement(i);
+        auto &[translation, rotation, scale] = model;
         ImGui::SliderFloat3("Position", glm::value_ptr(translation), -10.0f,
                             10.0f);
         ImGui::SliderFloat3("Rotation", glm::value_ptr(rotation), -180.0f,
                             180.0f);
         ImGui::SliderFloat("Scale", &scale, 0.0f, 10.0f);
-        ImGui::Checkbox("Outline", &m_objects[i].outline);
+        m_entities.setPlacement(i, model);
+        // Only objects created earlier can be parents, -1 for none.
+        const auto parent = m_entities.getParent(i);
+        auto parentIndex = m_entities.isAlive(parent)
+                               ? static_cast<int>(m_entities.getIndex(parent))
+                               : -1;
+        if (ImGui::InputInt("Parent", &parentIndex)) {
+          if (parentIndex < 0)
+            m_entities.setParent(i, {});
+          else if (parentIndex < entities.size() &&
+                   m_entities.canParent(parentIndex, i))
+            m_entities.setParent(i, entities[parentIndex]);
+        }
+        auto outline = outlined[i] != 0;
+        if (ImGui::Checkbox("Outline", &outline))
+          m_entities.setOutlined(i, outline);
         ImGui::TreePop();
       }
       ImGui::PopID();
     }
 
-    if (removeIndex != -1) {
-      m_objects.erase(m_objects.begin() + removeIndex);
+    // Children are removed with their parent.
+    if (removed) {
+      m_entities.destroy(*removed);
+      m_bvhDirty = true;
     }
   }
 }
 
-void ModelManager::draw(Shader *const shader) const {
-  glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-  glStencilFunc(GL_ALWAYS, 1, 0xFF);
-  glStencilMask(0xFF);
+void ModelManager::setShaderUniforms(Shader *const shader) const {
+  // Meshes bind their own textures from unit 0, the emission map stays on
+  // unit 2.
   m_emission.setUnit(2);
   shader->setInt("material.emission", 2);
-  for (const auto &[object, model, active, outline] : m_objects) {
-    if (!active)
+}
+
+void ModelManager::submit(RenderQueue &queue, Shader *const shader,
+                          const Frustum &frustum,
+                          ClusteredLights *const lights) {
+  using Clock = std::chrono::steady_clock;
+  const auto cull = [&](CullStats &stats) {
+    const auto start = Clock::now();
+    frustum.intersects(m_bounds, m_visible);
+    stats.milliseconds +=
+        std::chrono::duration<double, std::milli>(Clock::now() - start)
+            .count();
+    stats.tested += static_cast<int>(m_visible.size());
+  };
+  m_objectCulling = {};
+  m_meshCulling = {};
+  const auto models = m_entities.getModels();
+  const auto active = m_entities.getVisible();
+  const auto outlined = m_entities.getOutlined();
+  const auto worlds = m_entities.getWorlds();
+  const auto normals = m_entities.getNormals();
+
+  m_drawOrder.clear();
+  m_outlined = 0;
+  switch (m_cullingMode) {
+  case CullingMode::None:
+    for (auto i = 0; i < active.size(); ++i) {
+      if (active[i])
+        m_drawOrder.push_back(i);
+    }
+    m_objectCulling.tested = static_cast<int>(m_drawOrder.size());
+    break;
+  case CullingMode::Linear:
+    // World bounds of the active objects, tested against the frustum in a
+    // single batch.
+    m_candidates.clear();
+    m_bounds.clear();
+    for (auto i = 0; i < active.size(); ++i) {
+      if (!active[i])
+        continue;
+      m_candidates.push_back(i);
+      m_bounds.push_back(m_bvh.getBounds(i));
+    }
+    cull(m_objectCulling);
+    for (auto i = 0; i < m_candidates.size(); ++i) {
+      if (m_visible[i])
+        m_drawOrder.push_back(m_candidates[i]);
+    }
+    break;
+  case CullingMode::BVH: {
+    const auto start = Clock::now();
+    m_bvh.query(frustum, m_bvhHits);
+    for (const auto i : m_bvhHits) {
+      if (active[i])
+        m_drawOrder.push_back(static_cast<int>(i));
+    }
+    m_objectCulling.milliseconds =
+        std::chrono::duration<double, std::milli>(Clock::now() - start)
+            .count();
+    m_objectCulling.tested =
+        static_cast<int>(std::ranges::count(active, std::uint8_t{1}));
+    break;
+  }
+  }
+  m_objectCulling.visible = static_cast<int>(m_drawOrder.size());
+
+  m_occlusionStats = {};
+  if (m_occlusionMode == OcclusionMode::CPU)
+    occlusionCull(frustum.getViewProjection());
+
+  // The pyramid keeps the farthest depth of each region, which only bounds
+  // what is hidden with the usual depth test.
+  GLint depthFn;
+  glGetIntegerv(GL_DEPTH_FUNC, &depthFn);
+  const auto gpuOcclusion = m_occlusionMode == OcclusionMode::GPU && m_hiZ &&
+                            m_hiZ->isReady() && glIsEnabled(GL_DEPTH_TEST) &&
+                            depthFn == GL_LESS;
+  if (gpuOcclusion)
+    m_hiZ->begin(frustum.getViewProjection());
+
+  // Objects sharing a model are drawn as instances: one packet per mesh for
+  // all of them, and one more for the outlined ones, writing the outline mask.
+  std::ranges::sort(m_drawOrder, std::less{},
+                    [&](const auto i) { return models[i].get(); });
+
+  for (auto begin = m_drawOrder.begin(); begin != m_drawOrder.end();) {
+    const auto &object = models[*begin];
+    const auto end = std::find_if(begin, m_drawOrder.end(), [&](const auto i) {
+      return models[i] != object;
+    });
+
+    DrawPacket packet;
+    packet.shader = shader;
+    packet.pass = RenderPass::Opaque;
+    if (const auto &meshes = object->getMeshes(); gpuOcclusion) {
+      // Every mesh gets a draw in each opaque pass, their instances are picked
+      // on the GPU.
+      m_hiZ->beginGroup();
+      for (auto it = begin; it != end; ++it) {
+        const auto transform = queue.addTransform(worlds[*it], normals[*it]);
+        if (it == begin)
+          packet.transform = transform;
+        m_hiZ->addInstance(*it, transform, m_bvh.getBounds(*it));
+        if (lights)
+          lights->addObject(transform, m_bvh.getBounds(*it));
+      }
+      for (const auto &mesh : meshes) {
+        const auto &[baseVertex, vertexCount, firstIndex, indexCount] =
+            mesh.getRange();
+        const auto [early, late] =
+            m_hiZ->addDraw(indexCount, firstIndex, baseVertex);
+        packet.pass = RenderPass::Opaque;
+        packet.indirect = early;
+        mesh.submit(queue, packet);
+        packet.pass = RenderPass::OpaqueLate;
+        packet.indirect = late;
+        mesh.submit(queue, packet);
+      }
+      packet.indirect = {};
+    } else if (meshes.size() == 1 || m_cullingMode == CullingMode::None) {
+      packet.instances = static_cast<GLsizei>(end - begin);
+      for (auto it = begin; it != end; ++it) {
+        const auto transform = queue.addTransform(worlds[*it], normals[*it]);
+        if (it == begin)
+          packet.transform = transform;
+        if (lights)
+          lights->addObject(transform, m_bvh.getBounds(*it));
+      }
+      object->submit(queue, packet);
+    } else {
+      // Each mesh of a visible object can still be out of the frustum, meshes
+      // get their own list of instances.
+      for (const auto &mesh : meshes) {
+        m_bounds.clear();
+        for (auto it = begin; it != end; ++it)
+          m_bounds.push_back(mesh.getBounds().transform(worlds[*it]));
+        cull(m_meshCulling);
+        packet.instances = 0;
+        for (auto it = begin; it != end; ++it) {
+          if (!m_visible[it - begin])
+            continue;
+          const auto transform = queue.addTransform(worlds[*it], normals[*it]);
+          if (packet.instances++ == 0)
+            packet.transform = transform;
+          if (lights)
+            lights->addObject(transform,
+                              mesh.getBounds().transform(worlds[*it]));
+        }
+        m_meshCulling.visible += packet.instances;
+        if (packet.instances > 0)
+          mesh.submit(queue, packet);
+      }
+    }
+
+    packet.pass = RenderPass::Outline;
+    packet.instances = 0;
+    for (auto it = begin; it != end; ++it) {
+      if (!outlined[*it])
+        continue;
+      const auto transform = queue.addTransform(worlds[*it]);
+      if (packet.instances++ == 0)
+        packet.transform = transform;
+    }
+    m_outlined += packet.instances;
+    if (packet.instances > 0)
+      object->submit(queue, packet);
+
+    begin = end;
+  }
+
+  // Multi-draws index transforms through the pool's instance attribute.
+  m_meshPool.reserveInstances(queue.getTransformCount());
+
+  m_hiZStats = {};
+  if (gpuOcclusion) {
+    m_hiZ->submit(queue);
+    m_hiZStats = m_hiZ->getStats();
+  }
+}
+
+void ModelManager::submitShadowCasters(ShadowCascades &shadows) {
+  const auto models = m_entities.getModels();
+  const auto active = m_entities.getVisible();
+  const auto worlds = m_entities.getWorlds();
+  for (auto cascade = 0; cascade < ShadowCascades::CASCADES; ++cascade) {
+    if (!shadows.isDue(cascade))
       continue;
+    m_bvh.query(shadows.getCasterFrustum(cascade), m_bvhHits);
+    for (const auto i : m_bvhHits) {
+      if (!active[i])
+        continue;
+      for (const auto &mesh : models[i]->getMeshes()) {
+        const auto &[baseVertex, vertexCount, firstIndex, indexCount] =
+            mesh.getRange();
+        shadows.addCaster(cascade, m_meshPool.getCasterVao(), indexCount,
+                          firstIndex, baseVertex, worlds[i],
+                          m_bvh.getBounds(i));
+      }
+    }
+  }
+}
+
+void ModelManager::submitShadowCasters(ShadowAtlas &atlas) {
+  const auto models = m_entities.getModels();
+  const auto active = m_entities.getVisible();
+  const auto worlds = m_entities.getWorlds();
+  for (std::size_t light = 0; light < atlas.getLightCount(); ++light) {
+    m_bvh.query(atlas.getLightBounds(light), m_bvhHits);
+    for (const auto i : m_bvhHits) {
+      if (!active[i])
+        continue;
+      for (const auto &mesh : models[i]->getMeshes()) {
+        const auto &[baseVertex, vertexCount, firstIndex, indexCount] =
+            mesh.getRange();
+        atlas.addCaster(light, m_meshPool.getCasterVao(), indexCount,
+                        firstIndex, baseVertex, worlds[i],
+                        m_bvh.getBounds(i));
+      }
+    }
+  }
+}
+
+std::optional<Entity> ModelManager::pick(const glm::vec3 &origin,
+                                         const glm::vec3 &direction) {
+  if (m_bvhDirty || m_bvh.size() != m_entities.size())
+    return std::nullopt;
+  const auto active = m_entities.getVisible();
+  const auto hit = m_bvh.raycast(origin, direction,
+                                 [&](const auto i) { return active[i] != 0; });
+  if (!hit)
+    return std::nullopt;
+  const auto i = hit->primitive;
+  m_entities.setOutlined(i, !m_entities.getOutlined()[i]);
+  return m_entities.getEntities()[i];
+}
 
-    auto [modelMatrix, normalMatrix] = model.compute();
-    shader->setMat4("model", modelMatrix);
-    shader->setMat3("normalMatrix", normalMatrix);
-    object->draw(shader);
-
-    if (outline) {
-      // draw outline
-      glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-      glStencilMask(0x00);
-      glDisable(GL_DEPTH_TEST);
-      // shader single color?
-      shader->setBool("outline", true);
-      shader->setVec3("outlineColor", mOutlineColor);
-      // scale model matrix
-      modelMatrix =
-          glm::scale(modelMatrix, glm::vec3(1.0f + mOutlinePct / 100.0f));
-      shader->setMat4("model", modelMatrix);
-      object->draw(shader);
-      glStencilMask(0xFF);
-      glStencilFunc(GL_ALWAYS, 1, 0xFF);
-      glEnable(GL_DEPTH_TEST);
+int ModelManager::countObjectsOverlapping(const AABB &box) {
+  if (m_bvhDirty || m_bvh.size() != m_entities.size())
+    return 0;
+  m_bvh.query(box, m_bvhHits);
+  const auto active = m_entities.getVisible();
+  return static_cast<int>(std::ranges::count_if(
+      m_bvhHits, [&](const auto i) { return active[i] != 0; }));
+}
+
+void ModelManager::update() {
+  // Objects were added or removed: indices changed, the tree is rebuilt.
+  // Otherwise only the objects that moved, or whose parent moved, are refit:
+  // static frames compute nothing.
+  const auto moved = m_entities.update();
+  const auto models = m_entities.getModels();
+  const auto worlds = m_entities.getWorlds();
+  if (!m_bvhDirty && m_bvh.size() == m_entities.size()) {
+    for (const auto i : moved) {
+      const auto box = models[i]->getBounds().transform(worlds[i]);
+      if (box != m_bvh.getBounds(i))
+        m_bvh.refit(i, box);
     }
-    shader->setBool("outline", false);
+    m_bvh.update();
+    return;
+  }
+  std::vector<AABB> bounds;
+  for (auto i = 0; i < models.size(); ++i)
+    bounds.push_back(models[i]->getBounds().transform(worlds[i]));
+  m_bvh.build(std::move(bounds));
+  m_bvhDirty = false;
+  if (m_hiZ)
+    m_hiZ->reset(m_entities.size());
+}
+
+void ModelManager::occlusionCull(const glm::mat4 &viewProjection) {
+  using Clock = std::chrono::steady_clock;
+  const auto elapsed = [](const Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+  };
+  auto start = Clock::now();
+  m_occlusion.begin(viewProjection);
+  const auto models = m_entities.getModels();
+  const auto worlds = m_entities.getWorlds();
+
+  // Occluders are the visible objects covering the most screen, among the
+  // ones cheap enough to rasterize.
+  m_occluders.clear();
+  for (const auto i : m_drawOrder) {
+    if (models[i]->getTriangleCount() > MAX_OCCLUDER_TRIANGLES)
+      continue;
+    if (const auto coverage = m_occlusion.getScreenCoverage(m_bvh.getBounds(i));
+        coverage >= MIN_OCCLUDER_COVERAGE)
+      m_occluders.emplace_back(coverage, i);
+  }
+  const auto occluders = std::min(m_occluders.size(),
+                                  static_cast<std::size_t>(m_maxOccluders));
+  std::ranges::partial_sort(m_occluders, m_occluders.begin() + occluders,
+                            std::greater{});
+  for (std::size_t k = 0; k < occluders; ++k) {
+    const auto i = m_occluders[k].second;
+    for (const auto &mesh : models[i]->getMeshes()) {
+      const auto &vertices = mesh.getVertices();
+      m_occlusion.addOccluder(worlds[i], &vertices.front().position,
+                              sizeof(Vertex), vertices.size(),
+                              mesh.getIndices());
+    }
+  }
+  m_occlusion.rasterize();
+  m_occlusionStats.occluders = static_cast<int>(occluders);
+  m_occlusionStats.triangles = m_occlusion.getTriangleCount();
+  m_occlusionStats.rasterMilliseconds = elapsed(start);
+
+  start = Clock::now();
+  m_occlusionStats.tested = static_cast<int>(m_drawOrder.size());
+  std::erase_if(m_drawOrder, [this](const auto i) {
+    return !m_occlusion.isVisible(m_bvh.getBounds(i));
+  });
+  m_occlusionStats.occluded =
+      m_occlusionStats.tested - static_cast<int>(m_drawOrder.size());
+  m_occlusionStats.testMilliseconds = elapsed(start);
+}
+
+void ModelManager::addCopies(const std::size_t source, const int count) {
+  // Laid out on a square grid in the xz plane, centered on the source.
+  const auto side = static_cast<int>(std::ceil(std::sqrt(count)));
+  constexpr auto spacing = 2.0f;
+  const auto object = m_entities.getModels()[source];
+  const auto model = m_entities.getPlacement(source);
+  const auto parent = m_entities.getParent(source);
+  for (auto i = 0; i < count; ++i) {
+    auto placement = model;
+    placement.translation +=
+        glm::vec3(static_cast<float>(i % side - side / 2), 0.0f,
+                  static_cast<float>(i / side - side / 2)) *
+        spacing;
+    m_entities.create(object, placement, parent);
   }
+  m_bvhDirty = true;
 }
 
 void ModelManager::loadObject(const std::string &path) {
   if (const auto it = m_loadedModels.find(path); it != m_loadedModels.end()) {
     if (auto object = it->second.lock()) {
       std::cout << "Loading model '" << path << "' from cache...\n";
-      m_objects.push_back({std::move(object), ModelMatrix{}, true});
+      m_entities.create(std::move(object), ModelMatrix{});
+      m_bvhDirty = true;
       return;
     }
     std::cout << "Model was previously unloaded, reloading from disk...\n";
   }
   // The model was unloaded or not found in the cache, so we load it from disk.
   std::cout << "Loading model '" << path << "'...\n";
-  auto object = std::make_shared<Model>(path);
+  auto object = std::make_shared<Model>(path, m_meshPool);
   m_loadedModels[path] = std::weak_ptr{object};
-  m_objects.push_back({std::move(object), ModelMatrix{}, true});
+  m_entities.create(std::move(object), ModelMatrix{});
+  m_bvhDirty = true;
 }
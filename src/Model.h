@@ -5,9 +5,20 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "BVH.h"
+#include "Clusters.h"
+#include "Culling.h"
+#include "Entities.h"
+#include "HiZ.h"
+#include "Occlusion.h"
+#include "RenderQueue.h"
 #include "Shader.h"
+#include "Shadows.h"
 #include "Texture.h"
+#include "Transform.h"
 
+#include <memory>
+#include <optional>
 #include <unordered_map>
 #include <vector>
 
@@ -17,9 +28,82 @@ struct Vertex {
   glm::vec2 texCoords;
 };
 
+// Vertices and indices of every mesh, in two shared buffers drawn through a
+// single VAO, so that draws of different meshes can be merged into one
+// multi-draw. The VAO also feeds INSTANCE_ATTRIBUTE.
+//
+// Positions are also stored on their own, tightly packed at the same offsets,
+// for the passes that only need the depth: a second VAO reads them with the
+// same indices and instance attribute. A third one reads them without the
+// instance attribute, for draws that are never merged and may have more
+// instances than were reserved.
+class MeshPool {
+public:
+  // Where a mesh is stored, in vertices and indices.
+  struct Range {
+    GLint baseVertex = 0;
+    GLsizei vertexCount = 0;
+    GLuint firstIndex = 0;
+    GLsizei indexCount = 0;
+  };
+
+  MeshPool();
+
+  ~MeshPool();
+
+  MeshPool(const MeshPool &) = delete;
+
+  MeshPool &operator=(const MeshPool &) = delete;
+
+  // Buffers grow as needed, their content is copied on the GPU.
+  Range add(const std::vector<Vertex> &vertices,
+            const std::vector<unsigned int> &indices);
+
+  // The space is reused by the next meshes added.
+  void release(const Range &range);
+
+  // Makes INSTANCE_ATTRIBUTE cover instances [0, count).
+  void reserveInstances(std::size_t count);
+
+  [[nodiscard]] GLuint getVao() const { return m_vao; }
+
+  // Positions only, at location 0, with the indices of getVao().
+  [[nodiscard]] GLuint getPositionVao() const { return m_positionVao; }
+
+  // Positions only, without INSTANCE_ATTRIBUTE: draws go through
+  // baseInstance. Shadow casters are drawn with it.
+  [[nodiscard]] GLuint getCasterVao() const { return m_casterVao; }
+
+private:
+  // Buffer split in blocks of elements, with a first-fit free list.
+  struct Arena {
+    GLuint buffer = 0;
+    std::size_t elementSize = 0;
+    std::size_t capacity = 0; // in elements
+    std::vector<std::pair<std::size_t, std::size_t>> free; // offset, size
+
+    std::size_t allocate(std::size_t count);
+
+    void release(std::size_t offset, std::size_t count);
+
+    void grow(std::size_t count);
+  };
+
+  GLuint m_vao{}, m_positionVao{}, m_casterVao{};
+  Arena m_vertices;
+  Arena m_positions; // allocated along with m_vertices, at the same offsets
+  Arena m_indices;
+  GLuint m_instanceBuffer{};
+  std::size_t m_instanceCapacity = 0;
+
+  // Buffers are replaced when they grow, the VAOs have to point to the new
+  // ones.
+  void setupVao() const;
+};
+
 class Mesh {
 public:
-  Mesh(const std::vector<Vertex> &vertices,
+  Mesh(MeshPool &pool, const std::vector<Vertex> &vertices,
        const std::vector<unsigned int> &indices,
        const std::vector<std::shared_ptr<Texture>> &textures);
 
@@ -34,69 +118,166 @@ public:
 
   Mesh &operator=(Mesh &&other) noexcept;
 
-  void draw(Shader *shader) const;
+  // Fills in the geometry and textures of the packet and submits it.
+  void submit(RenderQueue &queue, DrawPacket packet) const;
+
+  // In model space.
+  [[nodiscard]] const AABB &getBounds() const { return m_bounds; }
+
+  [[nodiscard]] const std::vector<Vertex> &getVertices() const {
+    return m_vertices;
+  }
+
+  [[nodiscard]] const std::vector<unsigned int> &getIndices() const {
+    return m_indices;
+  }
+
+  [[nodiscard]] const MeshPool::Range &getRange() const { return m_range; }
 
 private:
-  GLuint m_vao{}, m_vbo{}, m_ebo{};
+  MeshPool *m_pool = nullptr;
+  MeshPool::Range m_range;
+  AABB m_bounds;
   std::vector<Vertex> m_vertices;
   std::vector<unsigned int> m_indices;
   std::vector<std::shared_ptr<Texture>> m_textures;
+  TextureSet m_textureSet;
 
   void setupMesh();
 };
 
 class Model {
 public:
-  explicit Model(const std::string &path);
+  Model(const std::string &path, MeshPool &pool);
+
+  // Submits one packet per mesh, based on the given one.
+  void submit(RenderQueue &queue, const DrawPacket &packet) const;
+
+  [[nodiscard]] const std::vector<Mesh> &getMeshes() const { return m_meshes; }
+
+  // Union of the mesh bounds, in model space.
+  [[nodiscard]] const AABB &getBounds() const { return m_bounds; }
 
-  void draw(Shader *shader) const;
+  [[nodiscard]] std::size_t getTriangleCount() const {
+    return m_triangleCount;
+  }
+
+  // Nodes of the file, breadth-first. Their transforms are already applied to
+  // the vertices of their meshes.
+  [[nodiscard]] const SceneGraph &getNodes() const { return m_nodes; }
 
 private:
   std::vector<Mesh> m_meshes;
+  SceneGraph m_nodes;
+  AABB m_bounds;
+  std::size_t m_triangleCount = 0;
   std::string m_directory;
 
-  void loadModel(const std::string &path);
+  void loadModel(const std::string &path, MeshPool &pool);
 
-  void processNode(const aiNode *node, const aiScene *scene);
+  // Builds the scene graph from the node tree, then the meshes of every node,
+  // placed by the world transform of their node.
+  void processNodes(const aiScene *scene, MeshPool &pool);
 
-  Mesh processMesh(aiMesh *mesh, const aiScene *scene) const;
+  Mesh processMesh(aiMesh *mesh, const aiScene *scene, MeshPool &pool,
+                   const glm::mat4 &transform,
+                   const glm::mat3 &normalMatrix) const;
 
   std::vector<std::shared_ptr<Texture>>
   loadMaterialTextures(const aiMaterial *mat, aiTextureType type) const;
 };
 
-struct ModelMatrix {
-  glm::vec3 translation = glm::vec3(0.0f);
-  glm::vec3 rotation = glm::vec3(0.0f); // in degrees
-  float scale = 1.0f;
-
-  [[nodiscard]] std::pair<glm::mat4, glm::mat3> compute() const;
-};
-
 class ModelManager {
 public:
-  ModelManager();
+  enum class CullingMode { None, Linear, BVH };
+  enum class OcclusionMode { None, CPU, GPU };
+
+  // Programs of GPU occlusion culling are added to the shader manager.
+  ModelManager(ThreadPool &threadPool, ShaderManager &shaders);
 
   void widgets();
 
-  void draw(Shader *shader) const;
+  void setShaderUniforms(Shader *shader) const;
 
-private:
-  struct ObjectData {
-    std::shared_ptr<Model> object;
-    ModelMatrix model;
-    bool active;
-    bool outline;
-  };
+  // Only objects, and meshes of multi-mesh models, intersecting the frustum
+  // are submitted. With GPU occlusion culling, objects are drawn indirectly in
+  // the two opaque passes, and meshes are not culled on their own. Given
+  // lights, every instance requests its list of lights.
+  void submit(RenderQueue &queue, Shader *shader, const Frustum &frustum,
+              ClusteredLights *lights = nullptr);
+
+  // Computes the world transform and bounds of the objects that moved, along
+  // with their descendants, and refits or rebuilds the BVH. To be called once
+  // per frame, before the submits.
+  void update();
+
+  // Adds the active objects reaching each due cascade as shadow casters.
+  void submitShadowCasters(ShadowCascades &shadows);
+
+  // Adds the active objects in range of each light of the atlas as shadow
+  // casters.
+  void submitShadowCasters(ShadowAtlas &atlas);
+
+  // Instances submitted to the outline pass by the last submit.
+  [[nodiscard]] int getOutlinedCount() const { return m_outlined; }
+
+  // Toggles the outline of the closest active object whose bounds are hit by
+  // the ray, and returns it.
+  std::optional<Entity> pick(const glm::vec3 &origin,
+                             const glm::vec3 &direction);
 
-  std::vector<ObjectData> m_objects;
+  // Active objects whose world bounds overlap the box.
+  [[nodiscard]] int countObjectsOverlapping(const AABB &box);
+
+  [[nodiscard]] const CullStats &getObjectCullStats() const {
+    return m_objectCulling;
+  }
+  [[nodiscard]] const CullStats &getMeshCullStats() const {
+    return m_meshCulling;
+  }
+  [[nodiscard]] const OcclusionStats &getOcclusionStats() const {
+    return m_occlusionStats;
+  }
+  [[nodiscard]] const HiZStats &getHiZStats() const { return m_hiZStats; }
+  [[nodiscard]] const TransformStats &getTransformStats() const {
+    return m_entities.getTransformStats();
+  }
+
+private:
+  MeshPool m_meshPool; // outlives the objects, whose meshes it stores
+  EntityStorage m_entities;
+  std::vector<int> m_drawOrder; // visible objects, grouped by model
+  // Per-frame culling data, kept to reuse their storage.
+  std::vector<int> m_candidates;
+  AABBList m_bounds;
+  std::vector<std::uint8_t> m_visible;
+  // World bounds of every object, by dense index of m_entities.
+  BVH m_bvh;
+  bool m_bvhDirty = true; // objects were added or removed
+  std::vector<std::uint32_t> m_bvhHits;
+  std::vector<BVHBenchmark> m_benchmarks;
+  OcclusionCuller m_occlusion;
+  std::vector<std::pair<float, int>> m_occluders; // screen coverage, object
+  std::unique_ptr<HiZCuller> m_hiZ; // only with OpenGL 4.3
   std::unordered_map<std::string, std::weak_ptr<Model>> m_loadedModels;
   Texture m_emission;
 
-  int mOutlinePct = 3; // in %
-  glm::vec4 mOutlineColor = glm::vec4(1.0f);
+  int m_outlined = 0; // instances submitted to the outline pass
+  int m_copyCount = 100;
+  CullingMode m_cullingMode = CullingMode::BVH;
+  CullStats m_objectCulling;
+  CullStats m_meshCulling;
+  OcclusionMode m_occlusionMode = OcclusionMode::None;
+  int m_maxOccluders = 32;
+  OcclusionStats m_occlusionStats;
+  HiZStats m_hiZStats;
 
   void loadObject(const std::string &path);
+
+  void addCopies(std::size_t source, int count);
+
+  // Removes from the draw order the objects hidden behind the largest ones.
+  void occlusionCull(const glm::mat4 &viewProjection);
 };
 
 #endif
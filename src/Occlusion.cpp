@@ -0,0 +1,214 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+
+#include "Occlusion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define OCCLUSION_SSE
+#endif
+
+constexpr int BAND_HEIGHT = 16;
+
+static_assert(OcclusionCuller::WIDTH % 4 == 0, "rows are rasterized 4 pixels at a time");
+static_assert(OcclusionCuller::HEIGHT % BAND_HEIGHT == 0);
+static_assert(OcclusionCuller::WIDTH % (1 << (OcclusionCuller::LEVELS - 1)) == 0 &&
+              OcclusionCuller::HEIGHT % (1 << (OcclusionCuller::LEVELS - 1)) == 0);
+
+OcclusionCuller::OcclusionCuller(ThreadPool &threadPool) : m_threadPool{threadPool} {
+    for (auto level = 0; level < LEVELS; ++level) {
+        m_pyramid[level].resize((WIDTH >> level) * (HEIGHT >> level), 1.0f);
+    }
+}
+
+void OcclusionCuller::begin(const glm::mat4 &viewProjection) {
+    m_viewProjection = viewProjection;
+    m_triangles.clear();
+    std::ranges::fill(m_pyramid[0], 1.0f);
+}
+
+void OcclusionCuller::addOccluder(const glm::mat4 &model, const glm::vec3 *positions, const std::size_t stride,
+                                  const std::size_t vertexCount, const std::span<const unsigned int> indices) {
+    const auto mvp = m_viewProjection * model;
+    m_clip.resize(vertexCount);
+    const auto bytes = reinterpret_cast<const std::byte *>(positions);
+    for (std::size_t i = 0; i < vertexCount; ++i) {
+        m_clip[i] = mvp * glm::vec4(*reinterpret_cast<const glm::vec3 *>(bytes + i * stride), 1.0f);
+    }
+
+    const auto toScreen = [](const glm::vec4 &clip) {
+        return glm::vec2((clip.x / clip.w * 0.5f + 0.5f) * WIDTH, (0.5f - clip.y / clip.w * 0.5f) * HEIGHT);
+    };
+    for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+        const auto &c0 = m_clip[indices[i]];
+        const auto &c1 = m_clip[indices[i + 1]];
+        const auto &c2 = m_clip[indices[i + 2]];
+        // Triangles crossing the near plane are dropped rather than clipped: missing occluders are always safe.
+        if (c0.z < -c0.w || c1.z < -c1.w || c2.z < -c2.w || c0.w <= 0.0f || c1.w <= 0.0f || c2.w <= 0.0f)
+            continue;
+
+        Triangle triangle{toScreen(c0), toScreen(c1), toScreen(c2)};
+        const auto area = (triangle.v1.x - triangle.v0.x) * (triangle.v2.y - triangle.v0.y) -
+                          (triangle.v1.y - triangle.v0.y) * (triangle.v2.x - triangle.v0.x);
+        if (area == 0.0f)
+            continue;
+        if (area < 0.0f)
+            std::swap(triangle.v1, triangle.v2); // counter-clockwise, so that inside means positive edge functions
+
+        const auto minX = std::min({triangle.v0.x, triangle.v1.x, triangle.v2.x});
+        const auto maxX = std::max({triangle.v0.x, triangle.v1.x, triangle.v2.x});
+        const auto minY = std::min({triangle.v0.y, triangle.v1.y, triangle.v2.y});
+        const auto maxY = std::max({triangle.v0.y, triangle.v1.y, triangle.v2.y});
+        if (maxX < 0.0f || minX >= WIDTH || maxY < 0.0f || minY >= HEIGHT)
+            continue;
+        triangle.minY = std::max(0, static_cast<int>(minY));
+        triangle.maxY = std::min(HEIGHT - 1, static_cast<int>(maxY));
+        triangle.depth = std::max({c0.z / c0.w, c1.z / c1.w, c2.z / c2.w}) * 0.5f + 0.5f;
+        m_triangles.push_back(triangle);
+    }
+}
+
+void OcclusionCuller::rasterize() {
+    m_threadPool.parallelFor(HEIGHT / BAND_HEIGHT, [this](const std::size_t band) {
+        const auto minY = static_cast<int>(band) * BAND_HEIGHT;
+        rasterizeBand(minY, minY + BAND_HEIGHT - 1);
+    });
+
+    // Each texel keeps the farthest depth of the four below it.
+    for (auto level = 1; level < LEVELS; ++level) {
+        const auto width = WIDTH >> level;
+        const auto height = HEIGHT >> level;
+        const auto &below = m_pyramid[level - 1];
+        auto &texels = m_pyramid[level];
+        for (auto y = 0; y < height; ++y) {
+            const auto row0 = below.data() + 2 * y * 2 * width;
+            const auto row1 = row0 + 2 * width;
+            for (auto x = 0; x < width; ++x) {
+                texels[y * width + x] = std::max({row0[2 * x], row0[2 * x + 1], row1[2 * x], row1[2 * x + 1]});
+            }
+        }
+    }
+}
+
+bool OcclusionCuller::isVisible(const AABB &box) const {
+    const auto footprint = project(box);
+    if (footprint.crossesNearPlane)
+        return true;
+    // Boxes outside the screen are left to frustum culling.
+    if (footprint.max.x < 0.0f || footprint.min.x >= WIDTH || footprint.max.y < 0.0f || footprint.min.y >= HEIGHT)
+        return true;
+
+    const auto x0 = std::clamp(static_cast<int>(footprint.min.x), 0, WIDTH - 1);
+    const auto x1 = std::clamp(static_cast<int>(footprint.max.x), 0, WIDTH - 1);
+    const auto y0 = std::clamp(static_cast<int>(footprint.min.y), 0, HEIGHT - 1);
+    const auto y1 = std::clamp(static_cast<int>(footprint.max.y), 0, HEIGHT - 1);
+
+    // The level where the rectangle spans about two texels per side, so that at most 3x3 texels are read.
+    const auto size = std::max(x1 - x0, y1 - y0) + 1;
+    auto level = 0;
+    while (level < LEVELS - 1 && size >> level > 2) {
+        level++;
+    }
+    const auto width = WIDTH >> level;
+    const auto &texels = m_pyramid[level];
+    auto farthest = 0.0f;
+    for (auto y = y0 >> level; y <= y1 >> level; ++y) {
+        for (auto x = x0 >> level; x <= x1 >> level; ++x) {
+            farthest = std::max(farthest, texels[y * width + x]);
+        }
+    }
+    return footprint.depth <= farthest;
+}
+
+float OcclusionCuller::getScreenCoverage(const AABB &box) const {
+    const auto footprint = project(box);
+    if (footprint.crossesNearPlane)
+        return 1.0f;
+    const auto min = glm::clamp(footprint.min, glm::vec2(0.0f), glm::vec2(WIDTH, HEIGHT));
+    const auto max = glm::clamp(footprint.max, glm::vec2(0.0f), glm::vec2(WIDTH, HEIGHT));
+    return (max.x - min.x) * (max.y - min.y) / static_cast<float>(WIDTH * HEIGHT);
+}
+
+OcclusionCuller::Footprint OcclusionCuller::project(const AABB &box) const {
+    Footprint footprint{
+        glm::vec2(std::numeric_limits<float>::max()), glm::vec2(std::numeric_limits<float>::lowest()), 1.0f, false
+    };
+    for (auto corner = 0; corner < 8; ++corner) {
+        const auto point = glm::vec3(corner & 1 ? box.max.x : box.min.x, corner & 2 ? box.max.y : box.min.y,
+                                     corner & 4 ? box.max.z : box.min.z);
+        const auto clip = m_viewProjection * glm::vec4(point, 1.0f);
+        if (clip.w <= 0.0f || clip.z < -clip.w) {
+            footprint.crossesNearPlane = true;
+            return footprint;
+        }
+        const auto screen = glm::vec2((clip.x / clip.w * 0.5f + 0.5f) * WIDTH,
+                                      (0.5f - clip.y / clip.w * 0.5f) * HEIGHT);
+        footprint.min = glm::min(footprint.min, screen);
+        footprint.max = glm::max(footprint.max, screen);
+        footprint.depth = std::min(footprint.depth, clip.z / clip.w * 0.5f + 0.5f);
+    }
+    return footprint;
+}
+
+void OcclusionCuller::rasterizeBand(const int minY, const int maxY) {
+    auto *const depth = m_pyramid[0].data();
+    for (const auto &triangle: m_triangles) {
+        if (triangle.maxY < minY || triangle.minY > maxY)
+            continue;
+        const auto &[v0, v1, v2, triangleDepth, triangleMinY, triangleMaxY] = triangle;
+
+        // Edge functions a * x + b * y + c, positive inside the triangle.
+        struct Edge {
+            float a, b, c;
+        };
+        const auto makeEdge = [](const glm::vec2 &from, const glm::vec2 &to) {
+            const auto a = from.y - to.y;
+            const auto b = to.x - from.x;
+            return Edge{a, b, -(a * from.x + b * from.y)};
+        };
+        const std::array edges = {makeEdge(v0, v1), makeEdge(v1, v2), makeEdge(v2, v0)};
+
+        // Rows are walked 4 pixels at a time, starting on a multiple of 4.
+        const auto x0 = std::max(0, static_cast<int>(std::min({v0.x, v1.x, v2.x}))) & ~3;
+        const auto x1 = std::min(WIDTH - 1, static_cast<int>(std::max({v0.x, v1.x, v2.x})));
+        const auto y0 = std::max(triangleMinY, minY);
+        const auto y1 = std::min(triangleMaxY, maxY);
+
+#if defined(OCCLUSION_SSE)
+        const auto zero = _mm_setzero_ps();
+        const auto newDepth = _mm_set1_ps(triangleDepth);
+        const auto offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        for (auto y = y0; y <= y1; ++y) {
+            const auto pixelY = static_cast<float>(y) + 0.5f;
+            auto *const row = depth + y * WIDTH;
+            for (auto x = x0; x <= x1; x += 4) {
+                const auto pixelX = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), offsets);
+                auto inside = _mm_cmpeq_ps(zero, zero);
+                for (const auto &[a, b, c]: edges) {
+                    const auto value = _mm_add_ps(_mm_mul_ps(pixelX, _mm_set1_ps(a)), _mm_set1_ps(b * pixelY + c));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(value, zero));
+                }
+                const auto current = _mm_loadu_ps(row + x);
+                const auto nearest = _mm_min_ps(current, newDepth);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+            }
+        }
+#else
+        for (auto y = y0; y <= y1; ++y) {
+            const auto pixelY = static_cast<float>(y) + 0.5f;
+            auto *const row = depth + y * WIDTH;
+            for (auto x = x0; x <= x1; ++x) {
+                const auto pixelX = static_cast<float>(x) + 0.5f;
+                if (std::ranges::all_of(edges, [&](const Edge &edge) {
+                    return edge.a * pixelX + edge.b * pixelY + edge.c >= 0.0f;
+                }))
+                    row[x] = std::min(row[x], triangleDepth);
+            }
+        }
+#endif
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+#include "ThreadPool.h"
+
+#include <array>
+#include <span>
+#include <vector>
+
+struct OcclusionStats {
+    int occluders = 0;
+    int triangles = 0;
+    int tested = 0;
+    int occluded = 0;
+    double rasterMilliseconds = 0.0;
+    double testMilliseconds = 0.0;
+};
+
+// Occlusion culling on the CPU, without any feedback from the GPU. Occluder triangles are rasterized into a small
+// depth buffer, from which a max-depth pyramid is built. A box is occluded when its nearest point is farther than
+// everything drawn in the pyramid texels covering it.
+//
+// Every occluder triangle is written at the depth of its farthest vertex, so that occluders never end up nearer than
+// they are.
+class OcclusionCuller {
+public:
+    static constexpr int WIDTH = 320;
+    static constexpr int HEIGHT = 192;
+    static constexpr int LEVELS = 7; // 320x192 down to 5x3
+
+    explicit OcclusionCuller(ThreadPool &threadPool);
+
+    // Clears the depth buffer and the occluders of the previous frame.
+    void begin(const glm::mat4 &viewProjection);
+
+    // Positions are read from a strided array, such as the vertices of a mesh.
+    void addOccluder(const glm::mat4 &model, const glm::vec3 *positions, std::size_t stride, std::size_t vertexCount,
+                     std::span<const unsigned int> indices);
+
+    // Rasterizes the occluders, in horizontal bands spread over the thread pool, and builds the depth pyramid.
+    void rasterize();
+
+    [[nodiscard]] bool isVisible(const AABB &box) const;
+
+    // Area of the screen covered by the projection of the box, from 0 to 1. Boxes crossing the near plane cover it all.
+    [[nodiscard]] float getScreenCoverage(const AABB &box) const;
+
+    [[nodiscard]] int getTriangleCount() const { return static_cast<int>(m_triangles.size()); }
+
+private:
+    struct Triangle {
+        glm::vec2 v0, v1, v2; // in pixels
+        float depth = 0.0f; // farthest vertex, in [0, 1]
+        int minY = 0, maxY = 0;
+    };
+
+    // Screen rectangle and nearest depth of a box.
+    struct Footprint {
+        glm::vec2 min, max;
+        float depth;
+        bool crossesNearPlane;
+    };
+
+    ThreadPool &m_threadPool;
+    glm::mat4 m_viewProjection{1.0f};
+    std::vector<Triangle> m_triangles;
+    std::vector<glm::vec4> m_clip; // scratch, occluder vertices in clip space
+    std::array<std::vector<float>, LEVELS> m_pyramid;
+
+    [[nodiscard]] Footprint project(const AABB &box) const;
+
+    void rasterizeBand(int minY, int maxY);
+};
+
+#endif
@@ -0,0 +1,98 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+
+#include "Oit.h"
+
+#include <array>
+
+WeightedBlendedOit::WeightedBlendedOit(ShaderManager &shaders, const std::string &shaderDir) : m_shaders{shaders} {
+    shaders.add("oit_composite", shaderDir + "fullscreen.vert", shaderDir + "oit_composite.frag");
+    glGenFramebuffers(1, &m_framebuffer);
+    glGenVertexArrays(1, &m_vao);
+}
+
+WeightedBlendedOit::~WeightedBlendedOit() {
+    glDeleteVertexArrays(1, &m_vao);
+    glDeleteRenderbuffers(1, &m_depth);
+    glDeleteTextures(1, &m_alphaWeights);
+    glDeleteTextures(1, &m_accumulation);
+    glDeleteFramebuffers(1, &m_framebuffer);
+}
+
+bool WeightedBlendedOit::isReady() const {
+    return m_shaders.isReady("oit_composite");
+}
+
+void WeightedBlendedOit::begin() {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] != m_width || viewport[3] != m_height)
+        resize(viewport[2], viewport[3]);
+
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_target);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_target);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer);
+    glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+
+    // Nothing accumulated yet, and everything behind fully revealed.
+    constexpr std::array accumulation = {0.0f, 0.0f, 0.0f, 1.0f};
+    constexpr std::array alphaWeights = {0.0f, 0.0f, 0.0f, 0.0f};
+    glClearBufferfv(GL_COLOR, 0, accumulation.data());
+    glClearBufferfv(GL_COLOR, 1, alphaWeights.data());
+
+    glDepthMask(GL_FALSE);
+    glEnable(GL_BLEND);
+    glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void WeightedBlendedOit::composite() {
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(m_target));
+    glDisable(GL_DEPTH_TEST);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    const auto compositeShader = m_shaders.get("oit_composite");
+    compositeShader->use();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_accumulation);
+    compositeShader->setInt("accumulation", 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_alphaWeights);
+    compositeShader->setInt("alphaWeights", 1);
+    glBindVertexArray(m_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+void WeightedBlendedOit::resize(const int width, const int height) {
+    m_width = width;
+    m_height = height;
+    if (width <= 0 || height <= 0)
+        return; // minimized, the old targets are kept
+
+    const auto target = [&](GLuint &texture, const GLint format, const GLenum components) {
+        if (texture == 0)
+            glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, components, GL_HALF_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    };
+    target(m_accumulation, GL_RGBA16F, GL_RGBA);
+    target(m_alphaWeights, GL_R16F, GL_RED);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Blits between depth buffers need the same format as the default framebuffer.
+    if (m_depth == 0)
+        glGenRenderbuffers(1, &m_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_accumulation, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_alphaWeights, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_depth);
+    constexpr std::array<GLenum, 2> drawBuffers = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(static_cast<GLsizei>(drawBuffers.size()), drawBuffers.data());
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
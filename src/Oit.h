@@ -0,0 +1,48 @@
+#ifndef OIT_H
+#define OIT_H
+
+#include <glad/glad.h>
+
+#include "Shader.h"
+
+#include <string>
+
+// Weighted blended order-independent transparency: transparent fragments are summed, in any order, into an
+// accumulation and a revealage target, weighted by their alpha and depth. A composite pass then blends the weighted
+// average over the frame. The result approximates back to front blending without sorting anything, at the cost of
+// exact ordering between close layers.
+//
+// Both targets are written with the same blend function, so that OpenGL 3.3 is enough:
+//  - accumulation (RGBA16F): the sum of color * alpha * weight, and the product of (1 - alpha) in alpha;
+//  - alpha weights (R16F): the sum of alpha * weight.
+class WeightedBlendedOit {
+public:
+    // The composite program is added to the shader manager.
+    WeightedBlendedOit(ShaderManager &shaders, const std::string &shaderDir);
+
+    ~WeightedBlendedOit();
+
+    WeightedBlendedOit(const WeightedBlendedOit &) = delete;
+
+    WeightedBlendedOit &operator=(const WeightedBlendedOit &) = delete;
+
+    // The composite program is linked, nothing can be blended before.
+    [[nodiscard]] bool isReady() const;
+
+    // Copies the depth of the opaque geometry, clears the targets and draws into them from now on.
+    void begin();
+
+    // Blends the transparent layers over the framebuffer that was bound on begin.
+    void composite();
+
+private:
+    const ShaderManager &m_shaders;
+    GLuint m_framebuffer{}, m_accumulation{}, m_alphaWeights{}, m_depth{};
+    GLuint m_vao{}; // no attributes, the composite triangle is generated from gl_VertexID
+    GLint m_target = 0;
+    int m_width = 0, m_height = 0;
+
+    void resize(int width, int height);
+};
+
+#endif
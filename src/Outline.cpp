@@ -0,0 +1,136 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+#include <glm/gtc/type_ptr.hpp>
+#include <imgui.h>
+
+#include "Outline.h"
+
+#include <bit>
+
+OutlineRenderer::OutlineRenderer(ShaderManager &shaders, const std::string &shaderDir) : m_shaders{shaders} {
+    shaders.add("outline_seed", shaderDir + "fullscreen.vert", shaderDir + "outline_seed.frag");
+    shaders.add("jump_flood", shaderDir + "fullscreen.vert", shaderDir + "jump_flood.frag");
+    shaders.add("outline_composite", shaderDir + "fullscreen.vert", shaderDir + "outline_composite.frag");
+
+    glGenFramebuffers(1, &m_framebuffer);
+    glGenFramebuffers(static_cast<GLsizei>(m_floodFramebuffers.size()), m_floodFramebuffers.data());
+    glGenVertexArrays(1, &m_vao);
+}
+
+OutlineRenderer::~OutlineRenderer() {
+    glDeleteVertexArrays(1, &m_vao);
+    glDeleteTextures(static_cast<GLsizei>(m_seeds.size()), m_seeds.data());
+    glDeleteTextures(1, &m_mask);
+    glDeleteFramebuffers(static_cast<GLsizei>(m_floodFramebuffers.size()), m_floodFramebuffers.data());
+    glDeleteFramebuffers(1, &m_framebuffer);
+}
+
+void OutlineRenderer::widgets() {
+    if (ImGui::CollapsingHeader("Outline")) {
+        ImGui::ColorEdit3("Color##outline", glm::value_ptr(m_color));
+        ImGui::SliderInt("Thickness", &m_thickness, 1, 64, "%d px");
+    }
+}
+
+bool OutlineRenderer::isReady() const {
+    return m_shaders.isReady("outline_seed") && m_shaders.isReady("jump_flood") &&
+           m_shaders.isReady("outline_composite");
+}
+
+void OutlineRenderer::begin() {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] != m_width || viewport[3] != m_height)
+        resize(viewport[2], viewport[3]);
+
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_target);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    constexpr std::array none = {0.0f, 0.0f, 0.0f, 0.0f};
+    glClearBufferfv(GL_COLOR, 0, none.data());
+}
+
+void OutlineRenderer::composite() {
+    if (!isReady()) {
+        glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(m_target));
+        return;
+    }
+
+    // Full-screen triangles must be filled, even in wireframe.
+    GLint polygonMode[2];
+    glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glBindVertexArray(m_vao);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_mask);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_floodFramebuffers[0]);
+    const auto seedShader = m_shaders.get("outline_seed");
+    seedShader->use();
+    seedShader->setInt("mask", 0);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    // Steps halve down to a pixel. They add up to twice the first one: edges up to that far are found.
+    const auto floodShader = m_shaders.get("jump_flood");
+    floodShader->use();
+    floodShader->setInt("seeds", 1);
+    auto read = 0;
+    for (auto step = static_cast<int>(std::bit_ceil(static_cast<unsigned>(m_thickness + 1))); step > 0; step /= 2) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, m_seeds[read]);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_floodFramebuffers[1 - read]);
+        floodShader->setInt("stepSize", step);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        read = 1 - read;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(m_target));
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    const auto compositeShader = m_shaders.get("outline_composite");
+    compositeShader->use();
+    compositeShader->setInt("mask", 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_seeds[read]);
+    compositeShader->setInt("seeds", 1);
+    compositeShader->setVec3("outlineColor", m_color);
+    compositeShader->setFloat("thickness", static_cast<float>(m_thickness));
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glDisable(GL_BLEND);
+    glBindVertexArray(0);
+    glPolygonMode(GL_FRONT_AND_BACK, static_cast<GLenum>(polygonMode[0]));
+}
+
+void OutlineRenderer::resize(const int width, const int height) {
+    m_width = width;
+    m_height = height;
+    if (width <= 0 || height <= 0)
+        return; // minimized, the old targets are kept
+
+    const auto target = [&](GLuint &texture, const GLint format, const GLenum components, const GLenum type) {
+        if (texture == 0)
+            glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, components, type, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    };
+    // IDs are small integers, exact in a float. Seeds are pixel coordinates, -1 without one.
+    target(m_mask, GL_R32F, GL_RED, GL_FLOAT);
+    for (auto &seeds: m_seeds) {
+        target(seeds, GL_RG16I, GL_RG_INTEGER, GL_SHORT);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_mask, 0);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    for (std::size_t i = 0; i < m_seeds.size(); ++i) {
+        glBindFramebuffer(GL_FRAMEBUFFER, m_floodFramebuffers[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_seeds[i], 0);
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
@@ -0,0 +1,56 @@
+#ifndef OUTLINE_H
+#define OUTLINE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+
+#include <array>
+#include <string>
+
+// Screen-space outlines of the selected objects. The outline pass of the render queue writes, in a mask, the ID of
+// each outlined instance, through the cheap outline branch of object.frag. The outlines are then found on the screen:
+//  - pixels of an instance next to a pixel of another one, or of none, are the edges of the silhouettes;
+//  - a jump flood spreads to every pixel the nearest edge, in log2 of the thickness passes of a full-screen triangle;
+//  - pixels outside the silhouettes closer to an edge than the thickness get the outline color, and touching outlined
+//    instances are separated by a line.
+// Outlines are drawn over everything, whatever the depth. Their cost depends on the screen size and the thickness, not
+// on the meshes or the number of outlined objects.
+class OutlineRenderer {
+public:
+    // The seed, jump flood and composite programs are added to the shader manager.
+    OutlineRenderer(ShaderManager &shaders, const std::string &shaderDir);
+
+    ~OutlineRenderer();
+
+    OutlineRenderer(const OutlineRenderer &) = delete;
+
+    OutlineRenderer &operator=(const OutlineRenderer &) = delete;
+
+    void widgets();
+
+    // Clears the mask and draws into it from now on. To be called before the outline pass.
+    void begin();
+
+    [[nodiscard]] bool isReady() const;
+
+    // Draws the outlines over the framebuffer that was bound on begin. Until the programs are linked, only binds it
+    // back.
+    void composite();
+
+private:
+    const ShaderManager &m_shaders;
+    GLuint m_framebuffer{}, m_mask{};
+    std::array<GLuint, 2> m_floodFramebuffers{}, m_seeds{}; // read and written in turns
+    GLuint m_vao{}; // no attributes, the full-screen triangle is generated from gl_VertexID
+    GLint m_target = 0;
+    int m_width = 0, m_height = 0;
+
+    glm::vec3 m_color{1.0f};
+    int m_thickness = 4; // in pixels
+
+    void resize(int width, int height);
+};
+
+#endif
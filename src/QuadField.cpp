@@ -0,0 +1,117 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+
+#include "QuadField.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <span>
+
+QuadField::QuadField(const std::string &texturePath, const glm::vec2 &quadMin, const glm::vec2 &quadMax)
+    : m_texture{texturePath} {
+    m_texture.setWrap(Texture::Wrap::ClampToEdge, Texture::Wrap::ClampToEdge);
+    m_textures = TextureSet{{{&m_texture, "transparentTexture"}}};
+
+    const auto [left, bottom] = quadMin;
+    const auto [right, top] = quadMax;
+    const std::array vertices = {
+        // positions        // texture coords
+        left, top, 0.0f, 0.0f, 0.0f,
+        left, bottom, 0.0f, 0.0f, 1.0f,
+        right, bottom, 0.0f, 1.0f, 1.0f,
+
+        left, top, 0.0f, 0.0f, 0.0f,
+        right, bottom, 0.0f, 1.0f, 1.0f,
+        right, top, 0.0f, 1.0f, 0.0f
+    };
+
+    glGenVertexArrays(1, &m_vao);
+    glGenBuffers(1, &m_vbo);
+    glBindVertexArray(m_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), static_cast<void *>(nullptr));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), reinterpret_cast<void *>(3 * sizeof(float)));
+    glBindVertexArray(0);
+}
+
+QuadField::~QuadField() {
+    glDeleteVertexArrays(1, &m_vao);
+    glDeleteBuffers(1, &m_vbo);
+}
+
+void QuadField::scatter(const int seed, const int count, const float regionSize, const float chunkSize,
+                        const Placement &placement) {
+    const auto chunksPerSide = std::max(1, static_cast<int>(std::ceil(regionSize / chunkSize)));
+    const auto halfSize = regionSize * 0.5f;
+
+    std::mt19937 rng(static_cast<std::mt19937::result_type>(seed));
+    std::uniform_real_distribution<float> position(-halfSize, halfSize);
+
+    std::vector<Instance> instances;
+    instances.reserve(std::max(count, 0));
+    std::vector<std::uint32_t> cells;
+    cells.reserve(instances.capacity());
+    std::vector<std::uint32_t> offsets(chunksPerSide * chunksPerSide + 1, 0);
+    const auto cell = [&](const float coordinate) {
+        return std::clamp(static_cast<int>((coordinate + halfSize) / chunkSize), 0, chunksPerSide - 1);
+    };
+    for (auto i = 0; i < count; ++i) {
+        const auto x = position(rng);
+        const auto z = position(rng);
+        instances.push_back(placement(x, z, rng));
+        cells.push_back(cell(z) * chunksPerSide + cell(x));
+        offsets[cells.back() + 1]++;
+    }
+
+    // Counting sort by chunk, so that the instances of a chunk are consecutive.
+    for (auto i = 1; i < offsets.size(); ++i) {
+        offsets[i] += offsets[i - 1];
+    }
+    m_chunks.assign(chunksPerSide * chunksPerSide, {});
+    for (auto i = 0; i < m_chunks.size(); ++i) {
+        m_chunks[i].first = offsets[i];
+        m_chunks[i].count = offsets[i + 1] - offsets[i];
+    }
+
+    std::vector<TransformBuffer::Transform> transforms(instances.size());
+    m_centers.resize(instances.size());
+    for (auto i = 0; i < instances.size(); ++i) {
+        const auto &[model, center, bounds] = instances[i];
+        m_centers[offsets[cells[i]]] = center;
+        transforms[offsets[cells[i]]++] = TransformBuffer::Transform(model);
+        m_chunks[cells[i]].bounds.expand(bounds);
+    }
+    std::erase_if(m_chunks, [](const Chunk &chunk) { return chunk.count == 0; });
+
+    m_transforms.upload(transforms, GL_STATIC_DRAW);
+}
+
+void QuadField::submit(RenderQueue &queue, Shader *const shader, const Frustum &frustum) {
+    clearStats();
+
+    DrawPacket packet;
+    packet.pass = RenderPass::Transparent;
+    packet.shader = shader;
+    packet.textures = &m_textures;
+    packet.vao = m_vao;
+    packet.count = 6;
+    packet.transforms = &m_transforms;
+    for (const auto &[bounds, first, count]: m_chunks) {
+        if (!frustum.intersects(bounds))
+            continue;
+        packet.transform = first;
+        packet.instances = static_cast<GLsizei>(count);
+        queue.submitTransparent(packet, std::span(m_centers).subspan(first, count));
+        m_visibleChunks++;
+        m_visibleInstances += static_cast<int>(count);
+    }
+}
+
+void QuadField::clearStats() {
+    m_visibleChunks = 0;
+    m_visibleInstances = 0;
+}
@@ -0,0 +1,74 @@
+#ifndef QUAD_FIELD_H
+#define QUAD_FIELD_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+#include "RenderQueue.h"
+#include "Shader.h"
+#include "Texture.h"
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+// Instances of a textured quad scattered over a square region around the origin, drawn blended. Their transforms are
+// generated once and kept on the GPU, only their centers stay on the CPU to sort them. Instances are grouped in square
+// chunks, culled as a whole.
+class QuadField {
+public:
+    // Transform of an instance, with its center and world bounds.
+    struct Instance {
+        glm::mat4 model;
+        glm::vec3 center;
+        AABB bounds;
+    };
+
+    // Places an instance at the given horizontal position, drawing what else it needs from the generator.
+    using Placement = std::function<Instance(float x, float z, std::mt19937 &rng)>;
+
+    // The quad faces +z, between the given corners of the xy plane.
+    QuadField(const std::string &texturePath, const glm::vec2 &quadMin, const glm::vec2 &quadMax);
+
+    ~QuadField();
+
+    QuadField(const QuadField &) = delete;
+
+    QuadField &operator=(const QuadField &) = delete;
+
+    // Same seed and settings give the same field.
+    void scatter(int seed, int count, float regionSize, float chunkSize, const Placement &placement);
+
+    void submit(RenderQueue &queue, Shader *shader, const Frustum &frustum);
+
+    // Empties the visible counts, for frames where the field is not submitted.
+    void clearStats();
+
+    [[nodiscard]] std::size_t getChunkCount() const { return m_chunks.size(); }
+
+    [[nodiscard]] int getVisibleChunks() const { return m_visibleChunks; }
+
+    [[nodiscard]] int getVisibleInstances() const { return m_visibleInstances; }
+
+private:
+    struct Chunk {
+        AABB bounds;
+        std::uint32_t first;
+        std::uint32_t count;
+    };
+
+    Texture m_texture;
+    TextureSet m_textures;
+    GLuint m_vao{}, m_vbo{};
+    TransformBuffer m_transforms;
+    std::vector<glm::vec3> m_centers; // in instance order
+    std::vector<Chunk> m_chunks;
+
+    int m_visibleChunks = 0;
+    int m_visibleInstances = 0;
+};
+
+#endif
@@ -0,0 +1,564 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <map>
+
+TextureSet::TextureSet(std::vector<TextureBinding> bindings) : bindings{std::move(bindings)} {
+    // Ids are handed out per distinct list of (texture, sampler), 0 is reserved for "no texture".
+    static std::map<std::vector<std::pair<GLuint, std::string> >, std::uint32_t> ids;
+    std::vector<std::pair<GLuint, std::string> > signature;
+    for (const auto &[texture, sampler]: this->bindings) {
+        signature.emplace_back(texture->getId(), sampler);
+    }
+    const auto [it, inserted] = ids.try_emplace(std::move(signature), static_cast<std::uint32_t>(ids.size() + 1));
+    id = it->second;
+}
+
+void radixSort(std::vector<SortItem> &items, std::vector<SortItem> &scratch) {
+    if (items.size() < 2)
+        return;
+    scratch.resize(items.size());
+
+    // All histograms are built in a single read of the keys.
+    std::array<std::array<std::uint32_t, 256>, 8> counts{};
+    for (const auto &[key, index]: items) {
+        for (auto byte = 0; byte < 8; ++byte) {
+            counts[byte][(key >> (byte * 8)) & 0xFF]++;
+        }
+    }
+
+    for (auto byte = 0; byte < 8; ++byte) {
+        const auto shift = byte * 8;
+        auto &count = counts[byte];
+        if (count[(items.front().key >> shift) & 0xFF] == items.size())
+            continue; // every key has the same byte, the pass would not move anything
+        std::uint32_t offset = 0;
+        for (auto &c: count) {
+            const auto n = c;
+            c = offset;
+            offset += n;
+        }
+        for (const auto &item: items) {
+            scratch[count[(item.key >> shift) & 0xFF]++] = item;
+        }
+        items.swap(scratch);
+    }
+}
+
+std::uint64_t makeSortKey(const RenderPass pass, const GLuint program, const std::uint32_t textures, const GLuint vao,
+                          const float depth) {
+    const auto quantize = [depth](const int bits) {
+        const auto max = (1u << bits) - 1;
+        return static_cast<std::uint64_t>(std::clamp(depth, 0.0f, 1.0f) * static_cast<float>(max));
+    };
+    return static_cast<std::uint64_t>(pass) << 60 | static_cast<std::uint64_t>(program & 0xFF) << 52 |
+           static_cast<std::uint64_t>(textures & 0xFFFF) << 36 | static_cast<std::uint64_t>(vao & 0xFFFF) << 20 |
+           quantize(20);
+}
+
+TransformBuffer::Transform::Transform(const glm::mat4 &model, const glm::mat3 &normalMatrix)
+    : model{model},
+      normalMatrix{glm::vec4(normalMatrix[0], 0.0f), glm::vec4(normalMatrix[1], 0.0f),
+                   glm::vec4(normalMatrix[2], 0.0f)} {
+}
+
+TransformBuffer::TransformBuffer() {
+    glGenBuffers(1, &m_buffer);
+    glGenTextures(1, &m_texture);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, m_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+TransformBuffer::~TransformBuffer() {
+    glDeleteTextures(1, &m_texture);
+    glDeleteBuffers(1, &m_buffer);
+}
+
+void TransformBuffer::upload(const std::span<const Transform> transforms, const GLenum usage) {
+    glBindBuffer(GL_TEXTURE_BUFFER, m_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(transforms.size_bytes()), transforms.data(), usage);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    if (m_streamed) {
+        // On the unit the texture is read from, so that no other buffer texture is unbound.
+        glActiveTexture(GL_TEXTURE0 + TRANSFORM_UNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, m_texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_buffer);
+        m_streamed = false;
+    }
+}
+
+void TransformBuffer::stream(RingBuffer &ring, const std::span<const Transform> transforms) {
+    // Empty ranges are invalid.
+    if (!RingBuffer::isTextureRangeSupported() || transforms.empty()) {
+        upload(transforms, GL_STREAM_DRAW);
+        return;
+    }
+    const auto allocation = ring.write(transforms, RingBuffer::getTextureAlignment());
+    ring.flush();
+    glActiveTexture(GL_TEXTURE0 + TRANSFORM_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, m_texture);
+    glTexBufferRange(GL_TEXTURE_BUFFER, GL_RGBA32F, allocation.buffer, allocation.offset, allocation.size);
+    m_streamed = true;
+}
+
+void TransformBuffer::bind() const {
+    glActiveTexture(GL_TEXTURE0 + TRANSFORM_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, m_texture);
+}
+
+RenderQueue::RenderQueue() {
+    glGenBuffers(1, &m_commandBuffer);
+    glGenBuffers(1, &m_sortedBuffer);
+    glGenTextures(1, &m_sortedTexture);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_sortedBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, m_sortedTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, m_sortedBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    setMultiDraw(true);
+}
+
+RenderQueue::~RenderQueue() {
+    glDeleteTextures(1, &m_sortedTexture);
+    glDeleteBuffers(1, &m_sortedBuffer);
+    glDeleteBuffers(1, &m_commandBuffer);
+}
+
+bool RenderQueue::isMultiDrawSupported() {
+    return GLAD_GL_VERSION_4_3 != 0;
+}
+
+void RenderQueue::begin(const glm::vec3 &viewPos, const float far) {
+    m_viewPos = viewPos;
+    m_far = far;
+    m_packets.clear();
+    m_transforms.clear();
+    m_items.clear();
+    m_transparentPackets.clear();
+    m_transparentItems.clear();
+    m_oit = m_nextOit;
+    for (auto &callbacks: m_callbacks) {
+        callbacks.clear();
+    }
+}
+
+std::uint32_t RenderQueue::addTransform(const glm::mat4 &model, const glm::mat3 &normalMatrix) {
+    m_transforms.emplace_back(model, normalMatrix);
+    return static_cast<std::uint32_t>(m_transforms.size() - 1);
+}
+
+void RenderQueue::submit(const DrawPacket &packet) {
+    if (packet.pass == RenderPass::Transparent) {
+        m_positions.clear();
+        for (auto i = 0; i < packet.instances; ++i) {
+            m_positions.emplace_back(m_transforms[packet.transform + i].model[3]);
+        }
+        submitTransparent(packet, m_positions);
+        return;
+    }
+    submit(packet, glm::vec3(m_transforms[packet.transform].model[3]));
+}
+
+void RenderQueue::submit(const DrawPacket &packet, const glm::vec3 &position) {
+    if (packet.pass == RenderPass::Transparent) {
+        m_positions.assign(packet.instances, position);
+        submitTransparent(packet, m_positions);
+        return;
+    }
+    const auto depth = glm::length(position - m_viewPos) / m_far;
+    const auto key = makeSortKey(packet.pass, packet.shader->getProgramId(),
+                                 packet.textures ? packet.textures->id : 0, packet.vao, depth);
+    m_items.push_back({key, static_cast<std::uint32_t>(m_packets.size())});
+    m_packets.push_back(packet);
+}
+
+void RenderQueue::submitTransparent(const DrawPacket &packet, const std::span<const glm::vec3> positions) {
+    // Accumulated in any order: packets are sorted by state, like opaque ones.
+    if (m_oit) {
+        m_items.push_back({
+            makeSortKey(packet.pass, packet.shader->getProgramId(), packet.textures ? packet.textures->id : 0,
+                        packet.vao, 0.0f),
+            static_cast<std::uint32_t>(m_packets.size())
+        });
+        m_packets.push_back(packet);
+        return;
+    }
+
+    // Instances are sorted one by one, their packets only tell how to draw them. Packets that differ only by their
+    // transforms are drawn the same way, so that instances of both end up in the same draw when they are adjacent.
+    const auto sameDraw = [&packet](const DrawPacket &other) {
+        return other.shader == packet.shader && other.vao == packet.vao && other.mode == packet.mode &&
+               other.count == packet.count && other.indexed == packet.indexed &&
+               other.firstIndex == packet.firstIndex && other.baseVertex == packet.baseVertex &&
+               other.transforms == packet.transforms &&
+               (other.textures ? other.textures->id : 0) == (packet.textures ? packet.textures->id : 0);
+    };
+    auto draw = std::ranges::find_if(m_transparentPackets, sameDraw);
+    if (draw == m_transparentPackets.end()) {
+        m_transparentPackets.push_back(packet);
+        draw = m_transparentPackets.end() - 1;
+    }
+    const auto drawIndex = static_cast<std::uint64_t>(draw - m_transparentPackets.begin());
+
+    // Squared distances order like distances, and positive floats order like their bits: inverted, the farthest
+    // instance comes first.
+    for (std::uint32_t i = 0; i < positions.size(); ++i) {
+        const auto offset = positions[i] - m_viewPos;
+        const auto bits = std::bit_cast<std::uint32_t>(glm::dot(offset, offset));
+        m_transparentItems.push_back({static_cast<std::uint64_t>(~bits) << 32 | drawIndex, packet.transform + i});
+    }
+}
+
+void RenderQueue::addCallback(const RenderPass pass, std::function<void()> callback) {
+    m_callbacks[static_cast<std::size_t>(pass)].push_back(std::move(callback));
+}
+
+void RenderQueue::execute() {
+    // Every transform of the frame is written at once.
+    if (m_ring)
+        m_transformBuffer.stream(*m_ring, m_transforms);
+    else
+        m_transformBuffer.upload(m_transforms, GL_STREAM_DRAW);
+
+    radixSort(m_items, m_scratch);
+
+    m_stats = {};
+    m_stats.packets = static_cast<int>(m_packets.size() + m_transparentPackets.size());
+
+    buildMultiDraws();
+
+    // The application decides whether depth testing is on, only the outline pass overrides it.
+    BoundState bound;
+    bound.depthTest = glIsEnabled(GL_DEPTH_TEST);
+    GLint depthFunc;
+    glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+    m_depthFunc = static_cast<GLenum>(depthFunc);
+    m_prepassed = false;
+    const auto prepass = m_depthPrepass && bound.depthTest && m_depthFunc == GL_LESS;
+
+    // Callbacks of every pass up to the given one that did not run yet. Afterwards nothing bound is known anymore.
+    std::size_t nextCallbacks = 0;
+    const auto runCallbacks = [&](const RenderPass pass) {
+        if (nextCallbacks > static_cast<std::size_t>(pass))
+            return;
+        setDepthEqual(false, bound);
+        auto ran = false;
+        for (; nextCallbacks <= static_cast<std::size_t>(pass); ++nextCallbacks) {
+            for (const auto &callback: m_callbacks[nextCallbacks]) {
+                callback();
+                ran = true;
+            }
+        }
+        if (ran)
+            bound = BoundState{.depthTest = bound.depthTest};
+    };
+
+    for (std::size_t item = 0; item < m_items.size();) {
+        const auto &packet = m_packets[m_items[item].index];
+        const auto &multiDraw = m_multiDraws[item];
+
+        runCallbacks(packet.pass);
+        // After the callbacks: the commands of indirect draws may be written by them.
+        if (prepass && !m_prepassed && packet.pass == RenderPass::Opaque)
+            drawDepthPrepass(item, bound);
+        bind(packet, bound);
+        const auto indirect = packet.indirect.commands != 0;
+        setDrawUniforms(packet, indirect ? packet.indirect.first : packet.transform, indirect, multiDraw.has_value());
+        drawItem(item, bound);
+        if (!multiDraw && !indirect && packet.pass == RenderPass::Transparent)
+            m_stats.transparentInstances += packet.instances;
+        item = multiDraw ? multiDraw->end : item + 1;
+    }
+    if (m_oit && bound.packet && bound.packet->pass == RenderPass::Transparent)
+        m_oit->composite();
+    runCallbacks(RenderPass::Transparent);
+    drawTransparent(bound);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    // Leave the depth writable so that the next frame can clear it.
+    setDepthEqual(false, bound);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+    bound.depthTest ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST);
+}
+
+void RenderQueue::drawItem(const std::size_t item, BoundState &bound) {
+    const auto &packet = m_packets[m_items[item].index];
+    if (const auto &multiDraw = m_multiDraws[item]) {
+        const auto count = multiDraw->end - item;
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+        glMultiDrawElementsIndirect(
+            packet.mode, GL_UNSIGNED_INT,
+            reinterpret_cast<const void *>(multiDraw->firstCommand * sizeof(DrawElementsIndirectCommand)),
+            static_cast<GLsizei>(count), 0);
+        for (auto command = multiDraw->firstCommand; command < multiDraw->firstCommand + count; ++command) {
+            m_stats.instances += static_cast<int>(m_commands[command].instanceCount);
+        }
+        m_stats.multiDraws++;
+    } else if (packet.indirect.commands != 0) {
+        if (packet.indirect.instanceIndices != bound.instanceIndices) {
+            glActiveTexture(GL_TEXTURE0 + INSTANCE_INDEX_UNIT);
+            glBindTexture(GL_TEXTURE_BUFFER, packet.indirect.instanceIndices);
+            bound.instanceIndices = packet.indirect.instanceIndices;
+        }
+        // The instance count is only known by the GPU, it is not counted.
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, packet.indirect.commands);
+        glDrawElementsIndirect(packet.mode, GL_UNSIGNED_INT, reinterpret_cast<const void *>(packet.indirect.offset));
+    } else {
+        draw(packet, packet.instances);
+    }
+    m_stats.drawCalls++;
+}
+
+void RenderQueue::drawDepthPrepass(const std::size_t first, BoundState &bound) {
+    beginPass(RenderPass::Opaque, bound.depthTest);
+    setDepthEqual(false, bound);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    m_depthPrepass->use();
+    m_depthPrepass->setInt("transforms", TRANSFORM_UNIT);
+    m_depthPrepass->setInt("instanceIndices", INSTANCE_INDEX_UNIT);
+
+    // Packets sorted for the shading pass, front to back within a state: good enough for the depth.
+    for (auto item = first; item < m_items.size();) {
+        const auto &packet = m_packets[m_items[item].index];
+        if (packet.pass != RenderPass::Opaque)
+            break;
+        const auto &multiDraw = m_multiDraws[item];
+        const auto next = multiDraw ? multiDraw->end : item + 1;
+        if (packet.depthVao == 0) {
+            item = next;
+            continue;
+        }
+        const auto transforms = packet.transforms ? packet.transforms : &m_transformBuffer;
+        if (transforms != bound.transforms) {
+            transforms->bind();
+            bound.transforms = transforms;
+        }
+        if (packet.depthVao != bound.vao) {
+            glBindVertexArray(packet.depthVao);
+            bound.vao = packet.depthVao;
+            m_stats.vaoChanges++;
+        }
+        const auto indirect = packet.indirect.commands != 0;
+        m_depthPrepass->setBool("remapInstances", indirect);
+        m_depthPrepass->setBool("multiDraw", multiDraw.has_value());
+        m_depthPrepass->setInt("baseInstance", static_cast<int>(indirect ? packet.indirect.first : packet.transform));
+        drawItem(item, bound);
+        m_stats.prepassDrawCalls++;
+        item = next;
+    }
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    m_stats.programChanges++;
+    m_prepassed = true;
+    // The shading pass binds its program and VAOs again.
+    bound.packet = nullptr;
+    bound.vao = 0;
+}
+
+void RenderQueue::setDepthEqual(const bool depthEqual, BoundState &bound) const {
+    if (depthEqual == bound.depthEqual)
+        return;
+    glDepthFunc(depthEqual ? GL_EQUAL : m_depthFunc);
+    glDepthMask(depthEqual ? GL_FALSE : GL_TRUE);
+    bound.depthEqual = depthEqual;
+}
+
+void RenderQueue::bind(const DrawPacket &packet, BoundState &bound) {
+    if (!bound.packet || packet.pass != bound.packet->pass) {
+        setDepthEqual(false, bound);
+        beginPass(packet.pass, bound.depthTest);
+    }
+    // Pre-passed packets only shade the fragments whose depth they wrote.
+    setDepthEqual(m_prepassed && packet.pass == RenderPass::Opaque && packet.depthVao != 0, bound);
+
+    if (!bound.packet || packet.shader != bound.packet->shader) {
+        packet.shader->use();
+        packet.shader->setInt("transforms", TRANSFORM_UNIT);
+        packet.shader->setInt("instanceIndices", INSTANCE_INDEX_UNIT);
+        // Sampler uniforms belong to the program, they have to be assigned again.
+        bound.textures = nullptr;
+        m_stats.programChanges++;
+    }
+
+    // Outlines only write IDs, their textures are never bound.
+    if (packet.textures && packet.pass != RenderPass::Outline &&
+        (!bound.textures || bound.textures->id != packet.textures->id)) {
+        for (auto unit = 0; const auto &[texture, sampler]: packet.textures->bindings) {
+            texture->setUnit(unit);
+            packet.shader->setInt(sampler, unit++);
+        }
+        bound.textures = packet.textures;
+        m_stats.textureChanges++;
+    }
+
+    const auto transforms = packet.transforms ? packet.transforms : &m_transformBuffer;
+    if (transforms != bound.transforms) {
+        transforms->bind();
+        bound.transforms = transforms;
+    }
+
+    if (packet.vao != bound.vao) {
+        glBindVertexArray(packet.vao);
+        bound.vao = packet.vao;
+        m_stats.vaoChanges++;
+    }
+    bound.packet = &packet;
+}
+
+void RenderQueue::draw(const DrawPacket &packet, const GLsizei instances) {
+    if (packet.indexed) {
+        glDrawElementsInstancedBaseVertex(packet.mode, packet.count, GL_UNSIGNED_INT,
+                                          reinterpret_cast<const void *>(packet.firstIndex * sizeof(GLuint)),
+                                          instances, packet.baseVertex);
+    } else {
+        glDrawArraysInstanced(packet.mode, 0, packet.count, instances);
+    }
+    m_stats.instances += instances;
+}
+
+void RenderQueue::drawTransparent(BoundState &bound) {
+    if (m_transparentItems.empty())
+        return;
+
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    radixSort(m_transparentItems, m_scratch);
+    m_sortedTransforms.resize(m_transparentItems.size());
+    for (std::size_t i = 0; i < m_transparentItems.size(); ++i) {
+        m_sortedTransforms[i] = static_cast<GLint>(m_transparentItems[i].index);
+    }
+    m_stats.transparentInstances = static_cast<int>(m_sortedTransforms.size());
+    m_stats.sortMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    // Instances are drawn in the sorted order through the list of their transforms.
+    glBindBuffer(GL_TEXTURE_BUFFER, m_sortedBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(m_sortedTransforms.size() * sizeof(GLint)),
+                 m_sortedTransforms.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0 + INSTANCE_INDEX_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, m_sortedTexture);
+    bound.instanceIndices = m_sortedTexture;
+
+    // Consecutive instances drawn the same way are a single draw.
+    const auto drawOf = [this](const std::size_t i) { return m_transparentItems[i].key & 0xFFFFFFFF; };
+    for (std::size_t first = 0; first < m_transparentItems.size();) {
+        auto end = first + 1;
+        while (end < m_transparentItems.size() && drawOf(end) == drawOf(first)) {
+            end++;
+        }
+        const auto &packet = m_transparentPackets[drawOf(first)];
+        bind(packet, bound);
+        setDrawUniforms(packet, static_cast<std::uint32_t>(first), true, false);
+        draw(packet, static_cast<GLsizei>(end - first));
+        m_stats.drawCalls++;
+        first = end;
+    }
+}
+
+void RenderQueue::buildMultiDraws() {
+    m_commands.clear();
+    m_multiDraws.assign(m_items.size(), std::nullopt);
+    if (!m_multiDraw)
+        return;
+
+    // Only per-packet uniforms that merged packets share are allowed: opaque passes, with the queue's transforms.
+    const auto mergeable = [](const DrawPacket &packet) {
+        return packet.mergeable && packet.indexed && packet.indirect.commands == 0 && !packet.transforms &&
+               (packet.pass == RenderPass::Opaque || packet.pass == RenderPass::OpaqueLate);
+    };
+    const auto sameState = [](const DrawPacket &a, const DrawPacket &b) {
+        return a.pass == b.pass && a.shader == b.shader && a.vao == b.vao && a.mode == b.mode &&
+               (a.textures ? a.textures->id : 0) == (b.textures ? b.textures->id : 0);
+    };
+
+    for (std::size_t item = 0; item < m_items.size();) {
+        const auto &first = m_packets[m_items[item].index];
+        auto end = item + 1;
+        if (mergeable(first)) {
+            while (end < m_items.size() && mergeable(m_packets[m_items[end].index]) &&
+                   sameState(first, m_packets[m_items[end].index])) {
+                end++;
+            }
+        }
+        if (end - item > 1) {
+            m_multiDraws[item] = MultiDraw{end, m_commands.size()};
+            for (auto i = item; i < end; ++i) {
+                const auto &packet = m_packets[m_items[i].index];
+                m_commands.push_back({
+                    static_cast<GLuint>(packet.count), static_cast<GLuint>(packet.instances), packet.firstIndex,
+                    packet.baseVertex, packet.transform
+                });
+            }
+        }
+        item = end;
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                 static_cast<GLsizeiptr>(m_commands.size() * sizeof(DrawElementsIndirectCommand)),
+                 m_commands.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void RenderQueue::beginPass(const RenderPass pass, const bool depthTest) const {
+    switch (pass) {
+        case RenderPass::Light:
+        case RenderPass::Opaque:
+        case RenderPass::OpaqueLate:
+            depthTest ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST);
+            break;
+        case RenderPass::Transparent:
+            // Blended back to front: tested against the opaque depth, but not written, so that overlapping instances
+            // all show.
+            depthTest ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST);
+            if (m_oit) {
+                m_oit->begin();
+            } else {
+                glDepthMask(GL_FALSE);
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            }
+            break;
+        case RenderPass::Outline:
+            // Whole silhouettes go to the outline mask, hidden parts included.
+            glDisable(GL_DEPTH_TEST);
+            break;
+    }
+}
+
+void RenderQueue::setDrawUniforms(const DrawPacket &packet, const std::uint32_t baseInstance,
+                                  const bool remapInstances, const bool multiDraw) const {
+    const auto shader = packet.shader;
+    shader->setBool("remapInstances", remapInstances);
+    shader->setBool("multiDraw", multiDraw);
+    shader->setInt("baseInstance", static_cast<int>(baseInstance));
+    switch (packet.pass) {
+        case RenderPass::Light:
+            shader->setVec3("lightColor", packet.color);
+            break;
+        case RenderPass::Opaque:
+        case RenderPass::OpaqueLate:
+            shader->setBool("outline", false);
+            shader->setBool("transparent", false);
+            break;
+        case RenderPass::Outline:
+            shader->setBool("outline", true);
+            break;
+        case RenderPass::Transparent:
+            shader->setBool("outline", false);
+            shader->setBool("transparent", true);
+            shader->setBool("weightedBlended", m_oit != nullptr);
+            break;
+    }
+}
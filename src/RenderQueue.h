@@ -0,0 +1,290 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Oit.h"
+#include "RingBuffer.h"
+#include "Shader.h"
+#include "Texture.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// Passes are executed in this order.
+enum class RenderPass : std::uint8_t {
+    Light = 0,
+    Opaque = 1,
+    OpaqueLate = 2, // opaque objects found visible once the depth of the opaque pass is known
+    Outline = 3, // IDs of the outlined instances, drawn into the mask of OutlineRenderer
+    Transparent = 4,
+};
+
+constexpr std::size_t RENDER_PASS_COUNT = 5;
+
+struct TextureBinding {
+    const Texture *texture;
+    std::string sampler; // uniform the texture unit is assigned to
+};
+
+// Textures bound together for a draw. Sets made of the same textures share an id.
+struct TextureSet {
+    TextureSet() = default;
+
+    explicit TextureSet(std::vector<TextureBinding> bindings);
+
+    std::vector<TextureBinding> bindings;
+    std::uint32_t id = 0;
+};
+
+// Texture unit of the per-instance transform buffer, out of the way of material textures.
+constexpr int TRANSFORM_UNIT = 15;
+
+// Texture unit of the instance indices of indirect draws.
+constexpr int INSTANCE_INDEX_UNIT = 14;
+
+// Vertex attribute holding the index of each instance, base instance included, for the VAOs of mergeable packets.
+// Multi-draws read it instead of baseInstance, which differs between their draws.
+constexpr GLuint INSTANCE_ATTRIBUTE = 3;
+
+// Layout of the commands read from GL_DRAW_INDIRECT_BUFFER by indexed indirect draws.
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Per-instance transforms stored in a buffer texture, read by the vertex shaders through transforms.glsl.
+class TransformBuffer {
+public:
+    // Layout read by the vertex shaders: 7 RGBA32F texels per instance.
+    struct Transform {
+        glm::mat4 model;
+        glm::vec4 normalMatrix[3]; // columns, padded to vec4
+
+        Transform() = default;
+
+        explicit Transform(const glm::mat4 &model, const glm::mat3 &normalMatrix = glm::mat3(1.0f));
+    };
+
+    TransformBuffer();
+
+    ~TransformBuffer();
+
+    TransformBuffer(const TransformBuffer &) = delete;
+
+    TransformBuffer &operator=(const TransformBuffer &) = delete;
+
+    // Replaces the whole content, the old storage is orphaned so the GPU never has to be waited for.
+    void upload(std::span<const Transform> transforms, GLenum usage);
+
+    // Reads the transforms from the ring buffer, where they are written for the current frame only: no storage is
+    // allocated and the driver copies nothing. Without glTexBufferRange, they are uploaded instead.
+    void stream(RingBuffer &ring, std::span<const Transform> transforms);
+
+    void bind() const;
+
+private:
+    GLuint m_buffer{}, m_texture{};
+    bool m_streamed = false; // the texture reads a range of a ring buffer instead of m_buffer
+};
+
+// Draw whose instances are chosen on the GPU. The command, a DrawElementsIndirectCommand, is read from a
+// GL_DRAW_INDIRECT_BUFFER. Instance i of the draw uses the transform stored at first + i in an R32I buffer texture.
+struct IndirectDraw {
+    GLuint commands = 0;
+    GLintptr offset = 0;
+    GLuint instanceIndices = 0;
+    std::uint32_t first = 0;
+};
+
+struct DrawPacket {
+    RenderPass pass = RenderPass::Opaque;
+    Shader *shader = nullptr;
+    const TextureSet *textures = nullptr;
+    GLuint vao = 0;
+    // Positions only, at location 0, with the same indices: opaque packets having one are drawn in the depth pre-pass.
+    GLuint depthVao = 0;
+    GLenum mode = GL_TRIANGLES;
+    GLsizei count = 0;
+    bool indexed = false;
+    GLuint firstIndex = 0;
+    GLint baseVertex = 0;
+    // The VAO feeds INSTANCE_ATTRIBUTE: consecutive opaque packets with the same state become a single multi-draw.
+    bool mergeable = false;
+    // Instances use consecutive transforms, starting at the index returned by RenderQueue::addTransform.
+    std::uint32_t transform = 0;
+    // Transforms read from this buffer instead of the queue's, for instance data that is not rebuilt every frame.
+    const TransformBuffer *transforms = nullptr;
+    GLsizei instances = 1;
+    // Indexed draws only. Replaces transform and instances when commands is set.
+    IndirectDraw indirect;
+    glm::vec3 color{}; // light color
+};
+
+struct RenderStats {
+    int packets = 0;
+    int drawCalls = 0;
+    int prepassDrawCalls = 0; // included in drawCalls
+    int multiDraws = 0; // draw calls made of several packets
+    int instances = 0;
+    int programChanges = 0;
+    int textureChanges = 0;
+    int vaoChanges = 0;
+    int transparentInstances = 0;
+    double sortMilliseconds = 0.0; // back to front order of the transparent instances
+};
+
+struct SortItem {
+    std::uint64_t key;
+    std::uint32_t index;
+};
+
+// Stable LSD radix sort on the 64-bit keys, byte by byte. Bytes shared by every key are skipped.
+void radixSort(std::vector<SortItem> &items, std::vector<SortItem> &scratch);
+
+// Key layout, most significant bits first: pass (4) | program (8) | texture set (16) | vao (16) | depth, front to
+// back (20). Transparent instances are sorted on their own, see RenderQueue::submitTransparent.
+std::uint64_t makeSortKey(RenderPass pass, GLuint program, std::uint32_t textures, GLuint vao, float depth);
+
+class RenderQueue {
+public:
+    RenderQueue();
+
+    ~RenderQueue();
+
+    RenderQueue(const RenderQueue &) = delete;
+
+    RenderQueue &operator=(const RenderQueue &) = delete;
+
+    // Clears the previous frame. Depth in sort keys is the distance to viewPos divided by far.
+    void begin(const glm::vec3 &viewPos, float far);
+
+    // Transforms added one after another are consecutive, so that they can be drawn as instances of one packet.
+    std::uint32_t addTransform(const glm::mat4 &model, const glm::mat3 &normalMatrix = glm::mat3(1.0f));
+
+    void submit(const DrawPacket &packet);
+
+    // Packets reading an external transform buffer give the position their depth is sorted by.
+    void submit(const DrawPacket &packet, const glm::vec3 &position);
+
+    // Transparent instances are drawn after everything else, blended from back to front. Each one is sorted on its
+    // own, by the distance of its position to the view: instances of a packet are interleaved with the others. Every
+    // instance of the packet needs a position. With weighted blended transparency, nothing is sorted and positions
+    // are ignored.
+    void submitTransparent(const DrawPacket &packet, std::span<const glm::vec3> positions);
+
+    // Runs before the packets of the pass, even if it has none, typically to dispatch GPU work their draws depend on.
+    // GL state changed by the callback is not restored, the queue binds everything again afterwards.
+    void addCallback(RenderPass pass, std::function<void()> callback);
+
+    // Uploads the transforms, sorts the packets and draws them, changing GL state only when the next packet needs it.
+    void execute();
+
+    // Multi-draw indirect needs OpenGL 4.3, without it every packet is a draw call.
+    [[nodiscard]] static bool isMultiDrawSupported();
+
+    void setMultiDraw(const bool multiDraw) { m_multiDraw = multiDraw && isMultiDrawSupported(); }
+
+    // Transforms of the frame are written into this ring buffer when set, between its beginFrame and endFrame. Draws
+    // then only differ by the index of their first transform.
+    void setRingBuffer(RingBuffer *const ring) { m_ring = ring; }
+
+    // Opaque packets with a depth VAO are first drawn with this program, depth only, when set. They are then shaded
+    // with GL_EQUAL without writing the depth: covered fragments are never shaded. The program must include
+    // transforms.glsl and compute gl_Position exactly like the packets' programs, both declaring it invariant. Only
+    // used while depth testing is on with GL_LESS.
+    void setDepthPrepass(Shader *const shader) { m_depthPrepass = shader; }
+
+    // Transparent packets are accumulated into these targets instead of sorted, when set. Changes apply from the next
+    // call to begin.
+    void setWeightedBlended(WeightedBlendedOit *const oit) { m_nextOit = oit; }
+
+    [[nodiscard]] std::size_t getTransformCount() const { return m_transforms.size(); }
+
+    [[nodiscard]] const RenderStats &getStats() const { return m_stats; }
+
+private:
+    // Packets drawn by one glMultiDrawElementsIndirect, with their commands in m_commands.
+    struct MultiDraw {
+        std::size_t end; // past the last item
+        std::size_t firstCommand;
+    };
+
+    // What is known to be bound while drawing.
+    struct BoundState {
+        const DrawPacket *packet = nullptr;
+        const TextureSet *textures = nullptr;
+        const TransformBuffer *transforms = nullptr;
+        GLuint vao = 0;
+        GLuint instanceIndices = 0;
+        bool depthTest = true;
+        bool depthEqual = false; // shading pre-passed packets
+    };
+
+    TransformBuffer m_transformBuffer;
+    GLuint m_commandBuffer{};
+    bool m_multiDraw = false;
+    WeightedBlendedOit *m_oit = nullptr, *m_nextOit = nullptr;
+    RingBuffer *m_ring = nullptr;
+    Shader *m_depthPrepass = nullptr;
+    GLenum m_depthFunc = GL_LESS; // of the application
+    bool m_prepassed = false; // this frame
+
+    glm::vec3 m_viewPos{};
+    float m_far = 1.0f;
+
+    std::vector<DrawPacket> m_packets;
+    std::vector<TransformBuffer::Transform> m_transforms;
+    std::vector<SortItem> m_items;
+    std::vector<SortItem> m_scratch;
+    std::array<std::vector<std::function<void()> >, RENDER_PASS_COUNT> m_callbacks;
+    std::vector<DrawElementsIndirectCommand> m_commands;
+    std::vector<std::optional<MultiDraw> > m_multiDraws; // indexed like m_items, set on the first item of each
+
+    // Transparent instances: the key is the inverted squared distance, then the packet. The index is the transform.
+    std::vector<DrawPacket> m_transparentPackets;
+    std::vector<SortItem> m_transparentItems;
+    std::vector<GLint> m_sortedTransforms;
+    std::vector<glm::vec3> m_positions; // scratch, positions of packets submitted without them
+    GLuint m_sortedBuffer{}, m_sortedTexture{};
+
+    RenderStats m_stats;
+
+    void beginPass(RenderPass pass, bool depthTest) const;
+
+    // Finds the runs of packets that can be merged and writes their commands.
+    void buildMultiDraws();
+
+    // Binds what the packet needs that is not bound yet.
+    void bind(const DrawPacket &packet, BoundState &bound);
+
+    void draw(const DrawPacket &packet, GLsizei instances);
+
+    // Draws the item: a multi-draw, an indirect draw or the instances of its packet. Its state is already bound.
+    void drawItem(std::size_t item, BoundState &bound);
+
+    // Draws the depth of the pre-passed packets of the opaque pass, whose items start at first.
+    void drawDepthPrepass(std::size_t first, BoundState &bound);
+
+    // Switches between the application's depth function and GL_EQUAL without depth writes.
+    void setDepthEqual(bool depthEqual, BoundState &bound) const;
+
+    // Sorts the transparent instances and draws them.
+    void drawTransparent(BoundState &bound);
+
+    // Instances read their transform at baseInstance + gl_InstanceID, or in the instance index buffer at this position
+    // when they are remapped. Multi-draws read the instance from INSTANCE_ATTRIBUTE.
+    void setDrawUniforms(const DrawPacket &packet, std::uint32_t baseInstance, bool remapInstances,
+                         bool multiDraw) const;
+};
+
+#endif
@@ -0,0 +1,162 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+
+#include "RingBuffer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// Timeout of each wait for a fence, in nanoseconds, repeated until the fence is reached.
+constexpr GLuint64 WAIT_TIMEOUT = 1'000'000'000;
+
+RingBuffer::RingBuffer(const GLsizeiptr frameSize) : m_frameSize{frameSize} {
+    create();
+}
+
+RingBuffer::~RingBuffer() {
+    destroy();
+    for (const auto &[buffer, fence]: m_retired) {
+        if (fence)
+            glDeleteSync(fence);
+        glDeleteBuffers(1, &buffer);
+    }
+}
+
+void RingBuffer::beginFrame() {
+    std::erase_if(m_retired, [](const Retired &retired) {
+        if (!retired.fence || glClientWaitSync(retired.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            return false;
+        glDeleteSync(retired.fence);
+        glDeleteBuffers(1, &retired.buffer);
+        return true;
+    });
+
+    m_part = (m_part + 1) % FRAMES_IN_FLIGHT;
+    if (m_fences[m_part])
+        wait(m_fences[m_part]);
+    m_head = 0;
+    m_flushed = 0;
+}
+
+void RingBuffer::endFrame() {
+    flush();
+    m_fences[m_part] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    for (auto &retired: m_retired) {
+        if (!retired.fence)
+            retired.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    m_frameBytes = m_head;
+}
+
+RingBuffer::Allocation RingBuffer::allocate(const GLsizeiptr size, const GLsizeiptr alignment) {
+    auto offset = (m_head + alignment - 1) & ~(alignment - 1);
+    if (offset + size > m_frameSize) {
+        // The frames in flight are waited for, so that only the current one still uses the old buffer. Growing is
+        // rare, the size is kept afterwards.
+        flush();
+        for (auto &fence: m_fences) {
+            if (fence)
+                wait(fence);
+        }
+        m_retired.push_back({m_buffer, nullptr});
+        m_buffer = 0;
+        // Large enough for the whole frame next time.
+        while (m_frameSize < m_head + size)
+            m_frameSize *= 2;
+        create();
+        m_head = 0;
+        m_flushed = 0;
+        offset = 0;
+    }
+
+    const auto start = static_cast<GLintptr>(m_part) * m_frameSize + offset;
+    m_head = offset + size;
+    return {m_buffer, start, size, m_mapped + start};
+}
+
+void RingBuffer::bindRange(const GLenum target, const GLuint index, const Allocation &allocation) {
+    flush();
+    glBindBufferRange(target, index, allocation.buffer, allocation.offset, allocation.size);
+}
+
+void RingBuffer::flush() {
+    if (m_staging.empty() || m_head == m_flushed)
+        return;
+    const auto start = static_cast<GLintptr>(m_part) * m_frameSize + m_flushed;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, start, m_head - m_flushed, m_staging.data() + start);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    m_flushed = m_head;
+}
+
+GLsizeiptr RingBuffer::getUniformAlignment() {
+    static const auto alignment = [] {
+        GLint value = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &value);
+        return static_cast<GLsizeiptr>(std::max(value, 1));
+    }();
+    return alignment;
+}
+
+GLsizeiptr RingBuffer::getTextureAlignment() {
+    static const auto alignment = [] {
+        GLint value = 0;
+        glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &value);
+        return static_cast<GLsizeiptr>(std::max(value, 1));
+    }();
+    return alignment;
+}
+
+bool RingBuffer::isTextureRangeSupported() {
+    return GLAD_GL_VERSION_4_3 != 0;
+}
+
+bool RingBuffer::isPersistentSupported() {
+    return GLAD_GL_VERSION_4_4 != 0;
+}
+
+void RingBuffer::create() {
+    const auto size = m_frameSize * FRAMES_IN_FLIGHT;
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    if (isPersistentSupported()) {
+        constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+        m_mapped = static_cast<std::byte *>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+        if (!m_mapped) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            throw std::runtime_error("Failed to map the frame ring buffer");
+        }
+    } else {
+        glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+        m_staging.assign(static_cast<std::size_t>(size), std::byte{0});
+        m_mapped = m_staging.data();
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void RingBuffer::destroy() {
+    for (auto &fence: m_fences) {
+        if (fence) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+    // Deleting the buffer unmaps it.
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+    m_mapped = nullptr;
+}
+
+void RingBuffer::wait(GLsync &fence) {
+    auto status = glClientWaitSync(fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        m_stalls++;
+        // The commands up to the fence may not even be submitted yet.
+        do {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, WAIT_TIMEOUT);
+        } while (status == GL_TIMEOUT_EXPIRED);
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+}
@@ -0,0 +1,129 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <vector>
+
+// Uniform buffer binding of the FrameConstants, declared by frame.glsl.
+constexpr GLuint FRAME_BLOCK_BINDING = 0;
+
+// Constants of the camera, shared by every program drawing with it. Layout of the std140 block of frame.glsl.
+struct FrameConstants {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::mat4 inverseViewProjection;
+    glm::vec4 viewPos; // w unused
+};
+
+// Per-frame GPU data, written by the CPU straight into a buffer and read by the draws of the same frame. The buffer is
+// split into one part per frame in flight, used in turns: a fence is placed after the draws of each frame, and the
+// part is only written again once the GPU passed it. Nothing is copied by the driver and nothing written is overwritten
+// while still read.
+//
+// With OpenGL 4.4, the buffer is allocated with glBufferStorage and stays mapped, persistent and coherent: writes are
+// seen by the GPU without any call. Without it, writes go to a copy in memory and the part not uploaded yet is sent
+// with glBufferSubData before each binding.
+class RingBuffer {
+public:
+    // Part of the buffer allocated to the current frame.
+    struct Allocation {
+        GLuint buffer = 0;
+        GLintptr offset = 0;
+        GLsizeiptr size = 0;
+        std::byte *data = nullptr; // to be written right away, before the next allocation
+    };
+
+    static constexpr int FRAMES_IN_FLIGHT = 3;
+
+    // Each frame starts with frameSize bytes, doubled whenever a frame needs more.
+    explicit RingBuffer(GLsizeiptr frameSize);
+
+    ~RingBuffer();
+
+    RingBuffer(const RingBuffer &) = delete;
+
+    RingBuffer &operator=(const RingBuffer &) = delete;
+
+    // Moves to the part of the next frame, waiting for the GPU if it still reads what was written there
+    // FRAMES_IN_FLIGHT frames ago.
+    void beginFrame();
+
+    // Fences the draws of the frame, to be called once they are all issued.
+    void endFrame();
+
+    // Offsets are multiples of the alignment, which must be a power of two.
+    [[nodiscard]] Allocation allocate(GLsizeiptr size, GLsizeiptr alignment);
+
+    template<typename T>
+    Allocation write(std::span<const T> values, const GLsizeiptr alignment) {
+        const auto allocation = allocate(static_cast<GLsizeiptr>(values.size_bytes()), alignment);
+        std::memcpy(allocation.data, values.data(), values.size_bytes());
+        return allocation;
+    }
+
+    template<typename T>
+    Allocation write(const T &value, const GLsizeiptr alignment) {
+        return write(std::span<const T>(&value, 1), alignment);
+    }
+
+    // Binds the allocation to an indexed target such as GL_UNIFORM_BUFFER, with glBindBufferRange.
+    void bindRange(GLenum target, GLuint index, const Allocation &allocation);
+
+    // Uploads what was written since the last flush. Only needed without persistent mapping, before the buffer is read
+    // through something else than bindRange.
+    void flush();
+
+    // Offset alignment of GL_UNIFORM_BUFFER ranges.
+    [[nodiscard]] static GLsizeiptr getUniformAlignment();
+
+    // Offset alignment of the ranges read by buffer textures, with glTexBufferRange.
+    [[nodiscard]] static GLsizeiptr getTextureAlignment();
+
+    // Buffer textures can read a range of the ring with OpenGL 4.3.
+    [[nodiscard]] static bool isTextureRangeSupported();
+
+    [[nodiscard]] static bool isPersistentSupported();
+
+    // Bytes allocated by the previous frame, out of getFrameSize().
+    [[nodiscard]] GLsizeiptr getFrameBytes() const { return m_frameBytes; }
+
+    [[nodiscard]] GLsizeiptr getFrameSize() const { return m_frameSize; }
+
+    // Frames that had to wait for the GPU to be done with their part.
+    [[nodiscard]] int getStalls() const { return m_stalls; }
+
+private:
+    GLuint m_buffer{};
+    std::byte *m_mapped = nullptr; // start of the buffer, or of m_staging without persistent mapping
+    std::vector<std::byte> m_staging;
+    GLsizeiptr m_frameSize;
+    std::array<GLsync, FRAMES_IN_FLIGHT> m_fences{};
+    int m_part = 0; // of the current frame
+    GLsizeiptr m_head = 0; // next free byte of the part
+    GLsizeiptr m_flushed = 0; // without persistent mapping, bytes of the part uploaded
+    GLsizeiptr m_frameBytes = 0; // allocated by the previous frame
+    int m_stalls = 0; // frames that waited for the GPU
+
+    // Buffers replaced by a larger one, deleted once every frame that used them is done.
+    struct Retired {
+        GLuint buffer;
+        GLsync fence;
+    };
+    std::vector<Retired> m_retired;
+
+    void create();
+
+    void destroy();
+
+    // Waits for the fence and deletes it.
+    void wait(GLsync &fence);
+};
+
+#endif
@@ -2,79 +2,293 @@
 #include <dbg.h>
 #include <fmt/format.h>
 #include <glm/gtc/type_ptr.hpp>
+#include <GLFW/glfw3.h>
+#include <imgui.h>
 
 #include "Light.h"
 #include "Shader.h"
+#include "utils.h"
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <ranges>
 #include <sstream>
 #include <stdexcept>
 
-Shader::Shader(const std::string &vertexPath, const std::string &fragmentPath): m_programId{0} {
-    const std::string vertexSource = readFile(vertexPath);
-    const std::string fragmentSource = readFile(fragmentPath);
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
-    m_programId = glCreateProgram();
+// KHR_parallel_shader_compile is not part of the generated loader.
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
-    if (const auto vertexShader = compile(vertexSource, GL_VERTEX_SHADER); vertexShader != 0) {
-        glAttachShader(m_programId, vertexShader);
-        glDeleteShader(vertexShader);
+using MaxShaderCompilerThreadsProc = void (APIENTRYP)(GLuint count);
+
+Shader::Shader(const std::string &vertexPath, const std::string &fragmentPath, const Build build)
+    : m_vertexPath{vertexPath}, m_fragmentPath{fragmentPath}, m_linked{false}, m_strict{true} {
+    m_program = submit(m_sources);
+
+    if (build == Build::Immediate) {
+        finalize();
     }
+}
+
+Shader::Shader(const std::string &computePath, const Build build)
+    : m_computePath{computePath}, m_linked{false}, m_strict{true} {
+    m_program = submit(m_sources);
 
-    if (const auto fragmentShader = compile(fragmentSource, GL_FRAGMENT_SHADER); fragmentShader != 0) {
-        glAttachShader(m_programId, fragmentShader);
-        glDeleteShader(fragmentShader);
+    if (build == Build::Immediate) {
+        finalize();
     }
+}
 
-    glLinkProgram(m_programId);
-    int success;
-    glGetProgramiv(m_programId, GL_LINK_STATUS, &success);
-    if (!success) {
-        char message[512];
-        glGetProgramInfoLog(m_programId, 512, nullptr, message);
-        auto str = fmt::format("Could not link shader program:\n{}", message);
-        throw std::runtime_error(str);
+Shader::~Shader() {
+    for (auto *program: {&m_program, &m_reload}) {
+        releaseShaders(*program);
+        if (program->id != 0)
+            glDeleteProgram(program->id);
+    }
+}
+
+bool Shader::poll() {
+    if (!m_linked && parallelCompileSupported() && isComplete(m_program)) {
+        finalize();
+    }
+    return m_linked;
+}
+
+void Shader::finalize() {
+    if (m_linked)
+        return;
+
+    const auto error = linkError(m_program);
+    releaseShaders(m_program);
+    if (!error.empty()) {
+        throw std::runtime_error(error);
     }
+    m_linked = true;
+}
+
+bool Shader::dependsOn(const std::string &path) const {
+    return std::ranges::find(m_sources, path) != m_sources.end();
+}
+
+void Shader::reload() {
+    std::vector<std::string> sources;
+    auto program = submit(sources);
+
+    // A newer edit supersedes a build that has not finished yet.
+    releaseShaders(m_reload);
+    if (m_reload.id != 0)
+        glDeleteProgram(m_reload.id);
+
+    m_reload = program;
+    m_reloadSources = std::move(sources);
+}
+
+bool Shader::pollReload() {
+    if (m_reload.id == 0)
+        return false;
+    // Without completion queries the check below stalls, which is acceptable right after an edit.
+    if (parallelCompileSupported() && !isComplete(m_reload))
+        return false;
+
+    auto error = linkError(m_reload);
+    releaseShaders(m_reload);
+
+    // Resolve every uniform the current program has been asked for, so the names used by callers stay valid.
+    std::unordered_map<std::string, GLint> locations;
+    for (const auto &name: m_uniformLocationCache | std::views::keys) {
+        if (!error.empty())
+            break;
+        const auto loc = glGetUniformLocation(m_reload.id, name.c_str());
+        if (loc == -1 && m_strict)
+            error = fmt::format("Uniform '{}' not found in reloaded shader program", name);
+        locations[name] = loc;
+    }
+
+    if (!error.empty()) {
+        glDeleteProgram(m_reload.id);
+        m_reload = {};
+        throw std::runtime_error(error);
+    }
+
+    glDeleteProgram(m_program.id);
+    m_program = m_reload;
+    m_reload = {};
+    m_sources = std::move(m_reloadSources);
+    m_uniformLocationCache = std::move(locations);
+    // The new program starts with default uniform values.
+    m_shadow.clear();
+    m_blockBindings.clear();
+    m_linked = true;
+    return true;
 }
 
 void Shader::use() const {
-    glUseProgram(m_programId);
+    glUseProgram(m_program.id);
 }
 
 void Shader::setBool(const std::string &name, const bool value) {
     const auto loc = getUniformLocation(name);
-    glUniform1i(loc, value);
+    if (const int stored = value; changed(loc, &stored, sizeof(stored)))
+        glUniform1i(loc, value);
 }
 
 void Shader::setInt(const std::string &name, const int value) {
     const auto loc = getUniformLocation(name);
-    glUniform1i(loc, value);
+    if (changed(loc, &value, sizeof(value)))
+        glUniform1i(loc, value);
 }
 
 void Shader::setFloat(const std::string &name, const float value) {
     const auto loc = getUniformLocation(name);
-    glUniform1f(loc, value);
+    if (changed(loc, &value, sizeof(value)))
+        glUniform1f(loc, value);
+}
+
+void Shader::setVec2(const std::string &name, const glm::vec2 &value) {
+    const auto loc = getUniformLocation(name);
+    if (changed(loc, glm::value_ptr(value), sizeof(value)))
+        glUniform2fv(loc, 1, glm::value_ptr(value));
 }
 
 void Shader::setVec3(const std::string &name, const glm::vec3 &value) {
     const auto loc = getUniformLocation(name);
-    glUniform3fv(loc, 1, glm::value_ptr(value));
+    if (changed(loc, glm::value_ptr(value), sizeof(value)))
+        glUniform3fv(loc, 1, glm::value_ptr(value));
 }
 
 void Shader::setVec4(const std::string &name, const glm::vec4 &value) {
     const auto loc = getUniformLocation(name);
-    glUniform4fv(loc, 1, glm::value_ptr(value));
+    if (changed(loc, glm::value_ptr(value), sizeof(value)))
+        glUniform4fv(loc, 1, glm::value_ptr(value));
 }
 
 void Shader::setMat3(const std::string &name, const glm::mat3 &value) {
     const auto loc = getUniformLocation(name);
-    glUniformMatrix3fv(loc, 1, GL_FALSE, glm::value_ptr(value));
+    if (changed(loc, glm::value_ptr(value), sizeof(value)))
+        glUniformMatrix3fv(loc, 1, GL_FALSE, glm::value_ptr(value));
 }
 
 void Shader::setMat4(const std::string &name, const glm::mat4 &value) {
     const auto loc = getUniformLocation(name);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(value));
+    if (changed(loc, glm::value_ptr(value), sizeof(value)))
+        glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::setBlockBinding(const std::string &name, const GLuint binding) {
+    if (const auto it = m_blockBindings.find(name); it != m_blockBindings.end() && it->second == binding) {
+        m_uploadStats.skipped++;
+        return;
+    }
+    const auto index = glGetUniformBlockIndex(m_program.id, name.c_str());
+    if (index == GL_INVALID_INDEX) {
+        if (m_strict)
+            throw std::runtime_error(fmt::format("Uniform block '{}' not found in shader program", name));
+    } else {
+        glUniformBlockBinding(m_program.id, index, binding);
+        m_uploadStats.issued++;
+    }
+    m_blockBindings[name] = binding;
+}
+
+void Shader::resetUploadStats() {
+    m_uploadStats = {};
+}
+
+bool Shader::changed(const GLint loc, const void *value, const std::size_t size) {
+    // Updates of unknown uniforms are dropped by GL anyway.
+    if (loc == -1)
+        return false;
+    auto &[data, storedSize] = m_shadow[loc];
+    if (storedSize == size && std::memcmp(data.data(), value, size) == 0) {
+        m_uploadStats.skipped++;
+        return false;
+    }
+    std::memcpy(data.data(), value, size);
+    storedSize = size;
+    m_uploadStats.issued++;
+    return true;
+}
+
+Shader::Program Shader::submit(const std::string &vertexSource, const std::string &fragmentSource) {
+    // Status is not queried here so that the driver can compile and link in the background.
+    Program program;
+    program.id = glCreateProgram();
+    program.vertexShader = compile(vertexSource, GL_VERTEX_SHADER);
+    program.fragmentShader = compile(fragmentSource, GL_FRAGMENT_SHADER);
+    glAttachShader(program.id, program.vertexShader);
+    glAttachShader(program.id, program.fragmentShader);
+    glLinkProgram(program.id);
+    return program;
+}
+
+Shader::Program Shader::submit(const std::string &computeSource) {
+    Program program;
+    program.id = glCreateProgram();
+    program.computeShader = compile(computeSource, GL_COMPUTE_SHADER);
+    glAttachShader(program.id, program.computeShader);
+    glLinkProgram(program.id);
+    return program;
+}
+
+Shader::Program Shader::submit(std::vector<std::string> &sources) const {
+    Files files;
+    if (!m_computePath.empty()) {
+        const auto computeSource = load(m_computePath, sources, files.compute);
+        auto program = submit(computeSource);
+        program.files = std::move(files);
+        return program;
+    }
+    const auto vertexSource = load(m_vertexPath, sources, files.vertex);
+    const auto fragmentSource = load(m_fragmentPath, sources, files.fragment);
+    auto program = submit(vertexSource, fragmentSource);
+    program.files = std::move(files);
+    return program;
+}
+
+bool Shader::isComplete(const Program &program) {
+    int done;
+    glGetProgramiv(program.id, GL_COMPLETION_STATUS_KHR, &done);
+    return done;
+}
+
+std::string Shader::linkError(const Program &program) {
+    int success;
+    glGetProgramiv(program.id, GL_LINK_STATUS, &success);
+    if (success)
+        return {};
+
+    // A stage that failed to compile is the usual reason for a failed link, and has the more useful log.
+    auto str = compileError(program.vertexShader, GL_VERTEX_SHADER, program.files.vertex);
+    if (str.empty())
+        str = compileError(program.fragmentShader, GL_FRAGMENT_SHADER, program.files.fragment);
+    if (str.empty())
+        str = compileError(program.computeShader, GL_COMPUTE_SHADER, program.files.compute);
+    if (str.empty()) {
+        char message[512];
+        glGetProgramInfoLog(program.id, 512, nullptr, message);
+        str = fmt::format("Could not link shader program:\n{}", message);
+    }
+    return str;
+}
+
+void Shader::releaseShaders(Program &program) {
+    for (const auto shader: {program.vertexShader, program.fragmentShader, program.computeShader}) {
+        if (shader == 0)
+            continue;
+        glDetachShader(program.id, shader);
+        glDeleteShader(shader);
+    }
+    program.vertexShader = 0;
+    program.fragmentShader = 0;
+    program.computeShader = 0;
 }
 
 GLuint Shader::compile(const std::string &source, const GLuint type) {
@@ -82,26 +296,84 @@ GLuint Shader::compile(const std::string &source, const GLuint type) {
     const char *shaderCode = source.c_str();
     glShaderSource(shader, 1, &shaderCode, nullptr);
     glCompileShader(shader);
+    return shader;
+}
 
+std::string Shader::compileError(const GLuint shader, const GLuint type, const std::vector<std::string> &files) {
+    if (shader == 0)
+        return {};
     int success;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        char message[512];
-        glGetShaderInfoLog(shader, 512, nullptr, message);
-        const auto typeStr = shaderTypeStr(type);
-        const auto str = fmt::format("Could not compile {} shader:\n{}", shaderTypeStr(type), message);
-        throw std::runtime_error(str);
+    if (success)
+        return {};
+    char message[512];
+    glGetShaderInfoLog(shader, 512, nullptr, message);
+
+    // Drivers start each line with the source string number, as in "1(12) : error" or "1:12(3): error".
+    std::istringstream stream{message};
+    std::string log;
+    std::string line;
+    while (std::getline(stream, line)) {
+        const auto digits = line.find_first_not_of("0123456789");
+        if (digits > 0 && digits != std::string::npos && (line[digits] == '(' || line[digits] == ':')) {
+            if (const auto number = std::stoul(line.substr(0, digits)); number < files.size())
+                line.replace(0, digits, files[number]);
+        }
+        log += line;
+        log += '\n';
     }
+    return fmt::format("Could not compile {} shader:\n{}", shaderTypeStr(type), log);
+}
 
-    return shader;
+std::string Shader::load(const std::string &path, std::vector<std::string> &sources,
+                         std::vector<std::string> &included) {
+    // Resolves `#include "file"` lines relative to the including file. Each file is included once per stage.
+    const auto normalized = normalize_path(path);
+    if (std::ranges::find(included, normalized) != included.end())
+        return {};
+    included.push_back(normalized);
+    if (std::ranges::find(sources, normalized) == sources.end())
+        sources.push_back(normalized);
+
+    const auto number = included.size() - 1;
+    std::istringstream stream{readFile(path)};
+    std::string result;
+    std::string line;
+    for (auto lineNumber = 1; std::getline(stream, line); ++lineNumber) {
+        const auto first = line.find_first_not_of(" \t");
+        if (first != std::string::npos && line.compare(first, 8, "#include") == 0) {
+            const auto begin = line.find('"', first);
+            const auto end = begin == std::string::npos ? begin : line.find('"', begin + 1);
+            if (end == std::string::npos) {
+                const auto str = fmt::format("Malformed include in '{}': {}", path, line);
+                throw std::runtime_error(str);
+            }
+            const auto file = join_paths(get_directory(path), line.substr(begin + 1, end - begin - 1));
+            const auto fileNumber = included.size();
+            auto source = load(file, sources, included);
+            if (included.size() == fileNumber) {
+                // Already included, the line is kept empty so that the next ones keep their number.
+                result += '\n';
+            } else {
+                // The line numbering of this file resumes after the included one.
+                result += fmt::format("#line 1 {}\n", fileNumber);
+                result += source;
+                result += fmt::format("#line {} {}\n", lineNumber + 1, number);
+            }
+        } else {
+            result += line;
+            result += '\n';
+        }
+    }
+    return result;
 }
 
-GLuint Shader::getUniformLocation(const std::string &name) {
+GLint Shader::getUniformLocation(const std::string &name) {
     if (const auto it = m_uniformLocationCache.find(name); it != m_uniformLocationCache.end()) {
         return it->second;
     } else {
-        const auto loc = glGetUniformLocation(m_programId, name.c_str());
-        if (loc == -1) {
+        const auto loc = glGetUniformLocation(m_program.id, name.c_str());
+        if (loc == -1 && m_strict) {
             const auto str = fmt::format("Uniform '{}' not found in shader program", name);
             throw std::runtime_error(str);
         }
@@ -110,6 +382,193 @@ GLuint Shader::getUniformLocation(const std::string &name) {
     }
 }
 
+ShaderManager::ShaderManager(const std::string &fallbackVertexPath, const std::string &fallbackFragmentPath)
+    : m_hotReload{true}, m_inotifyFd{-1} {
+    if (parallelCompileSupported()) {
+        auto maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(
+            glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+        if (!maxThreads)
+            maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(
+                glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+        if (maxThreads)
+            maxThreads(0xFFFFFFFF); // let the driver pick the number of threads
+    }
+
+#ifdef __linux__
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotifyFd == -1)
+        std::cerr << "Could not initialize inotify, shader hot-reload is disabled\n";
+#endif
+
+    // The fallback is drawn with whatever uniforms the pending program would have received.
+    m_fallback = std::make_unique<Shader>(fallbackVertexPath, fallbackFragmentPath);
+    m_fallback->setStrict(false);
+}
+
+ShaderManager::~ShaderManager() {
+#ifdef __linux__
+    if (m_inotifyFd != -1)
+        close(m_inotifyFd);
+#endif
+}
+
+void ShaderManager::widgets() {
+    if (ImGui::CollapsingHeader("Shaders")) {
+        ImGui::Text("Parallel compilation: %s", parallelCompileSupported() ? "yes" : "no");
+        ImGui::Checkbox("Hot reload", &m_hotReload);
+        for (const auto &[name, shader]: m_shaders) {
+            ImGui::PushID(name.c_str());
+            ImGui::BulletText("%s: %s", name.c_str(), shader->isLinked() ? "ready" : "compiling");
+            ImGui::SameLine();
+            if (ImGui::Button("Reload")) {
+                reload(name, *shader);
+            }
+            ImGui::PopID();
+        }
+    }
+}
+
+void ShaderManager::add(const std::string &name, const std::string &vertexPath, const std::string &fragmentPath) {
+    auto shader = std::make_unique<Shader>(vertexPath, fragmentPath, Shader::Build::Deferred);
+    watch(*shader);
+    m_shaders[name] = std::move(shader);
+}
+
+void ShaderManager::add(const std::string &name, const std::string &computePath) {
+    auto shader = std::make_unique<Shader>(computePath, Shader::Build::Deferred);
+    watch(*shader);
+    m_shaders[name] = std::move(shader);
+}
+
+void ShaderManager::poll() {
+    // Called at the start of a frame: what was counted so far belongs to the previous one.
+    m_uploadStats = m_fallback->getUploadStats();
+    m_fallback->resetUploadStats();
+    for (const auto &shader: m_shaders | std::views::values) {
+        const auto &[issued, skipped] = shader->getUploadStats();
+        m_uploadStats.issued += issued;
+        m_uploadStats.skipped += skipped;
+        shader->resetUploadStats();
+    }
+
+    if (m_hotReload) {
+        for (const auto &path: changedFiles()) {
+            for (const auto &[name, shader]: m_shaders) {
+                if (shader->dependsOn(path))
+                    reload(name, *shader);
+            }
+        }
+    }
+
+    // Without completion queries, checking a program stalls until it is linked: spread those stalls over frames.
+    auto blockingChecks = 1;
+    for (const auto &[name, shader]: m_shaders) {
+        try {
+            if (shader->isLinked()) {
+                if (shader->pollReload()) {
+                    std::cout << "Reloaded shader '" << name << "'\n";
+                    watch(*shader);
+                }
+            } else if (parallelCompileSupported()) {
+                shader->poll();
+            } else if (blockingChecks-- > 0) {
+                shader->finalize();
+            }
+        } catch (const std::exception &e) {
+            const auto str = fmt::format("Shader '{}': {}", name, e.what());
+            // A broken edit keeps the previous program, only the initial build is fatal.
+            if (!shader->isLinked())
+                throw std::runtime_error(str);
+            std::cerr << str << std::endl;
+        }
+    }
+}
+
+Shader *ShaderManager::get(const std::string &name) const {
+    const auto it = m_shaders.find(name);
+    if (it == m_shaders.end()) {
+        const auto str = fmt::format("Shader '{}' was never added", name);
+        throw std::runtime_error(str);
+    }
+    if (it->second->isLinked())
+        return it->second.get();
+    return it->second->isCompute() ? nullptr : m_fallback.get();
+}
+
+bool ShaderManager::isReady(const std::string &name) const {
+    const auto it = m_shaders.find(name);
+    if (it == m_shaders.end()) {
+        const auto str = fmt::format("Shader '{}' was never added", name);
+        throw std::runtime_error(str);
+    }
+    return it->second->isLinked();
+}
+
+int ShaderManager::getPendingCount() const {
+    int count = 0;
+    for (const auto &[name, shader]: m_shaders) {
+        if (!shader->isLinked())
+            count++;
+    }
+    return count;
+}
+
+void ShaderManager::watch(const Shader &shader) {
+    for (const auto &source: shader.getSources()) {
+        m_timestamps.try_emplace(source, std::filesystem::last_write_time(source));
+#ifdef __linux__
+        if (m_inotifyFd == -1)
+            continue;
+        // Editors often save by renaming a temporary file, so the directory is watched rather than the file.
+        const auto directory = get_directory(source);
+        const auto wd = inotify_add_watch(m_inotifyFd, directory.empty() ? "." : directory.c_str(),
+                                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (wd != -1)
+            m_watchedDirs[wd] = directory;
+#endif
+    }
+}
+
+std::vector<std::string> ShaderManager::changedFiles() {
+    std::vector<std::string> files;
+#ifdef __linux__
+    if (m_inotifyFd != -1) {
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(m_inotifyFd, buffer, sizeof(buffer))) > 0) {
+            for (auto ptr = buffer; ptr < buffer + length;) {
+                const auto event = reinterpret_cast<const inotify_event *>(ptr);
+                if (const auto it = m_watchedDirs.find(event->wd); it != m_watchedDirs.end() && event->len > 0) {
+                    auto path = normalize_path(join_paths(it->second, event->name));
+                    if (std::ranges::find(files, path) == files.end())
+                        files.push_back(std::move(path));
+                }
+                ptr += sizeof(inotify_event) + event->len;
+            }
+        }
+        return files;
+    }
+#endif
+    for (auto &[path, timestamp]: m_timestamps) {
+        std::error_code error;
+        const auto current = std::filesystem::last_write_time(path, error);
+        if (!error && current != timestamp) {
+            timestamp = current;
+            files.push_back(path);
+        }
+    }
+    return files;
+}
+
+void ShaderManager::reload(const std::string &name, Shader &shader) {
+    try {
+        shader.reload();
+    } catch (const std::exception &e) {
+        // The file may be caught mid-save, the next change event will retry.
+        std::cerr << fmt::format("Shader '{}': {}", name, e.what()) << std::endl;
+    }
+}
+
 std::string readFile(const std::string &path) {
     std::ifstream file;
     file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
@@ -129,7 +588,15 @@ std::string shaderTypeStr(const GLuint type) {
             return "fragment";
         case GL_GEOMETRY_SHADER:
             return "geometry";
+        case GL_COMPUTE_SHADER:
+            return "compute";
         default:
             return "unknown";
     }
 }
+
+bool parallelCompileSupported() {
+    static const bool supported = glfwExtensionSupported("GL_KHR_parallel_shader_compile") ||
+                                  glfwExtensionSupported("GL_ARB_parallel_shader_compile");
+    return supported;
+}
@@ -2,28 +2,93 @@
 #define SHADER_H
 
 #include <glad/glad.h>
+#include <glm/glm.hpp>
 
 class Light;
 
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 class Shader {
 public:
-    Shader(const std::string &vertexPath, const std::string &fragmentPath);
+    struct UploadStats {
+        std::uint64_t issued = 0;
+        std::uint64_t skipped = 0; // value already held by the program
+    };
+
+    // Immediate builds block until the program is linked and throw on failure. Deferred builds only submit the
+    // compile and link commands; call poll() or finalize() before using the program.
+    enum class Build { Immediate, Deferred };
+
+    Shader(const std::string &vertexPath, const std::string &fragmentPath, Build build = Build::Immediate);
+
+    // Compute program, requires OpenGL 4.3.
+    explicit Shader(const std::string &computePath, Build build = Build::Immediate);
+
+    ~Shader();
+
+    Shader(const Shader &) = delete;
+
+    Shader &operator=(const Shader &) = delete;
 
     void use() const;
 
     [[nodiscard]] GLuint getProgramId() const {
-        return m_programId;
+        return m_program.id;
+    }
+
+    [[nodiscard]] bool isLinked() const {
+        return m_linked;
+    }
+
+    [[nodiscard]] bool isCompute() const {
+        return !m_computePath.empty();
+    }
+
+    // Returns true once the program is linked. Never stalls: without driver support for completion queries the
+    // program stays pending until finalize() is called.
+    bool poll();
+
+    // Blocks until the program is linked, throws if compilation or linking failed.
+    void finalize();
+
+    // Every file the program was built from, including the ones pulled in with #include.
+    [[nodiscard]] const std::vector<std::string> &getSources() const {
+        return m_sources;
     }
 
+    [[nodiscard]] bool dependsOn(const std::string &path) const;
+
+    // Rebuilds the program from disk in the background, the current program stays in use until the new one is
+    // linked. Throws if a source file cannot be read.
+    void reload();
+
+    // Swaps in the reloaded program once it is linked and returns true. If the new program does not build, it is
+    // discarded, the current one is kept and an exception is thrown.
+    bool pollReload();
+
+    // When not strict, unknown uniforms resolve to -1 and their updates are silently dropped by GL.
+    void setStrict(const bool strict) { m_strict = strict; }
+
+    [[nodiscard]] const UploadStats &getUploadStats() const { return m_uploadStats; }
+
+    void resetUploadStats();
+
+    // Uniform updates are skipped when the program already holds the value. The setters expect this program to be
+    // in use, as glUniform* applies to the current program.
     void setBool(const std::string &name, bool value);
 
     void setInt(const std::string &name, int value);
 
     void setFloat(const std::string &name, float value);
 
+    void setVec2(const std::string &name, const glm::vec2 &value);
+
     void setVec3(const std::string &name, const glm::vec3 &value);
 
     void setVec4(const std::string &name, const glm::vec4 &value);
@@ -32,18 +97,126 @@ public:
 
     void setMat4(const std::string &name, const glm::mat4 &value);
 
+    // Reads the uniform block from the buffer bound to this uniform buffer binding. Unlike the setters above, it does
+    // not need the program to be in use.
+    void setBlockBinding(const std::string &name, GLuint binding);
+
 private:
-    GLuint m_programId;
+    // Files of each stage, indexed by the source string number of their #line directives.
+    struct Files {
+        std::vector<std::string> vertex;
+        std::vector<std::string> fragment;
+        std::vector<std::string> compute;
+    };
+
+    struct Program {
+        GLuint id{0};
+        GLuint vertexShader{0};
+        GLuint fragmentShader{0};
+        GLuint computeShader{0};
+        Files files;
+    };
+
+    std::string m_vertexPath;
+    std::string m_fragmentPath;
+    std::string m_computePath; // set for compute programs only
+    std::vector<std::string> m_sources;
+    Program m_program;
+    Program m_reload;
+    std::vector<std::string> m_reloadSources;
+    bool m_linked;
+    bool m_strict;
+
+    static Program submit(const std::string &vertexSource, const std::string &fragmentSource);
+
+    static Program submit(const std::string &computeSource);
+
+    // Loads the sources of every stage and submits them.
+    [[nodiscard]] Program submit(std::vector<std::string> &sources) const;
+
+    static bool isComplete(const Program &program);
+
+    static std::string linkError(const Program &program);
+
+    static void releaseShaders(Program &program);
 
     static GLuint compile(const std::string &source, GLuint type);
 
-    GLuint getUniformLocation(const std::string &name);
+    // Source string numbers at the start of the log lines are replaced by the names of the files.
+    static std::string compileError(GLuint shader, GLuint type, const std::vector<std::string> &files);
+
+    // Included files are preceded by #line directives giving their own line numbers, the source string number being
+    // the index of the file in `included`.
+    static std::string load(const std::string &path, std::vector<std::string> &sources,
+                            std::vector<std::string> &included);
+
+    GLint getUniformLocation(const std::string &name);
+
+    // Returns true if the value differs from the last one uploaded at this location, and records it.
+    bool changed(GLint loc, const void *value, std::size_t size);
+
+    struct ShadowValue {
+        std::array<std::byte, sizeof(glm::mat4)> data{};
+        std::size_t size = 0;
+    };
 
     std::unordered_map<std::string, GLint> m_uniformLocationCache;
+    std::unordered_map<GLint, ShadowValue> m_shadow;
+    std::unordered_map<std::string, GLuint> m_blockBindings;
+    UploadStats m_uploadStats;
+};
+
+class ShaderManager {
+public:
+    ShaderManager(const std::string &fallbackVertexPath, const std::string &fallbackFragmentPath);
+
+    ~ShaderManager();
+
+    void widgets();
+
+    // Submits a program for compilation without waiting for it. Until it is linked, get() returns the fallback.
+    void add(const std::string &name, const std::string &vertexPath, const std::string &fragmentPath);
+
+    // Compute program, requires OpenGL 4.3. Nothing can stand in for it: get() returns nullptr until it is linked.
+    void add(const std::string &name, const std::string &computePath);
+
+    // Checks pending programs and reloads the ones whose sources changed, to be called once per frame.
+    void poll();
+
+    [[nodiscard]] Shader *get(const std::string &name) const;
+
+    // The program is linked: get() returns it rather than the fallback. Passes the fallback cannot stand in for check
+    // this first.
+    [[nodiscard]] bool isReady(const std::string &name) const;
+
+    [[nodiscard]] int getPendingCount() const;
+
+    // Uniform uploads of all programs during the previous frame.
+    [[nodiscard]] const Shader::UploadStats &getUploadStats() const { return m_uploadStats; }
+
+private:
+    std::unordered_map<std::string, std::unique_ptr<Shader> > m_shaders;
+    std::unique_ptr<Shader> m_fallback;
+    Shader::UploadStats m_uploadStats;
+    bool m_hotReload;
+
+    // inotify instance and the directory of each watch descriptor (Linux).
+    int m_inotifyFd;
+    std::unordered_map<int, std::string> m_watchedDirs;
+    // Last modification times, used to detect changes on other platforms.
+    std::unordered_map<std::string, std::filesystem::file_time_type> m_timestamps;
+
+    void watch(const Shader &shader);
+
+    std::vector<std::string> changedFiles();
+
+    void reload(const std::string &name, Shader &shader);
 };
 
 std::string readFile(const std::string &path);
 
 std::string shaderTypeStr(GLuint type);
 
+bool parallelCompileSupported();
+
 #endif
@@ -0,0 +1,736 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+#include <fmt/format.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <imgui.h>
+
+#include "Shadows.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <tuple>
+
+// Cascades past the first move by this many texels at once, and are made larger by as much.
+constexpr int SNAP_TEXELS = 128;
+
+// Cube faces in the order read by shadows.glsl: +x, -x, +y, -y, +z, -z.
+constexpr std::array<std::pair<glm::vec3, glm::vec3>, 6> CUBE_FACES = {
+    {
+        {{1.0f, 0.0f, 0.0f}, {0.0f, -1.0f, 0.0f}}, {{-1.0f, 0.0f, 0.0f}, {0.0f, -1.0f, 0.0f}},
+        {{0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}}, {{0.0f, -1.0f, 0.0f}, {0.0f, 0.0f, -1.0f}},
+        {{0.0f, 0.0f, 1.0f}, {0.0f, -1.0f, 0.0f}}, {{0.0f, 0.0f, -1.0f}, {0.0f, -1.0f, 0.0f}}
+    }
+};
+
+// Texels per view in the buffer read by shadows.glsl.
+constexpr int VIEW_TEXELS = 6;
+
+// Depth comparisons filtered by the hardware, 2x2 texels per lookup.
+static void setShadowSampling(const GLenum target) {
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+}
+
+// State shared by the shadow passes, restored when they are done.
+struct SavedState {
+    GLint framebuffer, viewport[4], polygonMode[2], depthFunc;
+    bool depthTest;
+
+    SavedState() {
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+        glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+        depthTest = glIsEnabled(GL_DEPTH_TEST);
+    }
+
+    void restore() const {
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(framebuffer));
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        glPolygonMode(GL_FRONT_AND_BACK, static_cast<GLenum>(polygonMode[0]));
+        glDepthFunc(static_cast<GLenum>(depthFunc));
+        depthTest ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST);
+    }
+};
+
+// Depth only, filled even in wireframe, and pushed back against acne.
+static void beginDepthPass(Shader &shader, const GLuint framebuffer) {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(1.5f, 2.0f);
+    shader.use();
+    shader.setInt("transforms", TRANSFORM_UNIT);
+    shader.setInt("instanceIndices", INSTANCE_INDEX_UNIT);
+    shader.setBool("multiDraw", false);
+    shader.setBool("remapInstances", false);
+}
+
+std::uint64_t hashBytes(const void *const data, const std::size_t size, std::uint64_t seed) {
+    const auto bytes = static_cast<const unsigned char *>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        seed = (seed ^ bytes[i]) * 1099511628211ull;
+    }
+    return seed;
+}
+
+TimerQuery::TimerQuery() {
+    glGenQueries(1, &m_query);
+}
+
+TimerQuery::~TimerQuery() {
+    glDeleteQueries(1, &m_query);
+}
+
+void TimerQuery::begin() {
+    if (m_pending)
+        return;
+    glBeginQuery(GL_TIME_ELAPSED, m_query);
+    m_running = true;
+}
+
+void TimerQuery::end() {
+    if (!m_running)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    m_running = false;
+    m_pending = true;
+}
+
+void TimerQuery::poll() {
+    if (!m_pending)
+        return;
+    GLint available = 0;
+    glGetQueryObjectiv(m_query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return;
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(m_query, GL_QUERY_RESULT, &nanoseconds);
+    m_milliseconds = static_cast<double>(nanoseconds) / 1e6;
+    m_pending = false;
+}
+
+void ShadowCasters::clear() {
+    m_casters.clear();
+    m_transforms.clear();
+}
+
+void ShadowCasters::add(const GLuint vao, const GLsizei count, const GLuint firstIndex, const GLint baseVertex,
+                        const glm::mat4 &model, const AABB &bounds) {
+    m_casters.push_back({vao, count, firstIndex, baseVertex, static_cast<std::uint32_t>(m_transforms.size()), bounds});
+    m_transforms.emplace_back(model);
+}
+
+std::uint64_t ShadowCasters::hash(std::uint64_t seed) const {
+    for (const auto &caster: m_casters) {
+        const std::array<std::uint32_t, 4> draw = {
+            caster.vao, static_cast<std::uint32_t>(caster.count), caster.firstIndex,
+            static_cast<std::uint32_t>(caster.baseVertex)
+        };
+        seed = hashBytes(draw.data(), sizeof(draw), seed);
+        seed = hashBytes(&m_transforms[caster.transform].model, sizeof(glm::mat4), seed);
+    }
+    return seed;
+}
+
+int ShadowCasters::draw(Shader &shader, TransformBuffer &transforms, RingBuffer &ring, const Frustum *const frustum) {
+    m_drawn.clear();
+    for (const auto &caster: m_casters) {
+        if (!frustum || frustum->intersects(caster.bounds))
+            m_drawn.push_back(&caster);
+    }
+    if (m_drawn.empty())
+        return 0;
+
+    // Transforms of the instances of a mesh are made consecutive.
+    const auto key = [](const Caster *caster) {
+        return std::tuple{caster->vao, caster->firstIndex, caster->baseVertex, caster->count};
+    };
+    std::ranges::sort(m_drawn, {}, key);
+    m_sortedTransforms.clear();
+    for (const auto caster: m_drawn) {
+        m_sortedTransforms.push_back(m_transforms[caster->transform]);
+    }
+    transforms.stream(ring, m_sortedTransforms);
+    transforms.bind();
+
+    GLuint vao = 0;
+    for (std::size_t first = 0; first < m_drawn.size();) {
+        auto end = first + 1;
+        while (end < m_drawn.size() && key(m_drawn[end]) == key(m_drawn[first])) {
+            end++;
+        }
+        const auto &caster = *m_drawn[first];
+        if (caster.vao != vao) {
+            glBindVertexArray(caster.vao);
+            vao = caster.vao;
+        }
+        shader.setInt("baseInstance", static_cast<int>(first));
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, caster.count, GL_UNSIGNED_INT,
+                                          reinterpret_cast<const void *>(caster.firstIndex * sizeof(GLuint)),
+                                          static_cast<GLsizei>(end - first), caster.baseVertex);
+        first = end;
+    }
+    return static_cast<int>(m_drawn.size());
+}
+
+ShadowCascades::ShadowCascades() {
+    glGenFramebuffers(1, &m_framebuffer);
+    GLint framebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(framebuffer));
+    resize(m_size);
+}
+
+ShadowCascades::~ShadowCascades() {
+    glDeleteTextures(1, &m_depthMaps);
+    glDeleteFramebuffers(1, &m_framebuffer);
+}
+
+void ShadowCascades::widgets() {
+    if (ImGui::CollapsingHeader("Shadows")) {
+        ImGui::Checkbox("Enabled##shadows", &m_enabled);
+        constexpr std::array sizes = {512, 1024, 2048, 4096};
+        constexpr std::array sizeNames = {"512", "1024", "2048", "4096"};
+        auto size = static_cast<int>(std::ranges::find(sizes, m_size) - sizes.begin());
+        if (ImGui::Combo("Map size", &size, sizeNames.data(), sizeNames.size()))
+            resize(sizes[size]);
+        ImGui::DragFloat("Distance##shadows", &m_distance, 1.0f, 1.0f, 500.0f);
+        ImGui::SliderFloat("Split lambda", &m_splitLambda, 0.0f, 1.0f);
+        ImGui::DragFloat("Caster distance", &m_casterDistance, 1.0f, 0.0f, 1000.0f);
+        for (auto i = 1; i < CASCADES; ++i) {
+            ImGui::SliderInt(fmt::format("Cascade {} interval", i).c_str(), &m_intervals[i], 1, 16);
+        }
+        ImGui::SliderFloat("Normal offset", &m_normalOffset, 0.0f, 4.0f, "%.1f texels");
+        ImGui::DragFloat("Bias", &m_bias, 0.0001f, 0.0f, 0.01f, "%.4f");
+    }
+}
+
+void ShadowCascades::update(const LightManager &lights, const glm::mat4 &view, const float fovY, const float aspect,
+                            const float near, const float far) {
+    m_frame++;
+    for (auto &cascade: m_cascades) {
+        cascade.casters.clear();
+    }
+    for (auto &stats: m_stats) {
+        stats.casters = -1;
+        stats.rendered = false;
+    }
+
+    const Light *caster = nullptr;
+    lights.forEachActive([&caster](const Light &light) {
+        if (!caster && light.getType() == Light::Type::Directional)
+            caster = &light;
+    });
+    m_hasLight = caster != nullptr;
+    if (!isEnabled())
+        return;
+
+    // Practical split scheme: a blend of uniform and logarithmic splits.
+    const auto distance = std::min(m_distance, far);
+    std::array<float, CASCADES + 1> splits{};
+    for (auto i = 0; i <= CASCADES; ++i) {
+        const auto t = static_cast<float>(i) / CASCADES;
+        splits[i] = m_splitLambda * near * std::pow(distance / near, t) + (1.0f - m_splitLambda) * (near +
+                        (distance - near) * t);
+    }
+
+    const auto tanY = std::tan(glm::radians(fovY) * 0.5f);
+    const auto direction = glm::normalize(static_cast<const DirectionalLight *>(caster)->getDirection());
+    const auto inverseView = glm::inverse(view);
+    for (auto i = 0; i < CASCADES; ++i) {
+        fit(i, direction, inverseView, tanY * aspect, tanY, splits[i], splits[i + 1]);
+    }
+}
+
+bool ShadowCascades::isDue(const int cascade) const {
+    // Intervals are staggered, so that cascades sharing one are not checked in the same frame.
+    return isEnabled() && (m_cascades[cascade].hash == 0 || (m_frame + cascade) % m_intervals[cascade] == 0);
+}
+
+void ShadowCascades::addCaster(const int cascade, const GLuint vao, const GLsizei count, const GLuint firstIndex,
+                               const GLint baseVertex, const glm::mat4 &model, const AABB &bounds) {
+    m_cascades[cascade].casters.add(vao, count, firstIndex, baseVertex, model, bounds);
+}
+
+void ShadowCascades::render(Shader *const depthShader, RingBuffer &ring) {
+    for (auto i = 0; i < CASCADES; ++i) {
+        m_cascades[i].timer.poll();
+        m_stats[i].gpuMilliseconds = m_cascades[i].timer.getMilliseconds();
+    }
+    if (!isEnabled() || !depthShader)
+        return;
+
+    std::optional<SavedState> saved;
+    for (auto i = 0; i < CASCADES; ++i) {
+        if (!isDue(i))
+            continue;
+        auto &cascade = m_cascades[i];
+        m_stats[i].casters = static_cast<int>(cascade.casters.size());
+        // A cascade drawn with the same view and casters is still valid.
+        const auto hash = std::max<std::uint64_t>(
+            cascade.casters.hash(hashBytes(&cascade.nextViewProjection, sizeof(glm::mat4))), 1);
+        if (hash == cascade.hash)
+            continue;
+
+        if (!saved) {
+            saved.emplace();
+            beginDepthPass(*depthShader, m_framebuffer);
+            glViewport(0, 0, m_size, m_size);
+            glEnable(GL_DEPTH_CLAMP);
+        }
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_depthMaps, 0, i);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        cascade.timer.begin();
+        depthShader->setMat4("lightViewProjection", cascade.nextViewProjection);
+        cascade.casters.draw(*depthShader, m_transforms, ring, nullptr);
+        cascade.timer.end();
+
+        cascade.viewProjection = cascade.nextViewProjection;
+        cascade.texelSize = cascade.nextTexelSize;
+        cascade.hash = hash;
+        m_stats[i].rendered = true;
+    }
+
+    if (saved) {
+        glDisable(GL_DEPTH_CLAMP);
+        saved->restore();
+    }
+}
+
+void ShadowCascades::bind(Shader *const shader) const {
+    glActiveTexture(GL_TEXTURE0 + SHADOW_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_depthMaps);
+    shader->setInt("shadowMap", SHADOW_UNIT);
+    shader->setBool("shadows", isEnabled());
+    for (auto i = 0; i < CASCADES; ++i) {
+        shader->setMat4(fmt::format("shadowMatrices[{}]", i), m_cascades[i].viewProjection);
+        shader->setFloat(fmt::format("shadowOffsets[{}]", i), m_cascades[i].texelSize * m_normalOffset);
+    }
+    shader->setFloat("shadowBias", m_bias);
+}
+
+void ShadowCascades::resize(const int size) {
+    m_size = size;
+    glDeleteTextures(1, &m_depthMaps);
+    glGenTextures(1, &m_depthMaps);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_depthMaps);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, size, size, CASCADES, 0, GL_DEPTH_COMPONENT,
+                 GL_FLOAT, nullptr);
+    setShadowSampling(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    for (auto &cascade: m_cascades) {
+        cascade.hash = 0;
+    }
+}
+
+void ShadowCascades::fit(const int cascade, const glm::vec3 &direction, const glm::mat4 &inverseView,
+                         const float tanX, const float tanY, const float near, const float far) {
+    // Smallest sphere around the corners of the slice. Its center is on the view axis, at the depth where the corners
+    // of both ends are equally far, or at the far end when the slice is wide: it only depends on the projection.
+    const auto k2 = tanX * tanX + tanY * tanY;
+    const auto depth = std::min(far, (far + near) * (1.0f + k2) * 0.5f);
+    auto radius = std::sqrt(far * far * k2 + (far - depth) * (far - depth));
+    const auto center = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -depth, 1.0f));
+
+    // Cascades that are not drawn every frame cover more than their slice, so that their view can lag behind.
+    const auto cached = cascade > 0;
+    if (cached)
+        radius *= 1.0f + 2.0f * SNAP_TEXELS / static_cast<float>(m_size);
+    const auto texelSize = 2.0f * radius / static_cast<float>(m_size);
+    const auto step = cached ? texelSize * SNAP_TEXELS : texelSize;
+
+    // Moving the view by whole steps keeps the texels of the map on the same world grid.
+    const auto up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    const auto lightView = glm::lookAt(glm::vec3(0.0f), direction, up);
+    const auto snapped = glm::floor(glm::vec3(lightView * glm::vec4(center, 1.0f)) / step + 0.5f) * step;
+
+    // The light looks down -z: the sphere spans distances -z - radius to -z + radius.
+    const auto projection = [&](const float extraNear) {
+        return glm::ortho(snapped.x - radius, snapped.x + radius, snapped.y - radius, snapped.y + radius,
+                          -snapped.z - radius - extraNear, -snapped.z + radius);
+    };
+    auto &target = m_cascades[cascade];
+    target.nextViewProjection = projection(0.0f) * lightView;
+    target.nextTexelSize = texelSize;
+    target.casterFrustum = Frustum(projection(m_casterDistance) * lightView);
+}
+
+void ShadowAtlas::TileAllocator::reset(const int atlasSize) {
+    m_free.clear();
+    m_allocated = 0;
+    for (auto y = 0; y + MAX_TILE <= atlasSize; y += MAX_TILE) {
+        for (auto x = 0; x + MAX_TILE <= atlasSize; x += MAX_TILE) {
+            m_free[MAX_TILE].emplace(x, y);
+        }
+    }
+}
+
+std::optional<ShadowAtlas::Tile> ShadowAtlas::TileAllocator::allocate(const int size) {
+    if (size > MAX_TILE)
+        return std::nullopt;
+    if (auto &free = m_free[size]; !free.empty()) {
+        const auto [x, y] = *free.begin();
+        free.erase(free.begin());
+        m_allocated += static_cast<std::int64_t>(size) * size;
+        return Tile{x, y, size};
+    }
+    // A larger tile is split in four, the other quarters stay free.
+    const auto parent = allocate(size * 2);
+    if (!parent)
+        return std::nullopt;
+    m_allocated -= static_cast<std::int64_t>(parent->size) * parent->size;
+    auto &free = m_free[size];
+    free.emplace(parent->x + size, parent->y);
+    free.emplace(parent->x, parent->y + size);
+    free.emplace(parent->x + size, parent->y + size);
+    m_allocated += static_cast<std::int64_t>(size) * size;
+    return Tile{parent->x, parent->y, size};
+}
+
+void ShadowAtlas::TileAllocator::release(const Tile &tile) {
+    m_allocated -= static_cast<std::int64_t>(tile.size) * tile.size;
+    auto [x, y, size] = tile;
+    while (size < MAX_TILE) {
+        const auto parentX = x & ~(2 * size - 1);
+        const auto parentY = y & ~(2 * size - 1);
+        auto &free = m_free[size];
+        const std::array<std::pair<int, int>, 4> quarters = {
+            {{parentX, parentY}, {parentX + size, parentY}, {parentX, parentY + size}, {parentX + size, parentY + size}}
+        };
+        if (!std::ranges::all_of(quarters, [&](const auto &quarter) {
+            return quarter == std::pair{x, y} || free.contains(quarter);
+        }))
+            break;
+        for (const auto &quarter: quarters) {
+            free.erase(quarter);
+        }
+        x = parentX;
+        y = parentY;
+        size *= 2;
+    }
+    m_free[size].emplace(x, y);
+}
+
+ShadowAtlas::ShadowAtlas() {
+    glGenFramebuffers(1, &m_framebuffer);
+    GLint framebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(framebuffer));
+
+    glGenBuffers(1, &m_viewBuffer);
+    glGenTextures(1, &m_viewTexture);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_viewBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, m_viewTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_viewBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    resize(m_size);
+}
+
+ShadowAtlas::~ShadowAtlas() {
+    glDeleteTextures(1, &m_viewTexture);
+    glDeleteBuffers(1, &m_viewBuffer);
+    glDeleteTextures(1, &m_atlas);
+    glDeleteFramebuffers(1, &m_framebuffer);
+}
+
+void ShadowAtlas::widgets() {
+    if (ImGui::CollapsingHeader("Shadow atlas")) {
+        if (ImGui::Checkbox("Enabled##atlas", &m_enabled) && !m_enabled)
+            clear();
+        constexpr std::array sizes = {2048, 4096, 8192};
+        constexpr std::array sizeNames = {"2048", "4096", "8192"};
+        auto size = static_cast<int>(std::ranges::find(sizes, m_size) - sizes.begin());
+        if (ImGui::Combo("Atlas size", &size, sizeNames.data(), sizeNames.size()))
+            resize(sizes[size]);
+        ImGui::SliderInt("Max lights##atlas", &m_maxLights, 1, 64);
+        ImGui::SliderInt("Views per frame", &m_budget, 1, 64);
+        ImGui::SliderFloat("Texels per pixel", &m_sizeScale, 0.125f, 2.0f);
+        ImGui::SliderFloat("Near plane##atlas", &m_near, 0.01f, 1.0f);
+        ImGui::SliderFloat("Normal offset##atlas", &m_normalOffset, 0.0f, 4.0f, "%.1f texels");
+        ImGui::DragFloat("Bias##atlas", &m_bias, 0.0001f, 0.0f, 0.01f, "%.4f");
+    }
+}
+
+void ShadowAtlas::update(const LightManager &lights, const glm::mat4 &viewProjection, const glm::vec3 &viewPos,
+                         const float fovY, const int viewportHeight) {
+    m_order.clear();
+    for (auto &[light, entry]: m_entries) {
+        entry.selected = false;
+        entry.casters.clear();
+    }
+    if (!m_enabled)
+        return;
+
+    // Visible lights by the screen size of their range, the camera being inside counting as the whole screen.
+    struct Candidate {
+        const Light *light;
+        AABB bounds;
+        float pixels;
+    };
+    std::vector<Candidate> candidates;
+    const Frustum frustum(viewProjection);
+    const auto tanY = std::tan(glm::radians(fovY) * 0.5f);
+    lights.forEachActive([&](const Light &light) {
+        const auto bounds = light.getBounds();
+        if (light.getType() == Light::Type::Directional || !bounds || !frustum.intersects(*bounds))
+            return;
+        const auto range = light.getRange();
+        const auto distance = glm::length(bounds->getCenter() - viewPos);
+        const auto screen = static_cast<float>(viewportHeight);
+        const auto pixels = distance <= range
+                                ? screen
+                                : std::min(screen, screen * range /
+                                                   (std::sqrt(distance * distance - range * range) * tanY));
+        candidates.push_back({&light, *bounds, pixels});
+    });
+    std::ranges::sort(candidates, std::greater{}, &Candidate::pixels);
+    if (candidates.size() > static_cast<std::size_t>(m_maxLights))
+        candidates.resize(m_maxLights);
+
+    for (const auto &[light, bounds, pixels]: candidates) {
+        auto &entry = m_entries[light];
+        entry.light = light;
+        entry.bounds = bounds;
+        entry.pixels = pixels;
+        entry.selected = true;
+    }
+    // Lights that lost their shadow give their tiles back before the others get theirs.
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (it->second.selected) {
+            ++it;
+            continue;
+        }
+        release(it->second);
+        it = m_entries.erase(it);
+    }
+
+    // Tiles change size when the light gets twice as large on screen, or four times smaller, not to be drawn again
+    // on every small move. When the atlas is full, lights get smaller tiles, then none.
+    for (const auto &candidate: candidates) {
+        auto &entry = m_entries[candidate.light];
+        const auto wanted = static_cast<int>(std::clamp(
+            std::bit_ceil(static_cast<unsigned>(std::max(1.0f, entry.pixels * m_sizeScale))),
+            static_cast<unsigned>(MIN_TILE), static_cast<unsigned>(MAX_TILE)));
+        const auto current = entry.tiles.empty() ? 0 : entry.tiles.front().size;
+        if (current != 0 && wanted <= current && wanted * 2 >= current) {
+            m_order.push_back(&entry);
+            continue;
+        }
+        release(entry);
+        for (auto size = wanted; size >= MIN_TILE; size /= 2) {
+            if (allocate(entry, size))
+                break;
+        }
+        if (!entry.tiles.empty())
+            m_order.push_back(&entry);
+    }
+    for (const auto entry: m_order) {
+        computeViews(*entry);
+    }
+}
+
+const AABB &ShadowAtlas::getLightBounds(const std::size_t light) const {
+    return m_order[light]->bounds;
+}
+
+void ShadowAtlas::addCaster(const std::size_t light, const GLuint vao, const GLsizei count, const GLuint firstIndex,
+                            const GLint baseVertex, const glm::mat4 &model, const AABB &bounds) {
+    m_order[light]->casters.add(vao, count, firstIndex, baseVertex, model, bounds);
+}
+
+void ShadowAtlas::render(LightManager &lights, Shader *const depthShader, RingBuffer &ring) {
+    m_timer.poll();
+    m_stats = {};
+    m_stats.gpuMilliseconds = m_timer.getMilliseconds();
+
+    // Views and casters the same as when the tiles were drawn keep them valid. Tiles never drawn come first, then the
+    // lights covering the most of the screen.
+    std::vector<Entry *> outdated;
+    for (const auto entry: m_order) {
+        auto hash = entry->casters.hash(hashBytes(entry->views.data(), entry->views.size() * sizeof(View)));
+        for (const auto &tile: entry->tiles) {
+            hash = hashBytes(&tile, sizeof(Tile), hash);
+        }
+        entry->nextHash = std::max<std::uint64_t>(hash, 1);
+        if (entry->nextHash != entry->hash)
+            outdated.push_back(entry);
+    }
+    std::ranges::stable_sort(outdated, std::less{}, [](const Entry *entry) { return entry->hash != 0; });
+
+    std::optional<SavedState> saved;
+    auto budget = m_budget;
+    for (const auto entry: outdated) {
+        // A point light needing more views than the budget still gets them, alone.
+        const auto views = static_cast<int>(entry->views.size());
+        if (!depthShader || (views > budget && m_stats.drawnViews > 0)) {
+            m_stats.staleViews += views;
+            continue;
+        }
+        if (!saved) {
+            saved.emplace();
+            beginDepthPass(*depthShader, m_framebuffer);
+            glEnable(GL_SCISSOR_TEST);
+            m_timer.begin();
+        }
+        draw(*entry, *depthShader, ring);
+        budget -= views;
+        m_stats.drawnViews += views;
+    }
+    if (saved) {
+        m_timer.end();
+        glDisable(GL_SCISSOR_TEST);
+        saved->restore();
+    }
+
+    // Lights read the views their tiles were drawn with.
+    m_viewTexels.clear();
+    std::unordered_map<const Light *, int> shadows;
+    for (const auto entry: m_order) {
+        if (entry->hash == 0)
+            continue;
+        shadows[entry->light] = static_cast<int>(m_viewTexels.size() / VIEW_TEXELS);
+        for (std::size_t i = 0; i < entry->tiles.size(); ++i) {
+            const auto &[x, y, size] = entry->tiles[i];
+            const auto &[viewProjection, texelScale] = entry->drawnViews[i];
+            // From clip space to the tile, in atlas texture coordinates.
+            const auto scale = static_cast<float>(size) / static_cast<float>(m_size);
+            const auto origin = glm::vec2(x, y) / static_cast<float>(m_size);
+            auto toTile = glm::translate(glm::mat4(1.0f), glm::vec3(origin + scale * 0.5f, 0.5f));
+            toTile = glm::scale(toTile, glm::vec3(scale * 0.5f, scale * 0.5f, 0.5f));
+            const auto matrix = toTile * viewProjection;
+            for (auto column = 0; column < 4; ++column) {
+                m_viewTexels.push_back(matrix[column]);
+            }
+            m_viewTexels.emplace_back(origin, origin + scale);
+            m_viewTexels.emplace_back(texelScale, 0.0f, 0.0f, 0.0f);
+        }
+        m_stats.lights++;
+        m_stats.views += static_cast<int>(entry->tiles.size());
+    }
+    lights.assignShadows([&shadows](const Light &light) {
+        const auto it = shadows.find(&light);
+        return it == shadows.end() ? -1 : it->second;
+    });
+
+    // Empty buffer textures are not allowed everywhere.
+    if (m_viewTexels.empty())
+        m_viewTexels.emplace_back(0.0f);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_viewBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(m_viewTexels.size() * sizeof(glm::vec4)),
+                 m_viewTexels.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    m_stats.occupancy = static_cast<float>(m_allocator.getAllocatedTexels()) /
+                        (static_cast<float>(m_size) * static_cast<float>(m_size));
+}
+
+void ShadowAtlas::bind(Shader *const shader) const {
+    glActiveTexture(GL_TEXTURE0 + SHADOW_ATLAS_UNIT);
+    glBindTexture(GL_TEXTURE_2D, m_atlas);
+    glActiveTexture(GL_TEXTURE0 + SHADOW_VIEWS_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, m_viewTexture);
+    shader->setInt("shadowAtlas", SHADOW_ATLAS_UNIT);
+    shader->setInt("shadowViews", SHADOW_VIEWS_UNIT);
+    shader->setFloat("shadowAtlasOffset", m_normalOffset);
+    shader->setFloat("shadowAtlasBias", m_bias);
+}
+
+void ShadowAtlas::resize(const int size) {
+    m_size = size;
+    clear();
+    glDeleteTextures(1, &m_atlas);
+    glGenTextures(1, &m_atlas);
+    glBindTexture(GL_TEXTURE_2D, m_atlas);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    setShadowSampling(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLint framebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_atlas, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(framebuffer));
+}
+
+void ShadowAtlas::clear() {
+    m_entries.clear();
+    m_order.clear();
+    m_allocator.reset(m_size);
+}
+
+void ShadowAtlas::computeViews(Entry &entry) const {
+    entry.views.clear();
+    const auto size = static_cast<float>(entry.tiles.front().size);
+    const auto far = std::max(entry.light->getRange(), m_near * 2.0f);
+    if (entry.light->getType() == Light::Type::Spot) {
+        const auto &spot = static_cast<const SpotLight &>(*entry.light);
+        // The cone, and a texel around it for filtering.
+        const auto halfAngle = std::min(std::acos(spot.getOuterCutOff()) + 2.0f / size, glm::radians(85.0f));
+        const auto direction = glm::normalize(spot.getDirection());
+        const auto up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        const auto view = glm::lookAt(spot.getPosition(), spot.getPosition() + direction, up);
+        const auto projection = glm::perspective(2.0f * halfAngle, 1.0f, m_near, far);
+        entry.views.push_back({projection * view, 2.0f * std::tan(halfAngle) / size});
+        return;
+    }
+    const auto &point = static_cast<const PointLight &>(*entry.light);
+    const auto projection = glm::perspective(glm::radians(90.0f), 1.0f, m_near, far);
+    for (const auto &[axis, up]: CUBE_FACES) {
+        const auto view = glm::lookAt(point.getPosition(), point.getPosition() + axis, up);
+        entry.views.push_back({projection * view, 2.0f / size});
+    }
+}
+
+bool ShadowAtlas::allocate(Entry &entry, const int size) {
+    const auto count = entry.light->getType() == Light::Type::Point ? CUBE_FACES.size() : 1;
+    for (std::size_t i = 0; i < count; ++i) {
+        const auto tile = m_allocator.allocate(size);
+        if (!tile) {
+            release(entry);
+            return false;
+        }
+        entry.tiles.push_back(*tile);
+    }
+    return true;
+}
+
+void ShadowAtlas::release(Entry &entry) {
+    for (const auto &tile: entry.tiles) {
+        m_allocator.release(tile);
+    }
+    entry.tiles.clear();
+    entry.drawnViews.clear();
+    entry.hash = 0;
+}
+
+void ShadowAtlas::draw(Entry &entry, Shader &depthShader, RingBuffer &ring) {
+    for (std::size_t i = 0; i < entry.tiles.size(); ++i) {
+        const auto &[x, y, size] = entry.tiles[i];
+        glViewport(x, y, size, size);
+        glScissor(x, y, size, size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        const auto &viewProjection = entry.views[i].viewProjection;
+        depthShader.setMat4("lightViewProjection", viewProjection);
+        const Frustum frustum(viewProjection);
+        m_stats.instances += entry.casters.draw(depthShader, m_transforms, ring, &frustum);
+    }
+    entry.drawnViews = entry.views;
+    entry.hash = entry.nextHash;
+}
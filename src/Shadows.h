@@ -0,0 +1,311 @@
+#ifndef SHADOWS_H
+#define SHADOWS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+#include "Light.h"
+#include "RenderQueue.h"
+#include "Shader.h"
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Texture units of the shadow maps, below the light buffers.
+constexpr int SHADOW_UNIT = 9;
+constexpr int SHADOW_ATLAS_UNIT = 8;
+constexpr int SHADOW_VIEWS_UNIT = 7;
+
+// GL_TIME_ELAPSED query read back once the GPU is done with it, never waited for.
+class TimerQuery {
+public:
+    TimerQuery();
+
+    ~TimerQuery();
+
+    TimerQuery(const TimerQuery &) = delete;
+
+    TimerQuery &operator=(const TimerQuery &) = delete;
+
+    // Nothing is measured while the previous measure is not read back.
+    void begin();
+
+    void end();
+
+    // Reads the pending measure, if the GPU is done with it.
+    void poll();
+
+    [[nodiscard]] double getMilliseconds() const { return m_milliseconds; }
+
+private:
+    GLuint m_query{};
+    bool m_running = false;
+    bool m_pending = false;
+    double m_milliseconds = 0.0;
+};
+
+// Instances of indexed meshes drawn into a shadow map.
+class ShadowCasters {
+public:
+    void clear();
+
+    // An instance of the mesh drawn from vao, positions at location 0. The vao must not enable INSTANCE_ATTRIBUTE,
+    // whose buffer only covers the instances of the render queue: casters are located through baseInstance. Bounds are
+    // in world space.
+    void add(GLuint vao, GLsizei count, GLuint firstIndex, GLint baseVertex, const glm::mat4 &model, const AABB &bounds);
+
+    [[nodiscard]] std::size_t size() const { return m_casters.size(); }
+
+    // FNV-1a of the draws and transforms, continuing from seed.
+    [[nodiscard]] std::uint64_t hash(std::uint64_t seed) const;
+
+    // Draws the casters intersecting the frustum, every one without it, with a program including transforms.glsl
+    // already in use. Instances of the same mesh are drawn together, their transforms written into the ring buffer.
+    // Returns the instances drawn.
+    int draw(Shader &shader, TransformBuffer &transforms, RingBuffer &ring, const Frustum *frustum);
+
+private:
+    struct Caster {
+        GLuint vao;
+        GLsizei count;
+        GLuint firstIndex;
+        GLint baseVertex;
+        std::uint32_t transform;
+        AABB bounds;
+    };
+
+    std::vector<Caster> m_casters;
+    std::vector<TransformBuffer::Transform> m_transforms;
+    std::vector<const Caster *> m_drawn; // scratch, grouped by mesh
+    std::vector<TransformBuffer::Transform> m_sortedTransforms;
+};
+
+// FNV-1a over raw bytes, for the hashes telling whether a shadow map is still valid.
+std::uint64_t hashBytes(const void *data, std::size_t size, std::uint64_t seed = 14695981039346656037ull);
+
+struct CascadeStats {
+    int casters = 0; // instances, -1 when the cascade was not due this frame
+    bool rendered = false;
+    double gpuMilliseconds = 0.0; // of its last render, read back once available
+};
+
+// Cascaded shadow maps of the first active directional light. The view frustum, up to the shadow distance, is split
+// in CASCADES slices, each covered by an orthographic view of the light drawn into a layer of a depth texture array:
+//  - cascades are stable: they cover the bounding sphere of their slice, whose size does not change with the camera
+//    orientation, and they only move by whole texels, so that shadow edges do not shimmer;
+//  - casters are culled per cascade against its box, stretched towards the light;
+//  - a cascade is drawn again only when its view or one of its casters changed. Cascades past the first are only
+//    considered every few frames, and move by steps of several texels so that walking around keeps them valid.
+// Fragments read the first cascade covering them, so a cascade lagging behind the camera is never wrong, only less
+// precise. Depth is clamped rather than clipped, casters between the light and the cascade flatten onto its near plane.
+class ShadowCascades {
+public:
+    static constexpr int CASCADES = 4;
+
+    ShadowCascades();
+
+    ~ShadowCascades();
+
+    ShadowCascades(const ShadowCascades &) = delete;
+
+    ShadowCascades &operator=(const ShadowCascades &) = delete;
+
+    void widgets();
+
+    // Fits the cascades to a perspective view, fovY in degrees, and forgets the casters of the previous frame.
+    void update(const LightManager &lights, const glm::mat4 &view, float fovY, float aspect, float near, float far);
+
+    // Whether the casters of the cascade are wanted this frame.
+    [[nodiscard]] bool isDue(int cascade) const;
+
+    // Region whose objects can cast shadows in the cascade.
+    [[nodiscard]] const Frustum &getCasterFrustum(int cascade) const { return m_cascades[cascade].casterFrustum; }
+
+    void addCaster(int cascade, GLuint vao, GLsizei count, GLuint firstIndex, GLint baseVertex,
+                   const glm::mat4 &model, const AABB &bounds);
+
+    // Draws the due cascades whose view or casters changed with the shadow_depth program. The framebuffer and viewport
+    // are restored. Without a program, the cascades keep what they hold.
+    void render(Shader *depthShader, RingBuffer &ring);
+
+    // Binds the shadow maps and sets the uniforms of a program including shadows.glsl. The program must be in use.
+    void bind(Shader *shader) const;
+
+    [[nodiscard]] bool isEnabled() const { return m_enabled && m_hasLight; }
+
+    [[nodiscard]] const std::array<CascadeStats, CASCADES> &getStats() const { return m_stats; }
+
+private:
+    struct Cascade {
+        glm::mat4 viewProjection{1.0f}; // drawn with, read by the shaders
+        glm::mat4 nextViewProjection{1.0f}; // fitted this frame
+        Frustum casterFrustum;
+        float texelSize = 0.0f; // in world units
+        float nextTexelSize = 0.0f;
+        ShadowCasters casters;
+        std::uint64_t hash = 0; // of the view and casters it was drawn with, 0 when never drawn
+        TimerQuery timer;
+    };
+
+    GLuint m_depthMaps{}, m_framebuffer{};
+    TransformBuffer m_transforms;
+    std::array<Cascade, CASCADES> m_cascades;
+    std::array<CascadeStats, CASCADES> m_stats;
+    std::uint64_t m_frame = 0;
+    bool m_hasLight = false;
+
+    bool m_enabled = true;
+    int m_size = 2048;
+    float m_distance = 60.0f; // covered by the cascades, from the near plane
+    float m_splitLambda = 0.75f; // 0 for uniform splits, 1 for logarithmic ones
+    float m_casterDistance = 100.0f; // towards the light, past the cascade box
+    std::array<int, CASCADES> m_intervals = {1, 2, 4, 8}; // in frames
+    float m_normalOffset = 1.5f; // in texels
+    float m_bias = 0.0005f;
+
+    void resize(int size);
+
+    // Fits the cascade to the slice of the view between two distances.
+    void fit(int cascade, const glm::vec3 &direction, const glm::mat4 &inverseView, float tanX, float tanY,
+             float near, float far);
+};
+
+struct AtlasStats {
+    int lights = 0; // with tiles
+    int views = 0;
+    int drawnViews = 0;
+    int staleViews = 0; // out of date, left for the next frames by the budget
+    int instances = 0; // drawn into the atlas
+    float occupancy = 0.0f; // allocated fraction of the atlas
+    double gpuMilliseconds = 0.0; // of the last frame anything was drawn
+};
+
+// Shadow maps of point and spot lights, allocated from a single depth texture. Spot lights get one perspective view,
+// point lights six, one per cube face. Tiles are square, a power of two sized from the screen coverage of the light's
+// range, and come from a quadtree: freed quarters merge back into larger tiles.
+// A light keeps its tiles and their content while its views and the casters in its range stay the same. Views to draw
+// again are picked by priority within a per-frame budget, the others keep their outdated content. Lights whose tiles
+// were never drawn have no shadow until they are.
+// Shaders find the first view of a light from its shadow index, and read from a buffer texture (shadows.glsl), per
+// view, its matrix to atlas coordinates, its tile, and the size of a texel at unit distance.
+class ShadowAtlas {
+public:
+    ShadowAtlas();
+
+    ~ShadowAtlas();
+
+    ShadowAtlas(const ShadowAtlas &) = delete;
+
+    ShadowAtlas &operator=(const ShadowAtlas &) = delete;
+
+    void widgets();
+
+    // Picks the visible lights getting shadows, those covering the most of the screen first, and their tiles. fovY is
+    // in degrees. Forgets the casters of the previous frame.
+    void update(const LightManager &lights, const glm::mat4 &viewProjection, const glm::vec3 &viewPos, float fovY,
+                int viewportHeight);
+
+    // Lights getting shadows, by priority.
+    [[nodiscard]] std::size_t getLightCount() const { return m_order.size(); }
+
+    // Region whose objects can cast shadows for the light.
+    [[nodiscard]] const AABB &getLightBounds(std::size_t light) const;
+
+    void addCaster(std::size_t light, GLuint vao, GLsizei count, GLuint firstIndex, GLint baseVertex,
+                   const glm::mat4 &model, const AABB &bounds);
+
+    // Draws the views that changed, within the budget, with the shadow_depth program, and gives every light its shadow
+    // index. The framebuffer and viewport are restored. Without a program, every view that changed is left stale.
+    void render(LightManager &lights, Shader *depthShader, RingBuffer &ring);
+
+    // Binds the atlas and sets the uniforms of a program including shadows.glsl. The program must be in use.
+    void bind(Shader *shader) const;
+
+    [[nodiscard]] const AtlasStats &getStats() const { return m_stats; }
+
+private:
+    static constexpr int MIN_TILE = 128;
+    static constexpr int MAX_TILE = 1024;
+
+    struct Tile {
+        int x, y, size; // in texels
+    };
+
+    // Square tiles of power of two sizes, split from MAX_TILE blocks.
+    class TileAllocator {
+    public:
+        void reset(int atlasSize);
+
+        [[nodiscard]] std::optional<Tile> allocate(int size);
+
+        // Merges the tile with its siblings when they are all free.
+        void release(const Tile &tile);
+
+        [[nodiscard]] std::int64_t getAllocatedTexels() const { return m_allocated; }
+
+    private:
+        std::map<int, std::set<std::pair<int, int> > > m_free; // origins by size
+        std::int64_t m_allocated = 0;
+    };
+
+    struct View {
+        glm::mat4 viewProjection;
+        float texelScale; // size of a texel at unit distance
+    };
+
+    struct Entry {
+        const Light *light = nullptr;
+        std::vector<Tile> tiles;
+        std::vector<View> views; // this frame
+        std::vector<View> drawnViews; // what the tiles hold
+        AABB bounds;
+        float pixels = 0.0f; // screen size of the range, the priority
+        ShadowCasters casters;
+        std::uint64_t hash = 0; // of the views and casters drawn, 0 when the tiles hold nothing
+        std::uint64_t nextHash = 0;
+        bool selected = false;
+    };
+
+    GLuint m_atlas{}, m_framebuffer{};
+    GLuint m_viewBuffer{}, m_viewTexture{};
+    TransformBuffer m_transforms;
+    TileAllocator m_allocator;
+    std::unordered_map<const Light *, Entry> m_entries;
+    std::vector<Entry *> m_order;
+    std::vector<glm::vec4> m_viewTexels;
+    TimerQuery m_timer;
+    AtlasStats m_stats;
+
+    bool m_enabled = true;
+    int m_size = 4096;
+    int m_maxLights = 16;
+    int m_budget = 12; // views drawn per frame
+    float m_sizeScale = 0.5f; // tile texels per pixel of the light's range on screen
+    float m_near = 0.05f;
+    float m_normalOffset = 1.5f; // in texels
+    float m_bias = 0.0005f;
+
+    void resize(int size);
+
+    // Releases the tiles of every light.
+    void clear();
+
+    // Views of the light this frame, into the tiles it has.
+    void computeViews(Entry &entry) const;
+
+    // Allocates a tile per view, all of the same size. Returns false, holding nothing, when they do not fit.
+    bool allocate(Entry &entry, int size);
+
+    void release(Entry &entry);
+
+    void draw(Entry &entry, Shader &depthShader, RingBuffer &ring);
+};
+
+#endif
@@ -52,6 +52,8 @@ public:
 
     [[nodiscard]] Type getType() const { return m_type; }
 
+    [[nodiscard]] GLuint getId() const { return m_textureId; }
+
 private:
     GLuint m_textureId;
     Type m_type;
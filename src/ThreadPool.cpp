@@ -0,0 +1,75 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(const unsigned threads) {
+    m_threads.reserve(threads);
+    for (auto i = 0u; i < threads; ++i) {
+        m_threads.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto &thread: m_threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::parallelFor(const std::size_t count, const std::function<void(std::size_t)> &job) {
+    if (count == 0)
+        return;
+    if (m_threads.empty() || count == 1) {
+        for (std::size_t i = 0; i < count; ++i) {
+            job(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard lock(m_mutex);
+        m_job = &job;
+        m_count = count;
+        m_next = 0;
+        m_pending = m_threads.size();
+        m_generation++;
+    }
+    m_wake.notify_all();
+    runJobs(job, count);
+
+    // Every worker has to be done with this generation before the job goes out of scope.
+    std::unique_lock lock(m_mutex);
+    m_done.wait(lock, [this] { return m_pending == 0; });
+    m_job = nullptr;
+}
+
+void ThreadPool::work() {
+    std::uint64_t generation = 0;
+    while (true) {
+        std::unique_lock lock(m_mutex);
+        m_wake.wait(lock, [&] { return m_stop || m_generation != generation; });
+        if (m_stop)
+            return;
+        generation = m_generation;
+        const auto job = m_job;
+        const auto count = m_count;
+        lock.unlock();
+
+        runJobs(*job, count);
+
+        lock.lock();
+        if (--m_pending == 0)
+            m_done.notify_one();
+    }
+}
+
+void ThreadPool::runJobs(const std::function<void(std::size_t)> &job, const std::size_t count) {
+    for (auto i = m_next++; i < count; i = m_next++) {
+        job(i);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker threads kept alive for the whole run, for work split in many small jobs every frame.
+class ThreadPool {
+public:
+    // By default, one worker per hardware thread besides the calling one.
+    explicit ThreadPool(unsigned threads = std::max(1u, std::thread::hardware_concurrency()) - 1);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Runs job(i) for every i in [0, count) on the workers and the calling thread, and returns once all are done.
+    // Not reentrant: jobs must not call parallelFor.
+    void parallelFor(std::size_t count, const std::function<void(std::size_t)> &job);
+
+    // Threads running jobs, including the calling one.
+    [[nodiscard]] std::size_t getThreadCount() const { return m_threads.size() + 1; }
+
+private:
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    const std::function<void(std::size_t)> *m_job = nullptr;
+    std::size_t m_count = 0;
+    std::atomic<std::size_t> m_next = 0;
+    std::uint64_t m_generation = 0;
+    std::size_t m_pending = 0; // workers that did not finish the current generation
+    bool m_stop = false;
+
+    void work();
+
+    void runJobs(const std::function<void(std::size_t)> &job, std::size_t count);
+};
+
+#endif
@@ -0,0 +1,259 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+#include <fmt/format.h>
+
+#include "Transform.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define TRANSFORM_SSE
+#endif
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+// Placements composed together, one per SIMD lane.
+constexpr std::size_t BATCH_SIZE = 4;
+
+void TransformCache::push_back(const ModelMatrix &model) {
+    m_translationX.push_back(model.translation.x);
+    m_translationY.push_back(model.translation.y);
+    m_translationZ.push_back(model.translation.z);
+    m_rotationX.push_back(model.rotation.x);
+    m_rotationY.push_back(model.rotation.y);
+    m_rotationZ.push_back(model.rotation.z);
+    m_scale.push_back(model.scale);
+    m_world.emplace_back(1.0f);
+    m_normal.emplace_back(1.0f);
+    m_dirty.push_back(0);
+    markDirty(m_scale.size() - 1);
+}
+
+void TransformCache::swapAndPop(const std::size_t i) {
+    const auto last = m_scale.size() - 1;
+    const auto at = [i, last](auto &components) {
+        components[i] = components[last];
+        components.pop_back();
+    };
+    if (m_dirty[i])
+        std::erase(m_dirtyList, static_cast<std::uint32_t>(i));
+    if (m_dirty[last] && i != last)
+        std::ranges::replace(m_dirtyList, static_cast<std::uint32_t>(last), static_cast<std::uint32_t>(i));
+    at(m_translationX);
+    at(m_translationY);
+    at(m_translationZ);
+    at(m_rotationX);
+    at(m_rotationY);
+    at(m_rotationZ);
+    at(m_scale);
+    at(m_world);
+    at(m_normal);
+    at(m_dirty);
+}
+
+ModelMatrix TransformCache::get(const std::size_t i) const {
+    return {
+        glm::vec3(m_translationX[i], m_translationY[i], m_translationZ[i]),
+        glm::vec3(m_rotationX[i], m_rotationY[i], m_rotationZ[i]),
+        m_scale[i]
+    };
+}
+
+void TransformCache::set(const std::size_t i, const ModelMatrix &model) {
+    if (model == get(i))
+        return;
+    m_translationX[i] = model.translation.x;
+    m_translationY[i] = model.translation.y;
+    m_translationZ[i] = model.translation.z;
+    m_rotationX[i] = model.rotation.x;
+    m_rotationY[i] = model.rotation.y;
+    m_rotationZ[i] = model.rotation.z;
+    m_scale[i] = model.scale;
+    markDirty(i);
+}
+
+std::span<const std::uint32_t> TransformCache::update() {
+    m_updated.swap(m_dirtyList);
+    m_dirtyList.clear();
+    m_stats = {static_cast<int>(m_updated.size()), 0.0};
+    if (m_updated.empty())
+        return m_updated;
+
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    std::ranges::sort(m_updated);
+    for (std::size_t first = 0; first < m_updated.size(); first += BATCH_SIZE) {
+        compose(std::span(m_updated).subspan(first, std::min(BATCH_SIZE, m_updated.size() - first)));
+    }
+    for (const auto i: m_updated) {
+        m_dirty[i] = 0;
+    }
+    m_stats.milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    return m_updated;
+}
+
+void TransformCache::markDirty(const std::size_t i) {
+    if (m_dirty[i])
+        return;
+    m_dirty[i] = 1;
+    m_dirtyList.push_back(static_cast<std::uint32_t>(i));
+}
+
+void TransformCache::compose(const std::span<const std::uint32_t> indices) {
+    // Sines and cosines of each lane, the last placement fills the unused lanes.
+    alignas(16) std::array<float, BATCH_SIZE> sx{}, cx{}, sy{}, cy{}, sz{}, cz{};
+    for (std::size_t lane = 0; lane < BATCH_SIZE; ++lane) {
+        const auto i = indices[std::min(lane, indices.size() - 1)];
+        const auto x = glm::radians(m_rotationX[i]);
+        const auto y = glm::radians(m_rotationY[i]);
+        const auto z = glm::radians(m_rotationZ[i]);
+        sx[lane] = std::sin(x);
+        cx[lane] = std::cos(x);
+        sy[lane] = std::sin(y);
+        cy[lane] = std::cos(y);
+        sz[lane] = std::sin(z);
+        cz[lane] = std::cos(z);
+    }
+
+    // Entries of Rx * Ry * Rz, column by column.
+    alignas(16) std::array<std::array<float, BATCH_SIZE>, 9> rotation{};
+#if defined(TRANSFORM_SSE)
+    const auto sinX = _mm_load_ps(sx.data()), cosX = _mm_load_ps(cx.data());
+    const auto sinY = _mm_load_ps(sy.data()), cosY = _mm_load_ps(cy.data());
+    const auto sinZ = _mm_load_ps(sz.data()), cosZ = _mm_load_ps(cz.data());
+    const auto sinXSinY = _mm_mul_ps(sinX, sinY);
+    const auto cosXSinY = _mm_mul_ps(cosX, sinY);
+    _mm_store_ps(rotation[0].data(), _mm_mul_ps(cosY, cosZ));
+    _mm_store_ps(rotation[1].data(), _mm_add_ps(_mm_mul_ps(sinXSinY, cosZ), _mm_mul_ps(cosX, sinZ)));
+    _mm_store_ps(rotation[2].data(), _mm_sub_ps(_mm_mul_ps(sinX, sinZ), _mm_mul_ps(cosXSinY, cosZ)));
+    _mm_store_ps(rotation[3].data(), _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(cosY, sinZ)));
+    _mm_store_ps(rotation[4].data(), _mm_sub_ps(_mm_mul_ps(cosX, cosZ), _mm_mul_ps(sinXSinY, sinZ)));
+    _mm_store_ps(rotation[5].data(), _mm_add_ps(_mm_mul_ps(cosXSinY, sinZ), _mm_mul_ps(sinX, cosZ)));
+    _mm_store_ps(rotation[6].data(), sinY);
+    _mm_store_ps(rotation[7].data(), _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(sinX, cosY)));
+    _mm_store_ps(rotation[8].data(), _mm_mul_ps(cosX, cosY));
+#else
+    for (std::size_t lane = 0; lane < BATCH_SIZE; ++lane) {
+        rotation[0][lane] = cy[lane] * cz[lane];
+        rotation[1][lane] = sx[lane] * sy[lane] * cz[lane] + cx[lane] * sz[lane];
+        rotation[2][lane] = sx[lane] * sz[lane] - cx[lane] * sy[lane] * cz[lane];
+        rotation[3][lane] = -cy[lane] * sz[lane];
+        rotation[4][lane] = cx[lane] * cz[lane] - sx[lane] * sy[lane] * sz[lane];
+        rotation[5][lane] = cx[lane] * sy[lane] * sz[lane] + sx[lane] * cz[lane];
+        rotation[6][lane] = sy[lane];
+        rotation[7][lane] = -sx[lane] * cy[lane];
+        rotation[8][lane] = cx[lane] * cy[lane];
+    }
+#endif
+
+    for (std::size_t lane = 0; lane < indices.size(); ++lane) {
+        const auto i = indices[lane];
+        glm::mat3 matrix;
+        for (auto column = 0; column < 3; ++column) {
+            for (auto row = 0; row < 3; ++row) {
+                matrix[column][row] = rotation[column * 3 + row][lane];
+            }
+        }
+        // The inverse transpose of a rotation scaled by s is the rotation divided by s. A null scale keeps the
+        // rotation, normals are normalized anyway.
+        const auto scale = m_scale[i];
+        m_normal[i] = scale != 0.0f ? matrix * (1.0f / scale) : matrix;
+        matrix *= scale;
+        m_world[i] = glm::mat4(glm::vec4(matrix[0], 0.0f), glm::vec4(matrix[1], 0.0f), glm::vec4(matrix[2], 0.0f),
+                               glm::vec4(m_translationX[i], m_translationY[i], m_translationZ[i], 1.0f));
+    }
+}
+
+std::uint32_t SceneGraph::add(const glm::mat4 &local, const glm::mat3 &localNormal, const std::uint32_t parent) {
+    const auto node = static_cast<std::uint32_t>(m_parents.size());
+    m_parents.push_back(parent);
+    m_locals.push_back(local);
+    m_localNormals.push_back(localNormal);
+    m_worlds.push_back(local);
+    m_worldNormals.push_back(localNormal);
+    m_dirty.push_back(0);
+    markDirty(node);
+    return node;
+}
+
+void SceneGraph::setLocal(const std::uint32_t node, const glm::mat4 &local, const glm::mat3 &localNormal) {
+    m_locals[node] = local;
+    m_localNormals[node] = localNormal;
+    markDirty(node);
+}
+
+void SceneGraph::setParent(const std::uint32_t node, const std::uint32_t parent) {
+    if (parent != NO_PARENT && parent >= node)
+        throw std::runtime_error(fmt::format("Node {} cannot be the parent of node {}", parent, node));
+    m_parents[node] = parent;
+    markDirty(node);
+}
+
+std::vector<std::uint32_t> SceneGraph::remove(const std::uint32_t node) {
+    // Descendants come after the node: a node is removed if its parent is.
+    std::vector<std::uint32_t> indices(m_parents.size());
+    std::uint32_t next = 0;
+    for (std::size_t i = 0; i < m_parents.size(); ++i) {
+        const auto parent = m_parents[i];
+        const auto removed = i == node || (i > node && parent != NO_PARENT && indices[parent] == NO_PARENT);
+        indices[i] = removed ? NO_PARENT : next++;
+    }
+
+    std::size_t firstDirty = next;
+    for (std::size_t i = 0; i < m_parents.size(); ++i) {
+        const auto index = indices[i];
+        if (index == NO_PARENT)
+            continue;
+        // Parents come first, they were already moved.
+        const auto parent = m_parents[i];
+        m_parents[index] = parent == NO_PARENT ? NO_PARENT : indices[parent];
+        m_locals[index] = m_locals[i];
+        m_localNormals[index] = m_localNormals[i];
+        m_worlds[index] = m_worlds[i];
+        m_worldNormals[index] = m_worldNormals[i];
+        m_dirty[index] = m_dirty[i];
+        if (m_dirty[index])
+            firstDirty = std::min<std::size_t>(firstDirty, index);
+    }
+    m_parents.resize(next);
+    m_locals.resize(next);
+    m_localNormals.resize(next);
+    m_worlds.resize(next);
+    m_worldNormals.resize(next);
+    m_dirty.resize(next);
+    m_firstDirty = firstDirty;
+    return indices;
+}
+
+std::span<const std::uint32_t> SceneGraph::update() {
+    m_updated.clear();
+    for (auto i = m_firstDirty; i < m_parents.size(); ++i) {
+        const auto parent = m_parents[i];
+        const auto parentDirty = parent != NO_PARENT && m_dirty[parent];
+        if (!m_dirty[i] && !parentDirty)
+            continue;
+        // Dirty until the end of the pass, so that the children are computed too.
+        m_dirty[i] = 1;
+        if (parent == NO_PARENT) {
+            m_worlds[i] = m_locals[i];
+            m_worldNormals[i] = m_localNormals[i];
+        } else {
+            m_worlds[i] = m_worlds[parent] * m_locals[i];
+            m_worldNormals[i] = m_worldNormals[parent] * m_localNormals[i];
+        }
+        m_updated.push_back(static_cast<std::uint32_t>(i));
+    }
+    for (const auto i: m_updated) {
+        m_dirty[i] = 0;
+    }
+    m_firstDirty = m_parents.size();
+    return m_updated;
+}
+
+void SceneGraph::markDirty(const std::uint32_t node) {
+    m_dirty[node] = 1;
+    m_firstDirty = std::min<std::size_t>(m_firstDirty, node);
+}
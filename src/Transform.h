@@ -0,0 +1,120 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+// Placement of an object: scaled, then rotated around x, y and z in this order, then translated.
+struct ModelMatrix {
+    glm::vec3 translation = glm::vec3(0.0f);
+    glm::vec3 rotation = glm::vec3(0.0f); // in degrees
+    float scale = 1.0f;
+
+    bool operator==(const ModelMatrix &other) const = default;
+};
+
+struct TransformStats {
+    int recomputed = 0;
+    double milliseconds = 0.0;
+};
+
+// World and normal matrices of a list of placements, recomputed only for the placements that changed since the last
+// update: nothing is computed while nothing moves.
+//
+// Placements are stored component by component. The dirty ones are composed in batches, with SIMD instructions when
+// available. The scale being uniform, the normal matrix is the rotation divided by the scale, no matrix is inverted.
+class TransformCache {
+public:
+    void push_back(const ModelMatrix &model);
+
+    // The last placement takes its place.
+    void swapAndPop(std::size_t i);
+
+    [[nodiscard]] std::size_t size() const { return m_scale.size(); }
+
+    [[nodiscard]] ModelMatrix get(std::size_t i) const;
+
+    // The matrices are only recomputed if the placement differs.
+    void set(std::size_t i, const ModelMatrix &model);
+
+    // Recomputes the matrices of the placements that changed, and returns their indices in increasing order.
+    std::span<const std::uint32_t> update();
+
+    [[nodiscard]] const glm::mat4 &getWorld(const std::size_t i) const { return m_world[i]; }
+
+    [[nodiscard]] const glm::mat3 &getNormal(const std::size_t i) const { return m_normal[i]; }
+
+    // Of the last update.
+    [[nodiscard]] const TransformStats &getStats() const { return m_stats; }
+
+private:
+    std::vector<float> m_translationX, m_translationY, m_translationZ;
+    std::vector<float> m_rotationX, m_rotationY, m_rotationZ;
+    std::vector<float> m_scale;
+    std::vector<std::uint8_t> m_dirty;
+    std::vector<std::uint32_t> m_dirtyList; // indices of m_dirty set, in any order
+    std::vector<std::uint32_t> m_updated;
+    std::vector<glm::mat4> m_world;
+    std::vector<glm::mat3> m_normal;
+    TransformStats m_stats;
+
+    void markDirty(std::size_t i);
+
+    // Composes the matrices of the placements at these indices, a batch at most.
+    void compose(std::span<const std::uint32_t> indices);
+};
+
+// Hierarchy of transforms stored flat, in arrays indexed by node: every node comes after its parent, breadth-first
+// when built from a tree. World transforms are then propagated in a single pass from the first node to the last, each
+// node reading the already computed world transform of its parent. Nodes refer to each other by index only.
+//
+// Changing a local transform marks the node dirty. The next update starts from the first dirty node and only
+// computes the nodes below a dirty one, the others are only checked.
+//
+// Normal matrices are composed like the transforms: the inverse transpose of a product is the product of the inverse
+// transposes. Each local transform comes with its own, usually cheaper to derive than from the matrix.
+class SceneGraph {
+public:
+    static constexpr std::uint32_t NO_PARENT = std::numeric_limits<std::uint32_t>::max();
+
+    // Appends a node, whose parent must already be in the graph. Returns its index.
+    std::uint32_t add(const glm::mat4 &local, const glm::mat3 &localNormal, std::uint32_t parent = NO_PARENT);
+
+    void setLocal(std::uint32_t node, const glm::mat4 &local, const glm::mat3 &localNormal);
+
+    // The parent must come before the node, so that no cycle can be made.
+    void setParent(std::uint32_t node, std::uint32_t parent);
+
+    // Removes the node with its descendants, the other nodes keep their order. Returns the new index of every node,
+    // NO_PARENT for the removed ones.
+    std::vector<std::uint32_t> remove(std::uint32_t node);
+
+    // Propagates the local transforms that changed. Returns the nodes whose world transform was computed, in order.
+    std::span<const std::uint32_t> update();
+
+    [[nodiscard]] std::size_t size() const { return m_parents.size(); }
+
+    [[nodiscard]] std::uint32_t getParent(const std::size_t node) const { return m_parents[node]; }
+
+    [[nodiscard]] const glm::mat4 &getLocal(const std::size_t node) const { return m_locals[node]; }
+
+    [[nodiscard]] const glm::mat4 &getWorld(const std::size_t node) const { return m_worlds[node]; }
+
+    [[nodiscard]] const glm::mat3 &getWorldNormal(const std::size_t node) const { return m_worldNormals[node]; }
+
+private:
+    std::vector<std::uint32_t> m_parents;
+    std::vector<glm::mat4> m_locals, m_worlds;
+    std::vector<glm::mat3> m_localNormals, m_worldNormals;
+    std::vector<std::uint8_t> m_dirty;
+    std::size_t m_firstDirty = 0; // size() when nothing is dirty
+    std::vector<std::uint32_t> m_updated;
+
+    void markDirty(std::uint32_t node);
+};
+
+#endif
@@ -0,0 +1,56 @@
+#define DBG_MACRO_NO_WARNING
+#include <dbg.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <imgui.h>
+
+#include "Vegetation.h"
+
+#include <numbers>
+#include <random>
+
+constexpr int MAX_BLADES = 500000;
+
+// The quad spans [0, 1] horizontally, from the root of the blade.
+Vegetation::Vegetation(const std::string &texturePath)
+    : m_field{texturePath, glm::vec2(0.0f, -0.5f), glm::vec2(1.0f, 0.5f)} {
+    scatter();
+}
+
+void Vegetation::widgets() {
+    if (ImGui::CollapsingHeader("Vegetation")) {
+        ImGui::Checkbox("Draw##Vegetation", &m_enabled);
+        ImGui::InputInt("Seed##Vegetation", &m_seed);
+        ImGui::SliderInt("Blades##Vegetation", &m_bladeCount, 0, MAX_BLADES);
+        ImGui::SliderFloat("Region size##Vegetation", &m_regionSize, 1.0f, 200.0f);
+        ImGui::SliderFloat("Chunk size##Vegetation", &m_chunkSize, 1.0f, 50.0f);
+        ImGui::SliderFloat("Ground height##Vegetation", &m_groundHeight, -10.0f, 10.0f);
+        if (ImGui::Button("Scatter"))
+            scatter();
+        ImGui::Text("Visible: %d / %zu chunks, %d blades", m_field.getVisibleChunks(), m_field.getChunkCount(),
+                    m_field.getVisibleInstances());
+    }
+}
+
+void Vegetation::scatter() {
+    std::uniform_real_distribution<float> angle(0.0f, std::numbers::pi_v<float>);
+    std::uniform_real_distribution<float> scale(0.6f, 1.4f);
+    const auto place = [&](const float x, const float z, std::mt19937 &rng) {
+        const auto rotation = angle(rng);
+        const auto size = scale(rng);
+        const glm::vec3 root(x, m_groundHeight, z);
+        // The quad spans [-0.5, 0.5] vertically, it is lifted so that it stands on the ground.
+        const auto center = root + glm::vec3(0.0f, 0.5f * size, 0.0f);
+        auto model = glm::translate(glm::mat4(1.0f), center);
+        model = glm::rotate(model, rotation, glm::vec3(0.0f, 1.0f, 0.0f));
+        model = glm::scale(model, glm::vec3(size));
+        return QuadField::Instance{model, center, {root - glm::vec3(size, 0.0f, size), root + glm::vec3(size)}};
+    };
+    m_field.scatter(m_seed, m_bladeCount, m_regionSize, m_chunkSize, place);
+}
+
+void Vegetation::submit(RenderQueue &queue, Shader *const shader, const Frustum &frustum) {
+    if (m_enabled)
+        m_field.submit(queue, shader, frustum);
+    else
+        m_field.clearStats();
+}
@@ -0,0 +1,34 @@
+#ifndef VEGETATION_H
+#define VEGETATION_H
+
+#include "Culling.h"
+#include "QuadField.h"
+#include "RenderQueue.h"
+#include "Shader.h"
+
+#include <string>
+
+// Grass blades of random size and orientation standing on the ground, in a quad field.
+class Vegetation {
+public:
+    explicit Vegetation(const std::string &texturePath);
+
+    void widgets();
+
+    // Same seed and settings give the same field.
+    void scatter();
+
+    void submit(RenderQueue &queue, Shader *shader, const Frustum &frustum);
+
+private:
+    QuadField m_field;
+
+    bool m_enabled = true;
+    int m_seed = 1;
+    int m_bladeCount = 20000;
+    float m_regionSize = 40.0f;
+    float m_chunkSize = 4.0f;
+    float m_groundHeight = -0.5f;
+};
+
+#endif
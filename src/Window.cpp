@@ -8,17 +8,23 @@
 #include "callbacks.h"
 
 #include <iostream>
+#include <utility>
 
 Window::Window(Application *const user, const int width, const int height,
                const std::string &title)
     : m_width{width}, m_height{height}, m_title{title},
       m_bgColor{glm::vec3(0.0f)} {
   glfwInit();
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-  m_window =
-      glfwCreateWindow(m_width, m_height, title.c_str(), nullptr, nullptr);
+  // GPU culling needs OpenGL 4.3, everything else runs on 3.3.
+  for (const auto &[major, minor] : {std::pair{4, 6}, std::pair{3, 3}}) {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, major);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minor);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    m_window =
+        glfwCreateWindow(m_width, m_height, title.c_str(), nullptr, nullptr);
+    if (m_window != nullptr)
+      break;
+  }
   if (m_window == nullptr) {
     glfwTerminate();
     throw std::runtime_error("Failed to create GLFW window");
@@ -6,6 +6,7 @@
 #include "Application.h"
 
 constexpr auto TOGGLE_FLASHLIGHT_BUTTON = GLFW_MOUSE_BUTTON_RIGHT;
+constexpr auto PICK_BUTTON = GLFW_MOUSE_BUTTON_LEFT;
 constexpr auto TOGGLE_CURSOR = GLFW_KEY_LEFT_SHIFT;
 
 void framebufferSizeCallback(GLFWwindow *window, const int width, const int height) {
@@ -37,9 +38,13 @@ void mouseCallback(GLFWwindow *window, double posX, double posY) {
 }
 
 void mouseButtonCallback(GLFWwindow *window, const int button, const int action, int) {
-    if (const auto app = static_cast<Application *>(glfwGetWindowUserPointer(window));
-        button == TOGGLE_FLASHLIGHT_BUTTON && action == GLFW_PRESS && app->getCursorLocked()) {
+    const auto app = static_cast<Application *>(glfwGetWindowUserPointer(window));
+    if (button == TOGGLE_FLASHLIGHT_BUTTON && action == GLFW_PRESS && app->getCursorLocked()) {
         app->toggleFlashLight();
+    } else if (button == PICK_BUTTON && action == GLFW_PRESS && !app->getCursorLocked()) {
+        double x, y;
+        glfwGetCursorPos(window, &x, &y);
+        app->pick(x, y);
     }
 }
 